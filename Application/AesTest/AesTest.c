@@ -165,6 +165,47 @@ struct {
   }
 };
 
+/**
+ * Test vectors from RFC 3394, sections 4.1 and 4.6
+ */
+STATIC
+struct {
+  UINTN KeySize;
+  UINT8 KEK[32];
+  UINTN Size;
+  UINT8 Key[32];
+  UINT8 Wrapped[40];
+} CONST TEST_WRAP[] = {
+  {
+    128,
+    { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+      0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f },
+    16,
+    { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+      0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff },
+    { 0x1f, 0xa6, 0x8b, 0x0a, 0x81, 0x12, 0xb4, 0x47,
+      0xae, 0xf3, 0x4b, 0xd8, 0xfb, 0x5a, 0x7b, 0x82,
+      0x9d, 0x3e, 0x86, 0x23, 0x71, 0xd2, 0xcf, 0xe5 },
+  },
+  {
+    256,
+    { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+      0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+      0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+      0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f },
+    32,
+    { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+      0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff,
+      0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+      0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f },
+    { 0x28, 0xc9, 0xf4, 0x04, 0xc4, 0xb8, 0x10, 0xf4,
+      0xcb, 0xcc, 0xb3, 0x5c, 0xfb, 0x87, 0xf8, 0x26,
+      0x3f, 0x57, 0x86, 0xe2, 0xd8, 0x0e, 0xd3, 0x26,
+      0xcb, 0xc7, 0xf0, 0xe7, 0x1a, 0x99, 0xf4, 0x3b,
+      0xfb, 0x98, 0x8b, 0x9b, 0x7a, 0x02, 0xdd, 0x21 },
+  }
+};
+
 /**
  The entry point for the application.
 
@@ -195,15 +236,76 @@ UefiMain(IN EFI_HANDLE        ImageHandle,
       (res) = 0;                                                      \
     }                                                                 \
   }                                                                   \
+}
+  // The vectors for each key size share a key, so can also be run through the
+  // multi-block functions.  Repeat them to fill more than one batch.
+#define TestBlocks(ks,res)                                              \
+{                                                                       \
+  UINTN       Count = sizeof(TEST_##ks)/sizeof(TEST_##ks[0]);           \
+  UINT8       P[16 * TEST_BLOCKS];                                      \
+  UINT8       C[16 * TEST_BLOCKS];                                      \
+  UINT8       Buffer[16 * TEST_BLOCKS];                                 \
+  AES_CONTEXT Context;                                                  \
+  UINTN       Idx;                                                      \
+  for(Idx = 0; Idx < TEST_BLOCKS; Idx++) {                              \
+    CopyMem(P + 16*Idx, TEST_##ks[Idx % Count].P, 16);                  \
+    CopyMem(C + 16*Idx, TEST_##ks[Idx % Count].C, 16);                  \
+  }                                                                     \
+  AesInitContext(ks, TEST_##ks[0].K, &Context);                         \
+  AesCipherBlocks(&Context, TEST_BLOCKS, P, Buffer);                    \
+  if(CompareMem(C, Buffer, sizeof(Buffer))) {                           \
+    Print(L"Failed on %u bit multi-block encryption test\n", ks);       \
+    (res) = FALSE;                                                      \
+  }                                                                     \
+  InvAesCipherBlocks(&Context, TEST_BLOCKS, C, Buffer);                 \
+  if(CompareMem(P, Buffer, sizeof(Buffer))) {                           \
+    Print(L"Failed on %u bit multi-block decryption test\n", ks);       \
+    (res) = FALSE;                                                      \
+  }                                                                     \
+}
+#define TEST_BLOCKS 19
+  // Unwrapping with a corrupted wrapped key must fail the integrity check.
+#define TestWrap(res)                                                   \
+{                                                                       \
+  UINTN       Idx;                                                      \
+  for(Idx = 0; Idx < sizeof(TEST_WRAP)/sizeof(TEST_WRAP[0]); Idx++) {  \
+    UINT8       Buffer[40];                                             \
+    AES_CONTEXT Context;                                                \
+    UINTN       Size = TEST_WRAP[Idx].Size;                             \
+    AesInitContext(TEST_WRAP[Idx].KeySize, TEST_WRAP[Idx].KEK, &Context); \
+    AesKeyWrap(&Context, Size, TEST_WRAP[Idx].Key, Buffer);             \
+    if(CompareMem(TEST_WRAP[Idx].Wrapped, Buffer, Size + 8)) {          \
+      Print(L"Failed on key wrap test %llu\n", Idx);                    \
+      (res) = FALSE;                                                    \
+    }                                                                   \
+    if(EFI_ERROR(AesKeyUnwrap(&Context, Size + 8,                       \
+                              TEST_WRAP[Idx].Wrapped, Buffer)) ||       \
+       CompareMem(TEST_WRAP[Idx].Key, Buffer, Size)) {                  \
+      Print(L"Failed on key unwrap test %llu\n", Idx);                  \
+      (res) = FALSE;                                                    \
+    }                                                                   \
+    CopyMem(Buffer, TEST_WRAP[Idx].Wrapped, Size + 8);                  \
+    Buffer[Size + 7] ^= 1;                                              \
+    if(AesKeyUnwrap(&Context, Size + 8, Buffer, Buffer) !=              \
+       EFI_SECURITY_VIOLATION) {                                        \
+      Print(L"Failed on key unwrap integrity test %llu\n", Idx);        \
+      (res) = FALSE;                                                    \
+    }                                                                   \
+  }                                                                     \
 }
   BOOLEAN Res128 = TRUE;
   BOOLEAN Res192 = TRUE;
   BOOLEAN Res256 = TRUE;
+  BOOLEAN ResWrap = TRUE;
   Test(128, Res128);
   Test(192, Res192);
   Test(256, Res256);
+  TestBlocks(128, Res128);
+  TestBlocks(192, Res192);
+  TestBlocks(256, Res256);
+  TestWrap(ResWrap);
 
-  if(Res128 && Res192 && Res256)
+  if(Res128 && Res192 && Res256 && ResWrap)
     Print(L"All tests passed!\n");
   else
     Print(L"Some tests failed!\n");
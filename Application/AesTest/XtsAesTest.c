@@ -1987,6 +1987,71 @@ UefiMain(IN EFI_HANDLE        ImageHandle,
       Success = FALSE;
     }
   }
+  // Feed each vector through the stream functions in awkwardly sized pieces
+  for(Idx = 0; Idx < sizeof(TESTS)/sizeof(TESTS[0]); Idx++) {
+    UINT8           Buffer[sizeof(TESTS[0].P)];
+    UINT8 CONST    *Src;
+    XTS_AES_CONTEXT Context;
+    XTS_AES_STREAM  Stream;
+    UINTN           Done;
+    UINTN           Piece;
+    UINTN           Used;
+    UINTN           Out;
+    UINTN           Dir;
+    XtsAesInitContext(TESTS[Idx].KeySize, TESTS[Idx].K, &Context);
+    for(Dir = 0; Dir < 2; Dir++) {
+      Src = Dir ? TESTS[Idx].C : TESTS[Idx].P;
+      XtsAesStreamInit(&Stream, &Context, TESTS[Idx].IV, 0 == Dir);
+      Out = 0;
+      for(Done = 0; Done < TESTS[Idx].DataSize; Done += Piece) {
+        Piece = MIN(TESTS[Idx].DataSize - Done, 7 + 10 * Dir);
+        XtsAesStreamUpdate(&Stream, Piece, Src + Done, Buffer + Out, &Used);
+        Out += Used;
+      }
+      XtsAesStreamFinal(&Stream, Buffer + Out, &Used);
+      Out += Used;
+      if(Out != TESTS[Idx].DataSize ||
+         CompareMem(Buffer, Dir ? TESTS[Idx].P : TESTS[Idx].C, Out)) {
+        Print(L"Failed on XTS-AES stream %s test %lu\n",
+              Dir ? L"decryption" : L"encryption", Idx + 1);
+        Success = FALSE;
+      }
+    }
+  }
+  // Vectors 4 to 6 are data units 0 to 2 under the same key
+  {
+    UINT8 Plain[3 * sizeof(TESTS[0].P)];
+    UINT8 Cipher[3 * sizeof(TESTS[0].C)];
+    UINT8 Buffer[3 * sizeof(TESTS[0].P)];
+    for(Idx = 0; Idx < 3; Idx++) {
+      CopyMem(Plain + Idx * 512, TESTS[3 + Idx].P, 512);
+      CopyMem(Cipher + Idx * 512, TESTS[3 + Idx].C, 512);
+    }
+    XtsAesCipherDataUnits(256, TESTS[3].K, 0, 512,
+                          sizeof(Plain), Plain, Buffer);
+    if(CompareMem(Buffer, Cipher, sizeof(Cipher))) {
+      Print(L"Failed on XTS-AES data unit encryption test\n");
+      Success = FALSE;
+    }
+    InvXtsAesCipherDataUnits(256, TESTS[3].K, 1, 512,
+                             2 * 512, Cipher + 512, Buffer);
+    if(CompareMem(Buffer, Plain + 512, 2 * 512)) {
+      Print(L"Failed on XTS-AES data unit decryption test\n");
+      Success = FALSE;
+    }
+  }
+  // Decrypt the second half of vector 4 without the first half
+  {
+    UINT8           Buffer[256];
+    XTS_AES_CONTEXT Context;
+    XtsAesInitContext(TESTS[3].KeySize, TESTS[3].K, &Context);
+    InvXtsAesCipherBlocksAt(&Context, TESTS[3].IV, 16,
+                            sizeof(Buffer), TESTS[3].C + 256, Buffer);
+    if(CompareMem(Buffer, TESTS[3].P + 256, sizeof(Buffer))) {
+      Print(L"Failed on XTS-AES random access test\n");
+      Success = FALSE;
+    }
+  }
   if(Success)
     Print(L"All XTS-AES tests passed!\n");
   else
@@ -496,25 +496,38 @@ FreeFV2Volumes(IN UINTN       VolumeCount,
                IN FV2_VOLUME *Volumes)
 {
   UINTN Index;
-  for(Index = 0; Index < VolumeCount; Index++)
+  for(Index = 0; Index < VolumeCount; Index++) {
     gBS->FreePool(Volumes[Index].BootLoaderDevPath);
+    if(Volumes[Index].XtsAesContext) {
+      // Zero expanded key before freeing
+      gBS->SetMem(Volumes[Index].XtsAesContext, sizeof(XTS_AES_CONTEXT), 0);
+      gBS->FreePool(Volumes[Index].XtsAesContext);
+    }
+    FreeCryptoUserIndex(&Volumes[Index].UserIndex);
+  }
   gBS->FreePool(Volumes);
 }
 
 /**
   Get the XTS-AES key used by the EncryptedRoot.plist.wipekey file.
- 
+
+  The size of the key is read from the volume header along with the key, and
+  only the sizes XTS-AES can use are accepted, so that a damaged header cannot
+  make this read past the end of the header block.
+
   @param  FV2Volume   Pointer to the FV2 volume to get the key from.
   @param  KeySize     On entry, size of the Key buffer in bytes.
                       On exit, the size of the Key in bytes.
   @param  Key         Buffer in which to store the key.
- 
+
   @retval EFI_SUCCESS           The key was copied to the buffer successfully,
   @retval EFI_BUFFER_TOO_SMALL  The buffer was too small to store the key.
                                 The required size is returned in KeySize.
   @retval EFI_NOT_FOUND         The key could not be found/read.
+  @retval EFI_UNSUPPORTED       The key is not a supported size.
   @retval EFI_INVALID_PARAMETER One or more of the parameters are invalid.
  */
+STATIC
 EFI_STATUS
 EFIAPI
 GetXtsAesKey(IN     FV2_VOLUME *FV2Volume,
@@ -533,21 +546,83 @@ GetXtsAesKey(IN     FV2_VOLUME *FV2Volume,
                          (VOID**)&Block,
                          &BlockSize,
                          NULL);
-  if(!EFI_ERROR(Status) && BlockSize > 168 + sizeof(UINT32)) {
-    // Key Size is at offset 168.
-    // Should always be 16, but use on-disk value just in case.
-    // Size is doubled to account for both keys.
-    Size = (*(UINT32*)(Block + 168)) * 2;
-    if(*KeySize >= Size && BlockSize > 176 + Size)
-      gBS->CopyMem(Key, Block + 176,  Size);
-    else
+  if(EFI_ERROR(Status))
+    return EFI_NOT_FOUND;
+
+  // Key Size is at offset 168.
+  // Should always be 16, but use on-disk value just in case, as long as it
+  // is an AES key size that XTS-AES supports.
+  // Size is doubled to account for both keys.
+  Size = 0;
+  if(BlockSize < 168 + sizeof(UINT32))
+    Status = EFI_NOT_FOUND;
+  else {
+    Size = *(UINT32*)(Block + 168);
+    if(16 != Size && 32 != Size)
+      Status = EFI_UNSUPPORTED;
+    else if(BlockSize < 176 + 2 * Size)
+      Status = EFI_NOT_FOUND;
+    else if(*KeySize < 2 * Size)
       Status = EFI_BUFFER_TOO_SMALL;
-    *KeySize = Size;
-    // Zero buffer ...
-    gBS->SetMem(Block, BlockSize, 0);
-    gBS->FreePool(Block);
+    else
+      gBS->CopyMem(Key, Block + 176, 2 * Size);
   }
-  else
-    Status = EFI_NOT_FOUND;
+  *KeySize = 2 * Size;
+  // Zero buffer ...
+  gBS->SetMem(Block, BlockSize, 0);
+  gBS->FreePool(Block);
   return Status;
 }
+
+/**
+  Get the expanded XTS-AES key used by the EncryptedRoot.plist.wipekey file.
+
+  The key is read from the volume header and expanded on the first call, and
+  kept with the volume until it is freed by FreeFV2Volumes, so later calls do
+  not need to read from the disk.
+
+  @param  FV2Volume   Pointer to the FV2 volume to get the key from.
+  @param  Context     Location to store pointer to the expanded key.
+
+  @retval EFI_SUCCESS           The key was found and expanded.
+  @retval EFI_NOT_FOUND         The key could not be found/read.
+  @retval EFI_UNSUPPORTED       The key is not a supported size.
+  @retval EFI_OUT_OF_RESOURCES  There is not enough memory to hold the key.
+  @retval EFI_INVALID_PARAMETER One or more of the parameters are invalid.
+ */
+EFI_STATUS
+EFIAPI
+GetXtsAesContext(IN  FV2_VOLUME             *FV2Volume,
+                 OUT XTS_AES_CONTEXT CONST **Context)
+{
+  EFI_STATUS       Status;
+  UINT8            Key[64];
+  UINTN            KeySize;
+  XTS_AES_CONTEXT *NewContext;
+
+  if(!FV2Volume || !Context)
+    return EFI_INVALID_PARAMETER;
+
+  if(!FV2Volume->XtsAesContext) {
+    // GetXtsAesKey only returns the key sizes XtsAesInitContext accepts, and
+    // Key is large enough for the largest, so once it succeeds the key can be
+    // expanded without any further checks
+    KeySize = sizeof(Key);
+    Status = GetXtsAesKey(FV2Volume, &KeySize, Key);
+    if(!EFI_ERROR(Status))
+      Status = gBS->AllocatePool(EfiBootServicesData,
+                                 sizeof(*NewContext),
+                                 (VOID**)&NewContext);
+    if(!EFI_ERROR(Status)) {
+      XtsAesInitContext(KeySize * 8, Key, NewContext);
+      FV2Volume->XtsAesContext = NewContext;
+    }
+    // Zero key
+    gBS->SetMem(Key, sizeof(Key), 0);
+    if(EFI_ERROR(Status))
+      return Status;
+  }
+
+  *Context = FV2Volume->XtsAesContext;
+  return EFI_SUCCESS;
+}
@@ -29,12 +29,16 @@
 #define __FV2_H__
 
 #include <Uefi.h>
+#include <Library/Aes.h>
 #include <Protocol/DevicePath.h>
+#include "FV2PlistFilter.h"
 
 typedef struct _FV2_VOLUME {
   EFI_HANDLE                CSVolumeHandle;
   EFI_HANDLE                BootVolumeHandle;
   EFI_DEVICE_PATH_PROTOCOL *BootLoaderDevPath;
+  XTS_AES_CONTEXT          *XtsAesContext;
+  CRYPTO_USER_INDEX         UserIndex;
 } FV2_VOLUME;
 
 /**
@@ -66,22 +70,24 @@ FreeFV2Volumes(IN UINTN       VolumeCount,
                IN FV2_VOLUME *Volumes);
 
 /**
-  Get the XTS-AES key used by the EncryptedRoot.plist.wipekey file.
+  Get the expanded XTS-AES key used by the EncryptedRoot.plist.wipekey file.
+
+  The key is read from the volume header and expanded on the first call, and
+  kept with the volume until it is freed by FreeFV2Volumes, so later calls do
+  not need to read from the disk.
 
   @param  FV2Volume   Pointer to the FV2 volume to get the key from.
-  @param  KeySize     On entry, size of the Key buffer in bytes.
-                      On exit, the size of the Key in bytes.
-  @param  Key         Buffer in which to store the key.
+  @param  Context     Location to store pointer to the expanded key.
 
-  @retval EFI_SUCCESS           The key was copied to the buffer successfully,
-  @retval EFI_BUFFER_TOO_SMALL  The buffer was too small to store the key.
-                                The required size is returned in KeySize.
+  @retval EFI_SUCCESS           The key was found and expanded.
   @retval EFI_NOT_FOUND         The key could not be found/read.
+  @retval EFI_UNSUPPORTED       The key is not a supported size.
+  @retval EFI_OUT_OF_RESOURCES  There is not enough memory to hold the key.
+  @retval EFI_INVALID_PARAMETER One or more of the parameters are invalid.
  */
 EFI_STATUS
 EFIAPI
-GetXtsAesKey(IN     FV2_VOLUME *FV2Volume,
-             IN OUT UINTN      *KeySize,
-             IN     UINT8      *Key);
+GetXtsAesContext(IN  FV2_VOLUME             *FV2Volume,
+                 OUT XTS_AES_CONTEXT CONST **Context);
 
 #endif
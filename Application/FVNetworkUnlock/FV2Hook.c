@@ -40,6 +40,7 @@
 
 #define REQUIRED_FILE         L"EncryptedRoot.plist.wipekey"
 #define REQUIRED_FILE_LENGTH  ((sizeof(REQUIRED_FILE) / 2) - 1)
+#define WINDOW_SIZE           (64 * 1024)
 
 /**
   Internal type holding information about open files.
@@ -131,6 +132,139 @@ FreeFile(IN HOOKED_FILE* Node)
   gBS->FreePool(Node);
 }
 
+/**
+  Read, decrypt, filter and re-encrypt the EncryptedRoot.plist.wipekey file.
+
+  Rather than making separate passes over the whole file for each step, the
+  file is worked through in windows of WINDOW_SIZE bytes.  Each window is read
+  and decrypted, passed to the plist filter, and whatever part of the filtered
+  file is then final is re-encrypted, while it is all still in the cache.  All
+  of this is done in place in FileData: the decrypted data trails the data
+  read and the re-encrypted data trails that.  The filter does not move any
+  data, but gives the ranges of the decrypted data that make up the filtered
+  file, and these are re-encrypted straight from where they are.
+
+  @param  File          The EFI_FILE_PROTOCOL for the file.
+  @param  Key           Pointer to the expanded XTS-AES key.
+  @param  Index         The index of the users in the file, used by the filter
+                        if it is complete, and built by it otherwise.
+  @param  FileSize      Size of the file.
+  @param  FileData      Buffer of FileSize bytes.  On success, this holds the
+                        re-encrypted filtered file.
+  @param  NewFileSize   On success, the size of the filtered file.
+
+  @retval EFI_SUCCESS           The file was filtered.
+  @retval EFI_INVALID_PARAMETER The file was not a plist.
+  @return Any error from reading the file, decrypting it or filtering it.
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+FilterEncryptedFile(IN     EFI_FILE_PROTOCOL     *File,
+                    IN     XTS_AES_CONTEXT CONST *Key,
+                    IN OUT CRYPTO_USER_INDEX     *Index,
+                    IN     UINTN                  FileSize,
+                    IN OUT UINT8                 *FileData,
+                    OUT    UINTN                 *NewFileSize)
+{
+  XTS_AES_STREAM     Decrypt;
+  XTS_AES_STREAM     Encrypt;
+  PLIST_FILTER       Filter;
+  PLIST_RANGE CONST *Ranges;
+  EFI_STATUS         Status;
+  UINT8              Tweak[16] = {0};
+  UINTN              ReadSize;
+  UINTN              DecryptedSize;
+  UINTN              FilteredSize;
+  UINTN              EncryptedSize;
+  UINTN              WindowSize;
+  UINTN              ProcessedSize;
+  UINTN              RangeCount;
+  UINTN              Range;
+  UINTN              RangeUsed;
+  UINTN              Length;
+  BOOLEAN            End;
+
+  ReadSize      = 0;
+  DecryptedSize = 0;
+  FilteredSize  = 0;
+  EncryptedSize = 0;
+  Range         = 0;
+  RangeUsed     = 0;
+  End           = FALSE;
+  PlistFilterInit(&Filter, Index);
+  Status = XtsAesStreamInit(&Decrypt, Key, Tweak, FALSE);
+  if(!EFI_ERROR(Status))
+    Status = XtsAesStreamInit(&Encrypt, Key, Tweak, TRUE);
+  while(!EFI_ERROR(Status) && !End) {
+    // Read and decrypt the next window
+    WindowSize = MIN(FileSize - ReadSize, WINDOW_SIZE);
+    Status = File->Read(File, &WindowSize, FileData + ReadSize);
+    if(EFI_ERROR(Status))
+      break;
+    End = 0 == WindowSize || FileSize == ReadSize + WindowSize;
+    XtsAesStreamUpdate(&Decrypt,
+                       WindowSize,
+                       FileData + ReadSize,
+                       FileData + DecryptedSize,
+                       &ProcessedSize);
+    ReadSize      += WindowSize;
+    DecryptedSize += ProcessedSize;
+    if(End) {
+      Status = XtsAesStreamFinal(&Decrypt,
+                                 FileData + DecryptedSize,
+                                 &ProcessedSize);
+      DecryptedSize += ProcessedSize;
+      if(EFI_ERROR(Status))
+        break;
+    }
+
+    // Make sure that this is a plist before changing anything
+    if(0 == FilteredSize && (DecryptedSize >= 5 || End) &&
+       (DecryptedSize < 5 || AsciiStrnCmp((CHAR8*)FileData, "<?xml", 5))) {
+      Status = EFI_INVALID_PARAMETER;
+      break;
+    }
+
+    // Filter it, and re-encrypt what the filter has finished with.  Each
+    // range starts no earlier than its place in the filtered file, so the
+    // encrypted data never overwrites a range before it has been encrypted.
+    Status = PlistFilterUpdate(&Filter,
+                               (CHAR8*)FileData,
+                               DecryptedSize,
+                               End,
+                               &Ranges,
+                               &RangeCount);
+    if(EFI_ERROR(Status))
+      break;
+    for(; Range < RangeCount; Range++, RangeUsed = 0) {
+      Length = Ranges[Range].Length - RangeUsed;
+      XtsAesStreamUpdate(&Encrypt,
+                         Length,
+                         FileData + Ranges[Range].Offset + RangeUsed,
+                         FileData + EncryptedSize,
+                         &ProcessedSize);
+      RangeUsed     += Length;
+      FilteredSize  += Length;
+      EncryptedSize += ProcessedSize;
+      // The last range may still grow
+      if(Range + 1 == RangeCount)
+        break;
+    }
+    if(End) {
+      Status = XtsAesStreamFinal(&Encrypt,
+                                 FileData + EncryptedSize,
+                                 &ProcessedSize);
+      EncryptedSize += ProcessedSize;
+    }
+  }
+  gBS->SetMem(&Decrypt, sizeof(Decrypt), 0);
+  gBS->SetMem(&Encrypt, sizeof(Encrypt), 0);
+  *NewFileSize = EncryptedSize;
+
+  return Status;
+}
+
 /**
   Process the EncryptedRoot.plist.wipekey file.
  
@@ -182,48 +316,34 @@ ProcessEncRootPlist(IN EFI_FILE_PROTOCOL *File,
                                FileSize,
                                (VOID**)&FileData);
     if(!EFI_ERROR(Status)) {
-      Status = File->Read(File, &FileSize, FileData);
+      XTS_AES_CONTEXT CONST *Key;
+      Status = GetXtsAesContext(Volume, &Key);
       if(!EFI_ERROR(Status)) {
-        UINT8 Key[512/8];
-        UINT8 Tweak[16] = {0};
-        UINTN KeySize   = sizeof(Key);
-        Status = GetXtsAesKey(Volume, &KeySize, Key);
+        UINTN NewFileSize;
+        // An index of a different file cannot be used
+        if(Volume->UserIndex.FileSize != FileSize)
+          FreeCryptoUserIndex(&Volume->UserIndex);
+        Status = FilterEncryptedFile(File,
+                                     Key,
+                                     &Volume->UserIndex,
+                                     FileSize,
+                                     FileData,
+                                     &NewFileSize);
         if(!EFI_ERROR(Status)) {
-          Status = InvXtsAesCipher(KeySize * 8,
-                                   Key,
-                                   Tweak,
-                                   FileSize,
-                                   FileData,
-                                   FileData);
-          if(!EFI_ERROR(Status)) {
-            if(!AsciiStrnCmp((CHAR8*)FileData, "<?xml", 5)) {
-              UINTN NewFileSize = PlistFilter(FileData, FileSize, FileData);
-              XtsAesCipher(KeySize * 8,
-                           Key,
-                           Tweak,
-                           NewFileSize,
-                           FileData,
-                           FileData);
-              Status = CreateFile(File, NewFileSize, FileData);
-              // Zero out end of buffer to remove decrypted data
-              gBS->SetMem(FileData + NewFileSize, FileSize - NewFileSize, 0);
-            }
-            else
-              Status = EFI_INVALID_PARAMETER;
-          }
-          if(EFI_ERROR(Status)) {
-            gBS->FreePool(FileData);
-            Print(L"Processing of EncryptedRoot.plist.wipekey failed - %r\n",
-                  Status);
-          }
-          // Zero out key
-          gBS->SetMem(Key, sizeof(Key), 0);
+          Status = CreateFile(File, NewFileSize, FileData);
+          // Zero out end of buffer to remove decrypted data
+          gBS->SetMem(FileData + NewFileSize, FileSize - NewFileSize, 0);
+        }
+        if(EFI_ERROR(Status)) {
+          // Zero out any decrypted data
+          gBS->SetMem(FileData, FileSize, 0);
+          gBS->FreePool(FileData);
+          Print(L"Processing of EncryptedRoot.plist.wipekey failed - %r\n",
+                Status);
         }
-        else
-          Print(L"Failed to get decryptio key - %r\n", Status);
       }
       else
-        Print(L"Failed to read EncryptedRoot.plist.wipekey - %r\n", Status);
+        Print(L"Failed to get decryptio key - %r\n", Status);
     }
     else
       Print(L"AllocatePool failed - %r\n", Status);
@@ -352,7 +472,7 @@ ReadCB(IN     EFI_FILE_PROTOCOL *This,
   if(Node) {
     Count = MIN(*BufferSize, Node->Size - Node->Offset);
     if(Count) {
-      gBS->CopyMem(Buffer, Node->Data, Count);
+      gBS->CopyMem(Buffer, (UINT8*)Node->Data + Node->Offset, Count);
       Node->Offset += Count;
     }
     *BufferSize = Count;
@@ -0,0 +1,215 @@
+/**
+ * Copyright (c) 2015, baskingshark
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <Uefi.h>
+#include <Library/Aes.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include "FileLoad.h"
+#include "FV2.h"
+#include "FV2Passphrase.h"
+#include "FV2PlistFilter.h"
+#include "Pbkdf2.h"
+
+#define WIPEKEY_FILE  \
+  L"\\System\\Library\\Caches\\com.apple.corestorage\\EncryptedRoot.plist.wipekey"
+
+/**
+  Layout of the PassphraseWrappedKEKStruct.
+
+  The KEK is wrapped (RFC 3394) with an AES-128 key derived from the password
+  using PBKDF2-HMAC-SHA256 with the given salt and iteration count.
+ */
+#define KEK_STRUCT_SIZE         284
+#define KEK_SALT_OFFSET         8
+#define KEK_SALT_SIZE           16
+#define KEK_WRAPPED_OFFSET      24
+#define KEK_WRAPPED_SIZE        24
+#define KEK_ITERATIONS_OFFSET   168
+#define KEK_DERIVED_KEY_SIZE    16
+
+/**
+  Unwrap the KEK of a PassphraseWrappedKEKStruct with a password.
+
+  @param  KekStruct       The decoded PassphraseWrappedKEKStruct.
+  @param  Password        The password.
+  @param  PasswordLength  The length of the password.
+
+  @retval EFI_SUCCESS             The password unlocks the structure.
+  @retval EFI_SECURITY_VIOLATION  The password does not unlock the structure.
+  @retval EFI_UNSUPPORTED         The structure is not in a recognised format.
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+UnwrapKekStruct(IN UINT8 CONST *KekStruct,
+                IN CONST CHAR8 *Password,
+                IN UINTN        PasswordLength)
+{
+  EFI_STATUS  Status;
+  AES_CONTEXT Context;
+  UINT8       DerivedKey[KEK_DERIVED_KEY_SIZE];
+  UINT8       Kek[KEK_WRAPPED_SIZE - 8];
+  UINT32      Iterations;
+
+  Iterations = ((UINT32)KekStruct[KEK_ITERATIONS_OFFSET + 0] <<  0) |
+               ((UINT32)KekStruct[KEK_ITERATIONS_OFFSET + 1] <<  8) |
+               ((UINT32)KekStruct[KEK_ITERATIONS_OFFSET + 2] << 16) |
+               ((UINT32)KekStruct[KEK_ITERATIONS_OFFSET + 3] << 24);
+  Status = Pbkdf2HmacSha256((CONST UINT8*)Password,
+                            PasswordLength,
+                            KekStruct + KEK_SALT_OFFSET,
+                            KEK_SALT_SIZE,
+                            Iterations,
+                            sizeof(DerivedKey),
+                            DerivedKey);
+  if(EFI_INVALID_PARAMETER == Status)
+    Status = EFI_UNSUPPORTED;
+  if(!EFI_ERROR(Status))
+    Status = AesInitContext(sizeof(DerivedKey) * 8, DerivedKey, &Context);
+  if(!EFI_ERROR(Status)) {
+    // Fails the integrity check unless the password is correct
+    Status = AesKeyUnwrap(&Context,
+                          KEK_WRAPPED_SIZE,
+                          KekStruct + KEK_WRAPPED_OFFSET,
+                          Kek);
+    SetMem(&Context, sizeof(Context), 0);
+  }
+  SetMem(DerivedKey, sizeof(DerivedKey), 0);
+  SetMem(Kek, sizeof(Kek), 0);
+  return Status;
+}
+
+/**
+  Check a password against the EncryptedRoot.plist.wipekey file of a volume.
+
+  The wipekey is decrypted and the PassphraseWrappedKEKStruct of each user
+  that will be kept by the filter is unwrapped with a key derived from the
+  password, until one of them is unlocked.  This must be called before the
+  volume is hooked, so that the original file is read.  The index of the
+  users built here is kept with the volume for the filter to use.
+
+  @param  Volume          The FileVault 2 volume to check against.
+  @param  Password        The contents of the password file.  Anything from
+                          the first CR or LF onwards is ignored.
+  @param  PasswordLength  The length of the password file.
+
+  @retval EFI_SUCCESS             The password unlocks one of the kept users.
+  @retval EFI_SECURITY_VIOLATION  The password does not unlock any of the kept
+                                  users.
+  @retval EFI_NOT_FOUND           The wipekey, the key used to decrypt it, or
+                                  a user to keep could not be found.
+  @retval EFI_UNSUPPORTED         The wipekey is not in a recognised format.
+  @retval EFI_INVALID_PARAMETER   One or more of the parameters are invalid.
+  @retval EFI_OUT_OF_RESOURCES    There is not enough memory to index the
+                                  users.
+  @retval ...                     Errors from loading the wipekey may also be
+                                  returned.
+ */
+EFI_STATUS
+EFIAPI
+VerifyPassword(IN FV2_VOLUME  *Volume,
+               IN CONST CHAR8 *Password,
+               IN UINTN        PasswordLength)
+{
+  EFI_STATUS             Status;
+  EFI_STATUS             UserStatus;
+  XTS_AES_CONTEXT CONST *XtsKey;
+  CRYPTO_USER CONST     *User;
+  UINT8                  Tweak[16] = {0};
+  UINT8                  KekStruct[KEK_STRUCT_SIZE];
+  UINTN                  KekSize;
+  UINTN                  FileSize;
+  UINT8                 *FileData;
+  UINTN                  Idx;
+
+  if(!Volume || (PasswordLength && !Password))
+    return EFI_INVALID_PARAMETER;
+
+  // The password file ends with the return key, which is not part of the
+  // password itself
+  for(Idx = 0; Idx < PasswordLength; Idx++)
+    if('\r' == Password[Idx] || '\n' == Password[Idx])
+      break;
+  PasswordLength = Idx;
+
+  Status = LoadFile(Volume->BootVolumeHandle,
+                    (CHAR16*)WIPEKEY_FILE,
+                    &FileSize,
+                    (VOID**)&FileData);
+  if(EFI_ERROR(Status))
+    return Status;
+
+  Status = GetXtsAesContext(Volume, &XtsKey);
+  if(!EFI_ERROR(Status))
+    Status = InvXtsAesCipherUnit(XtsKey,
+                                 Tweak,
+                                 FileSize,
+                                 FileData,
+                                 FileData);
+  if(!EFI_ERROR(Status) && (FileSize < 5 || CompareMem(FileData, "<?xml", 5)))
+    Status = EFI_UNSUPPORTED;
+
+  if(!EFI_ERROR(Status))
+    Status = BuildCryptoUserIndex((CHAR8*)FileData,
+                                  FileSize,
+                                  &Volume->UserIndex);
+
+  // The password need only unlock one of the kept users.  Otherwise a wrong
+  // password is reported in preference to any other problem with a user.
+  if(!EFI_ERROR(Status)) {
+    Status = EFI_NOT_FOUND;
+    for(Idx = 0; Idx < Volume->UserIndex.Count; Idx++) {
+      User = Volume->UserIndex.Users + Idx;
+      if(!User->Keep)
+        continue;
+      KekSize = sizeof(KekStruct);
+      UserStatus = GetWrappedKekStruct((CHAR8*)FileData,
+                                       User,
+                                       KekStruct,
+                                       &KekSize);
+      if(EFI_BUFFER_TOO_SMALL == UserStatus ||
+         EFI_INVALID_PARAMETER == UserStatus ||
+         (!EFI_ERROR(UserStatus) && KekSize != KEK_STRUCT_SIZE))
+        UserStatus = EFI_UNSUPPORTED;
+      if(!EFI_ERROR(UserStatus))
+        UserStatus = UnwrapKekStruct(KekStruct, Password, PasswordLength);
+      if(!EFI_ERROR(UserStatus)) {
+        Status = UserStatus;
+        break;
+      }
+      if(EFI_SECURITY_VIOLATION != Status)
+        Status = UserStatus;
+    }
+  }
+
+  // Zero out decrypted data
+  SetMem(KekStruct, sizeof(KekStruct), 0);
+  SetMem(FileData, FileSize, 0);
+  gBS->FreePool(FileData);
+  return Status;
+}
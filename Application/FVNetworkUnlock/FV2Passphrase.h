@@ -0,0 +1,65 @@
+/**
+ * Copyright (c) 2015, baskingshark
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __FV2_PASSPHRASE_H__
+#define __FV2_PASSPHRASE_H__
+
+#include <Uefi.h>
+#include "FV2.h"
+
+/**
+  Check a password against the EncryptedRoot.plist.wipekey file of a volume.
+
+  The wipekey is decrypted and the PassphraseWrappedKEKStruct of each user
+  that will be kept by the filter is unwrapped with a key derived from the
+  password, until one of them is unlocked.  This must be called before the
+  volume is hooked, so that the original file is read.
+
+  @param  Volume          The FileVault 2 volume to check against.
+  @param  Password        The contents of the password file.  Anything from
+                          the first CR or LF onwards is ignored.
+  @param  PasswordLength  The length of the password file.
+
+  @retval EFI_SUCCESS             The password unlocks one of the kept users.
+  @retval EFI_SECURITY_VIOLATION  The password does not unlock any of the kept
+                                  users.
+  @retval EFI_NOT_FOUND           The wipekey, the key used to decrypt it, or
+                                  a user to keep could not be found.
+  @retval EFI_UNSUPPORTED         The wipekey is not in a recognised format.
+  @retval EFI_INVALID_PARAMETER   One or more of the parameters are invalid.
+  @retval EFI_OUT_OF_RESOURCES    There is not enough memory to index the
+                                  users.
+  @retval ...                     Errors from loading the wipekey may also be
+                                  returned.
+ */
+EFI_STATUS
+EFIAPI
+VerifyPassword(IN FV2_VOLUME  *Volume,
+               IN CONST CHAR8 *Password,
+               IN UINTN        PasswordLength);
+
+#endif
@@ -27,50 +27,14 @@
 
 #include <Uefi.h>
 #include <Library/UefiBootServicesTableLib.h>
+#include "FV2PlistFilter.h"
+#include "FV2UserPolicy.h"
 
 /**
   Library routines.
   Replacements for and additions to string routines in MdePkg.
  */
 
-/**
-  Return the length of a NULL-terminated ASCII string.
-
-  @param  String The pointer to the NULL-terminated string.
-
-  @return The length of the string.
- */
-STATIC
-UINTN
-EFIAPI
-AsciiStrLen(IN CHAR8 CONST *String)
-{
-  UINTN Length;
-  for(Length = 0; *String++; Length++)
-    ;
-  return Length;
-}
-
-/**
-  Return the length of a NULL-terminated ASCII string with a maximum length.
-
-  @param  String    The pointer to the NULL-terminated string.
-  @param  MaxLength The maximum allowed length of the string.
-
-  @return The length of the string, or MaxLength if a NULL was not found.
- */
-STATIC
-UINTN
-EFIAPI
-AsciiStrnLen(IN CHAR8 CONST *String,
-             IN UINTN        MaxLength)
-{
-  UINTN Length;
-  for(Length = 0; Length < MaxLength && *String++; Length++)
-    ;
-  return Length;
-}
-
 /**
   Compares two Null-terminated ASCII strings with maximum lengths.
 
@@ -98,178 +62,290 @@ AsciiStrnCmp(IN CHAR8 CONST *String1,
   return *String1 - *String2;
 }
 
+
 /**
-  Returns the first occurrence of a NULL-terminated ASCII string in a NULL-
-  terminated ASCII string with a limit on the number of characters searched.
+  Macro Definitions ...
 
-  @param  String        The pointer to a NULL-terminated string.
-  @param  SearchString  The pointer to the NULL-terminated string to search for.
-  @param  MaxLength     The maximum number of characters to search
+  ONES          A word with each byte set to 0x01
+  HIGHS         A word with each byte set to 0x80
+  HasZeroByte   Check whether any byte of a word is zero
+ */
 
-  @return A pointer to the first character of the first occurrence of
-          SearchString is returned, or NULL if SearchString is not found.
+#define ONES              ((UINTN)-1 / 0xFF)
+#define HIGHS             (ONES << 7)
+#define HasZeroByte(Word) ((((Word) - ONES) & ~(Word)) & HIGHS)
+
+/**
+  Find the next occurrence of a character in a buffer.
+
+  Most of the plist file is text between tags, such as the base64 data of the
+  wrapped keys, so the buffer is searched two words at a time, and only the
+  pair of words holding the character is searched a byte at a time.
+
+  @param  Buffer  The buffer to search.
+  @param  Offset  The offset in Buffer to start searching from.
+  @param  Size    The size of the buffer.
+  @param  Char    The character to search for.
+
+  @return The offset of the character, or Size if it was not found.
  */
 STATIC
-CHAR8*
+UINTN
 EFIAPI
-AsciiStrnStr(IN CHAR8 CONST *String,
-             IN CHAR8 CONST *SearchString,
-             IN UINTN        MaxLength)
+FindChar(IN CHAR8 CONST *Buffer,
+         IN UINTN        Offset,
+         IN UINTN        Size,
+         IN CHAR8        Char)
 {
-  UINTN SearchStringLen;
-  UINTN Idx;
-
-  if(!SearchString || !(SearchStringLen = AsciiStrLen(SearchString)))
-    return (char *)String;
-
-  MaxLength = AsciiStrnLen(String, MaxLength);
-  MaxLength = SearchStringLen < MaxLength? MaxLength - SearchStringLen : 0;
+  UINTN CONST *Words;
+  UINTN        Pattern;
+
+  // Up to a word boundary
+  for(; Offset < Size && ((UINTN)(Buffer + Offset) & (sizeof(UINTN) - 1));
+      Offset++)
+    if(Char == Buffer[Offset])
+      return Offset;
+
+  // Whole words, until a pair of words holds the character
+  Pattern = ONES * (UINT8)Char;
+  for(; Offset < Size && Size - Offset >= 2 * sizeof(UINTN);
+      Offset += 2 * sizeof(UINTN)) {
+    Words = (UINTN CONST *)(Buffer + Offset);
+    if(HasZeroByte(Words[0] ^ Pattern) | HasZeroByte(Words[1] ^ Pattern))
+      break;
+  }
 
-  for(Idx = 0; Idx < MaxLength; Idx++, String++)
-    if(*String == *SearchString)
-      if(!AsciiStrnCmp(String, SearchString, SearchStringLen))
-        return (char *) String;
-  return NULL;
+  while(Offset < Size && Char != Buffer[Offset])
+    Offset++;
+  return Offset;
 }
 
 /**
   Internal types
  */
-typedef struct _CRYPTO_USER {
-  UINT32   UserType;
-  EFI_GUID UserIdent;
-} CRYPTO_USER;
 
-#define USER_TYPE_DISK      0x10000001
-#define USER_TYPE_RECOVERY  0x10010005
-#define USER_TYPE_REGULAR   0x10060002
+/**
+  A token from the plist file.
+
+  Offsets are from the start of the file.
+
+  Type        One of the PLIST_TOKEN_* values below.
+  Start       Offset of the '<' that starts the token.
+  End         Offset just past the '>' that ends the token.
+  Name        Offset of the element name.
+  NameLength  Length of the element name.
+  Text        For a key or value, the offset of its text.
+  TextLength  For a key or value, the length of its text.
+ */
+typedef struct _PLIST_TOKEN {
+  UINTN Type;
+  UINTN Start;
+  UINTN End;
+  UINTN Name;
+  UINTN NameLength;
+  UINTN Text;
+  UINTN TextLength;
+} PLIST_TOKEN;
 
 /**
-  Macro Definitions ...
+  Token types.
+
+  PLIST_TOKEN_START   The start tag of an element that holds other elements,
+                      such as <dict>.
+  PLIST_TOKEN_END     The end tag of such an element.
+  PLIST_TOKEN_EMPTY   An empty element, such as <true/>.
+  PLIST_TOKEN_KEY     A whole <key>Name</key> element.
+  PLIST_TOKEN_VALUE   A whole element that holds only text, such as
+                      <integer>1</integer>.
+ */
+#define PLIST_TOKEN_START 0
+#define PLIST_TOKEN_END   1
+#define PLIST_TOKEN_EMPTY 2
+#define PLIST_TOKEN_KEY   3
+#define PLIST_TOKEN_VALUE 4
 
-  KeySize       Size (in bytes) of a plist key (<key>Name</key>)
-  StartTagSize  Size (in bytes) of a start tag
-  EndTagSize    Size (in bytes) of an end tag
+/**
+  States of the CryptoUsers parser.
 
-  BeginsWithStartTag  Check whether buffer starts with a given tag
+  CRYPTO_USERS_FIND   Looking for the CryptoUsers key.
+  CRYPTO_USERS_KEY    Found the key, expecting the array to follow it.
+  CRYPTO_USERS_ARRAY  Within the CryptoUsers array, between users.
+  CRYPTO_USERS_DICT   Within the dict of a user.
+  CRYPTO_USERS_DONE   Reached the end of the array or of the file.
+ */
+#define CRYPTO_USERS_FIND   0
+#define CRYPTO_USERS_KEY    1
+#define CRYPTO_USERS_ARRAY  2
+#define CRYPTO_USERS_DICT   3
+#define CRYPTO_USERS_DONE   4
 
-  FindKey       Find a plist key in the buffer
-  FindStartTag  Find a start tag in the buffer
-  FindEndTag    Find an end tag in the buffer
+/**
+  Keys of interest in the dict of a user.
  */
+#define USER_KEY_NONE       0
+#define USER_KEY_USERTYPE   1
+#define USER_KEY_USERIDENT  2
+#define USER_KEY_WRAPPEDKEK 3
+
+/**
+  Macro Definitions ...
 
-#define KeySize(Key)      (sizeof("<key>"Key"</key>")-1)
-#define StartTagSize(Tag) (sizeof("<"Tag">")-1)
-#define EndTagSize(Tag)   (sizeof("</"Tag">")-1)
+  TokenNameIs   Check whether a token is for an element with the given name
+  TokenTextIs   Check whether the text of a key or value is the given string
+ */
 
-#define BeginsWithStartTag(Tag, String, Length) \
-  !AsciiStrnCmp(String, "<"Tag">", StartTagSize(Tag))
-#define FindKey(Key, String, Length) \
-  AsciiStrnStr(String, "<key>"Key"</key>", Length)
-#define FindStartTag(Tag, String, Length) \
-  AsciiStrnStr(String, "<"Tag">", Length)
-#define FindEndTag(Tag, String, Length) \
-  AsciiStrnStr(String, "</"Tag">", Length)
+#define TokenNameIs(Buffer, Token, String)                                \
+  (sizeof(String) - 1 == (Token)->NameLength &&                           \
+   !AsciiStrnCmp((Buffer) + (Token)->Name, String, sizeof(String) - 1))
+#define TokenTextIs(Buffer, Token, String)                                \
+  (sizeof(String) - 1 == (Token)->TextLength &&                           \
+   !AsciiStrnCmp((Buffer) + (Token)->Text, String, sizeof(String) - 1))
 
 #define TAG_ARRAY       "array"
+#define TAG_DATA        "data"
 #define TAG_DICT        "dict"
+#define TAG_KEY         "key"
 #define KEY_USERTYPE    "UserType"
 #define KEY_USERIDENT   "UserIdent"
 #define KEY_CRYPTOUSERS "CryptoUsers"
+#define KEY_WRAPPEDKEK  "PassphraseWrappedKEKStruct"
 
 /**
-  Locate the end of an array within the plist file.
-
-  Nested arrays should be skipped.
+  Check whether there is a given end tag at an offset in the buffer.
 
-  @param  Start   Pointer to the start of the array.
-  @param  LEngth  The length of the buffer pointed to by Start.
+  @param  Buffer      The buffer holding the plist file.
+  @param  Offset      The offset to check.
+  @param  Size        How much of the file is available in Buffer.
+  @param  Name        Offset of the element name to look for.
+  @param  NameLength  Length of the element name.
 
-  @return A pointer to the </array> tag or NULL if it could not be found.
+  @return A BOOLEAN indicating whether the end tag is at Offset.
  */
 STATIC
-CHAR8 *
+BOOLEAN
 EFIAPI
-FindArrayEnd(IN CHAR8 CONST *Start,
-             IN UINTN        Length)
+IsEndTag(IN CHAR8 CONST *Buffer,
+         IN UINTN        Offset,
+         IN UINTN        Size,
+         IN UINTN        Name,
+         IN UINTN        NameLength)
 {
-  CHAR8 *End;
-  if(BeginsWithStartTag(TAG_ARRAY, Start, Length)) {
-    Start  += StartTagSize(TAG_ARRAY);
-    Length -= StartTagSize(TAG_ARRAY);
-  }
-  do {
-    if((End = FindEndTag(TAG_ARRAY, Start, Length))) {
-      if((Start = FindStartTag(TAG_ARRAY, Start, End - Start))) {
-        Start = FindArrayEnd(Start, Length - (End - Start));
-        if(Start)
-          Start += EndTagSize(TAG_ARRAY);
-      }
-    }
-  } while(Start && End);
-  return End;
+  UINTN Idx;
+  if(Size - Offset < NameLength + 3 ||
+     '/' != Buffer[Offset + 1] ||
+     '>' != Buffer[Offset + 2 + NameLength])
+    return FALSE;
+  for(Idx = 0; Idx < NameLength; Idx++)
+    if(Buffer[Offset + 2 + Idx] != Buffer[Name + Idx])
+      return FALSE;
+  return TRUE;
 }
 
 /**
-  Locate the end of a dict within the plist file.
-
-  Nested dicts should be skipped.
-
-  @param  Start   Pointer to the start of the dict.
-  @param  Length  The length of the buffer pointed to by Start.
-
-  @return A pointer to the </dict> tag or NULL if it could not be found.
+  Get the next token from the plist file.
+
+  The file is read once, from start to end, and may be passed in as it
+  becomes available: each call is given the same buffer with at least as much
+  of the file available.  Nothing before the start of the token being looked
+  for is read again.
+
+  The XML declaration, DOCTYPE, comments and any text between elements are
+  skipped.  An element is reported as a key or a value if its start tag is
+  followed directly by its end tag, so that it holds only text.
+
+  @param  Tokenizer   The tokenizer state.
+  @param  Buffer      The buffer holding the plist file.
+  @param  Size        How much of the file is available in Buffer.
+  @param  End         Whether this is the whole of the file.
+  @param  Token       Where to store the token.
+
+  @retval EFI_SUCCESS       The next token was found.
+  @retval EFI_NOT_READY     More of the file is needed to find the next token.
+  @retval EFI_END_OF_FILE   There are no more tokens.
  */
 STATIC
-CHAR8 *
+EFI_STATUS
 EFIAPI
-FindDictEnd(IN CHAR8 CONST *Start,
-            IN UINTN        Length)
+NextToken(IN OUT PLIST_TOKENIZER *Tokenizer,
+          IN     CHAR8 CONST     *Buffer,
+          IN     UINTN            Size,
+          IN     BOOLEAN          End,
+          OUT    PLIST_TOKEN     *Token)
 {
-  CHAR8 *End;
-  if(BeginsWithStartTag(TAG_DICT, Start, Length)) {
-    Start  += StartTagSize(TAG_DICT);
-    Length -= StartTagSize(TAG_DICT);
-  }
-  do {
-    if((End = FindEndTag(TAG_DICT, Start, Length))) {
-      if((Start = FindStartTag(TAG_DICT, Start, End - Start))) {
-        Start = FindDictEnd(Start, Length - (End - Start));
-        if(Start)
-          Start += EndTagSize(TAG_DICT);
+  UINTN Start;
+  UINTN Close;
+  UINTN Next;
+
+  for(;;) {
+    Start = FindChar(Buffer, Tokenizer->Pos, Size, '<');
+    Tokenizer->Pos = Start;
+    if(Size - Start < 2)
+      break;
+
+    // Skip the XML declaration, DOCTYPE and comments
+    if('?' == Buffer[Start + 1] || '!' == Buffer[Start + 1]) {
+      if(Size - Start < 4 && !End)
+        break;
+      if(Size - Start >= 4 && !AsciiStrnCmp(Buffer + Start, "<!--", 4)) {
+        for(Close = Start + 4;
+            (Close = FindChar(Buffer, Close, Size, '>')) < Size;
+            Close++)
+          if(Close >= Start + 6 &&
+             '-' == Buffer[Close - 1] && '-' == Buffer[Close - 2])
+            break;
       }
+      else
+        Close = FindChar(Buffer, Start + 2, Size, '>');
+      if(Close == Size)
+        break;
+      Tokenizer->Pos = Close + 1;
+      continue;
     }
-  } while(Start && End);
-  return End;
-}
-
-/**
-  Extract the UserType value from a CryptoUsers dict.
 
-  @param  Dict    Pointer to the start of the CryptoUser dict.
-  @param  Length  Length of the CryptoUser dict.
+    if((Close = FindChar(Buffer, Start + 1, Size, '>')) == Size)
+      break;
+    Token->Start      = Start;
+    Token->End        = Close + 1;
+    Token->Text       = Close + 1;
+    Token->TextLength = 0;
+    if('/' == Buffer[Start + 1]) {
+      Token->Type = PLIST_TOKEN_END;
+      Token->Name = Start + 2;
+    }
+    else {
+      Token->Type = '/' == Buffer[Close - 1]? PLIST_TOKEN_EMPTY:
+                                             PLIST_TOKEN_START;
+      Token->Name = Start + 1;
+    }
+    for(Token->NameLength = 0;
+        Token->Name + Token->NameLength < Close;
+        Token->NameLength++) {
+      CHAR8 Char = Buffer[Token->Name + Token->NameLength];
+      if(' ' == Char || '\t' == Char || '\r' == Char || '\n' == Char ||
+         '/' == Char)
+        break;
+    }
 
-  @return The UserType value or 0 if the UserType could not be found.
- */
-STATIC
-UINT32
-EFIAPI
-GetUserType(IN CHAR8 CONST *Dict,
-            IN UINTN        Length)
-{
-  UINT32  UserType = 0;
-  CHAR8  *UserTypeString;
-  if((UserTypeString = FindKey(KEY_USERTYPE, Dict, Length))) {
-    UserTypeString += KeySize(KEY_USERTYPE);
-    Length         -= UserTypeString - Dict + KeySize(KEY_USERTYPE);
-    while(Length && '>' != *UserTypeString++)
-      Length--;
-    while(Length && '0' <= *UserTypeString && *UserTypeString <= '9') {
-      UserType = 10 * UserType + (*UserTypeString++ -'0');
-      Length--;
+    // An element holding only text has its end tag next.  The text may be
+    // long, so remember how much of it has already been searched.
+    if(PLIST_TOKEN_START == Token->Type) {
+      Next = FindChar(Buffer, MAX(Token->Text, Tokenizer->Scan), Size, '<');
+      if(Size - Next < Token->NameLength + 3 && !End) {
+        Tokenizer->Scan = Next;
+        break;
+      }
+      if(IsEndTag(Buffer, Next, Size, Token->Name, Token->NameLength)) {
+        Token->Type       = TokenNameIs(Buffer, Token, TAG_KEY)?
+                              PLIST_TOKEN_KEY: PLIST_TOKEN_VALUE;
+        Token->TextLength = Next - Token->Text;
+        Token->End        = Next + Token->NameLength + 3;
+      }
     }
+    Tokenizer->Pos  = Token->End;
+    Tokenizer->Scan = 0;
+    return EFI_SUCCESS;
   }
-  return UserType;
+  return End? EFI_END_OF_FILE: EFI_NOT_READY;
 }
 
 /**
@@ -281,7 +357,6 @@ GetUserType(IN CHAR8 CONST *Dict,
 
   @return A BOOLEAN indicating whether parsing was successful or not.
  */
-STATIC
 BOOLEAN
 EFIAPI
 ParseGuid(IN  CHAR8 CONST *String,
@@ -347,110 +422,583 @@ ParseGuid(IN  CHAR8 CONST *String,
   return TRUE;
 }
 
+
+/**
+  Get the next user from the CryptoUsers array.
+
+  The users are found with a single pass over the file, which may be passed in
+  as it becomes available, as for NextToken().  A user is returned once the
+  whole of its dict is available.  Only the keys directly within the dict of
+  the user are considered.
+
+  @param  Users   The parser state, initially all zero.
+  @param  Buffer  The buffer holding the plist file.
+  @param  Size    How much of the file is available in Buffer.
+  @param  End     Whether this is the whole of the file.
+  @param  User    Where to store the user.
+
+  @retval EFI_SUCCESS       The next user was found.
+  @retval EFI_NOT_READY     More of the file is needed to find the next user.
+  @retval EFI_END_OF_FILE   The end of the CryptoUsers array was reached.
+  @retval EFI_NOT_FOUND     The end of the file was reached without finding
+                            the end of a CryptoUsers array.
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+NextCryptoUser(IN OUT CRYPTO_USERS *Users,
+               IN     CHAR8 CONST  *Buffer,
+               IN     UINTN         Size,
+               IN     BOOLEAN       End,
+               OUT    CRYPTO_USER  *User)
+{
+  PLIST_TOKEN Token;
+  EFI_STATUS  Status;
+  UINTN       Idx;
+
+  while(CRYPTO_USERS_DONE != Users->State) {
+    Status = NextToken(&Users->Tokenizer, Buffer, Size, End, &Token);
+    if(EFI_NOT_READY == Status)
+      return Status;
+    if(EFI_ERROR(Status)) {
+      Users->State = CRYPTO_USERS_DONE;
+      break;
+    }
+
+    switch(Users->State) {
+    case CRYPTO_USERS_FIND:
+      if(PLIST_TOKEN_KEY == Token.Type &&
+         TokenTextIs(Buffer, &Token, KEY_CRYPTOUSERS))
+        Users->State = CRYPTO_USERS_KEY;
+      break;
+
+    case CRYPTO_USERS_KEY:
+      if(PLIST_TOKEN_START == Token.Type &&
+         TokenNameIs(Buffer, &Token, TAG_ARRAY)) {
+        Users->ArrayStart = Token.End;
+        Users->Depth      = 0;
+        Users->State      = CRYPTO_USERS_ARRAY;
+      }
+      // An empty array
+      else if(PLIST_TOKEN_VALUE == Token.Type &&
+              TokenNameIs(Buffer, &Token, TAG_ARRAY)) {
+        Users->ArrayStart = Token.Text;
+        Users->ArrayEnd   = Token.Text + Token.TextLength;
+        Users->State      = CRYPTO_USERS_DONE;
+      }
+      else if(PLIST_TOKEN_KEY != Token.Type ||
+              !TokenTextIs(Buffer, &Token, KEY_CRYPTOUSERS))
+        Users->State = CRYPTO_USERS_FIND;
+      break;
+
+    case CRYPTO_USERS_ARRAY:
+      if(PLIST_TOKEN_START == Token.Type) {
+        if(!Users->Depth && TokenNameIs(Buffer, &Token, TAG_DICT)) {
+          gBS->SetMem(&Users->User, sizeof(Users->User), 0);
+          Users->User.DictStart = Token.Start;
+          Users->Key            = USER_KEY_NONE;
+          Users->State          = CRYPTO_USERS_DICT;
+        }
+        Users->Depth++;
+      }
+      else if(PLIST_TOKEN_END == Token.Type) {
+        if(!Users->Depth) {
+          Users->ArrayEnd = Token.Start;
+          Users->State    = CRYPTO_USERS_DONE;
+        }
+        else
+          Users->Depth--;
+      }
+      // A user with an empty dict
+      else if(PLIST_TOKEN_VALUE == Token.Type && !Users->Depth &&
+              TokenNameIs(Buffer, &Token, TAG_DICT)) {
+        gBS->SetMem(User, sizeof(*User), 0);
+        User->DictStart = Token.Start;
+        User->DictEnd   = Token.End;
+        return EFI_SUCCESS;
+      }
+      break;
+
+    case CRYPTO_USERS_DICT:
+      if(1 == Users->Depth && PLIST_TOKEN_KEY == Token.Type) {
+        if(TokenTextIs(Buffer, &Token, KEY_USERTYPE))
+          Users->Key = USER_KEY_USERTYPE;
+        else if(TokenTextIs(Buffer, &Token, KEY_USERIDENT))
+          Users->Key = USER_KEY_USERIDENT;
+        else if(TokenTextIs(Buffer, &Token, KEY_WRAPPEDKEK))
+          Users->Key = USER_KEY_WRAPPEDKEK;
+        else
+          Users->Key = USER_KEY_NONE;
+        break;
+      }
+      if(1 == Users->Depth && PLIST_TOKEN_VALUE == Token.Type) {
+        switch(Users->Key) {
+        case USER_KEY_USERTYPE:
+          Users->User.UserType = 0;
+          for(Idx = 0;
+              Idx < Token.TextLength &&
+              '0' <= Buffer[Token.Text + Idx] &&
+              Buffer[Token.Text + Idx] <= '9';
+              Idx++)
+            Users->User.UserType = 10 * Users->User.UserType +
+                                   (Buffer[Token.Text + Idx] - '0');
+          break;
+        case USER_KEY_USERIDENT:
+          ParseGuid(Buffer + Token.Text,
+                    Token.TextLength,
+                    &Users->User.UserIdent);
+          break;
+        case USER_KEY_WRAPPEDKEK:
+          if(TokenNameIs(Buffer, &Token, TAG_DATA)) {
+            Users->User.Kek       = Token.Text;
+            Users->User.KekLength = Token.TextLength;
+          }
+          break;
+        }
+      }
+      Users->Key = USER_KEY_NONE;
+      if(PLIST_TOKEN_START == Token.Type)
+        Users->Depth++;
+      else if(PLIST_TOKEN_END == Token.Type && !--Users->Depth) {
+        Users->User.DictEnd = Token.End;
+        Users->State        = CRYPTO_USERS_ARRAY;
+        gBS->CopyMem(User, &Users->User, sizeof(*User));
+        return EFI_SUCCESS;
+      }
+      break;
+    }
+  }
+  return Users->ArrayEnd? EFI_END_OF_FILE: EFI_NOT_FOUND;
+}
+
 /**
-  Extract the UserIdent GUID from a CryptoUsers dict.
+  Add a user to an index, making room for it if needed.
 
-  @param  Dict        Pointer to the start of the CryptoUser dict.
-  @param  Length      Length of the CryptoUser dict.
-  @param  UserIdent   Where to store the UserIdent GUID
+  @param  Index   The index to add the user to.
+  @param  User    The user to add.
 
-  @return Pointer to the UserIdent GUID in the dictionary, or NULL if it was
-          not found.
+  @retval EFI_SUCCESS           The user was added.
+  @retval EFI_OUT_OF_RESOURCES  There is not enough memory for the user.
  */
 STATIC
-CHAR8 CONST *
+EFI_STATUS
 EFIAPI
-GetUserIdent(IN  CHAR8 CONST *Dict,
-             IN  UINTN        Length,
-             OUT EFI_GUID    *Guid)
+AddIndexUser(IN OUT CRYPTO_USER_INDEX *Index,
+             IN     CRYPTO_USER CONST *User)
 {
-  CHAR8 *UserIdentString;
-  if((UserIdentString = FindKey(KEY_USERIDENT, Dict, Length))) {
-    UserIdentString += KeySize(KEY_USERIDENT);
-    Length          -= UserIdentString - Dict + KeySize(KEY_USERIDENT);
-    while(Length && '>' != *UserIdentString++)
-      Length--;
-    return ParseGuid(UserIdentString, Length, Guid)? UserIdentString: NULL;
+  CRYPTO_USER *Users;
+  EFI_STATUS   Status;
+  UINTN        Capacity;
+
+  if(Index->Count == Index->Capacity) {
+    Capacity = Index->Capacity? 2 * Index->Capacity: 8;
+    Status = gBS->AllocatePool(EfiBootServicesData,
+                               Capacity * sizeof(CRYPTO_USER),
+                               (VOID**)&Users);
+    if(EFI_ERROR(Status))
+      return Status;
+    if(Index->Users) {
+      gBS->CopyMem(Users, Index->Users, Index->Count * sizeof(CRYPTO_USER));
+      gBS->SetMem(Index->Users, Index->Count * sizeof(CRYPTO_USER), 0);
+      gBS->FreePool(Index->Users);
+    }
+    Index->Users    = Users;
+    Index->Capacity = Capacity;
   }
-  return NULL;
+  gBS->CopyMem(Index->Users + Index->Count++,
+               (VOID*)User,
+               sizeof(CRYPTO_USER));
+  return EFI_SUCCESS;
 }
 
 /**
-  Determine whether the User is of interest.
+  Erase and free the contents of an index, leaving it empty.
+
+  @param  Index   The index to free.
+ */
+VOID
+EFIAPI
+FreeCryptoUserIndex(IN OUT CRYPTO_USER_INDEX *Index)
+{
+  if(Index->Users) {
+    gBS->SetMem(Index->Users, Index->Capacity * sizeof(CRYPTO_USER), 0);
+    gBS->FreePool(Index->Users);
+  }
+  gBS->SetMem(Index, sizeof(*Index), 0);
+}
 
-  Currently, only a user of type USER_TYPE_DISK is accepted.
+/**
+  Build the index of the users in the EncryptedRoot.plist.wipekey file.
 
-  @param  User  Pointer to the CRYPTO_USER to test.
+  Anything already in the index is freed first.  The users to keep are chosen
+  by the user policy once the whole array has been indexed.
 
-  @return A BOOLEAN indicating whether the user is of interest.
+  @param  Src     Pointer to the decrypted contents of the
+                  EncryptedRoot.plist.wipekey file.
+  @param  Size    Size of the buffer pointed to by Src.
+  @param  Index   The index to build.
+
+  @retval EFI_SUCCESS           The index was built.
+  @retval EFI_OUT_OF_RESOURCES  There is not enough memory for the index.
+ */
+EFI_STATUS
+EFIAPI
+BuildCryptoUserIndex(IN     CHAR8 CONST       *Src,
+                     IN     UINTN              Size,
+                     IN OUT CRYPTO_USER_INDEX *Index)
+{
+  CRYPTO_USERS Users;
+  CRYPTO_USER  User;
+  EFI_STATUS   Status;
+
+  FreeCryptoUserIndex(Index);
+  gBS->SetMem(&Users, sizeof(Users), 0);
+  Users.State = CRYPTO_USERS_FIND;
+  while(!EFI_ERROR(Status = NextCryptoUser(&Users, Src, Size, TRUE, &User)))
+    if(EFI_ERROR(Status = AddIndexUser(Index, &User))) {
+      FreeCryptoUserIndex(Index);
+      return Status;
+    }
+
+  // The users of an incomplete array are not used
+  if(EFI_END_OF_FILE == Status) {
+    Index->ArrayStart = Users.ArrayStart;
+    Index->ArrayEnd   = Users.ArrayEnd;
+  }
+  else
+    Index->Count = 0;
+  Index->FileSize = Size;
+  SelectUsers(Index);
+  return EFI_SUCCESS;
+}
+
+/**
+  States of the incremental filter.
+
+  PLIST_FILTER_USERS    Looking for users in the CryptoUsers array.
+  PLIST_FILTER_INDEXED  Waiting for the kept users and the end of the array
+                        found by the index.
+  PLIST_FILTER_COPY     Passing the rest of the file through.
+ */
+#define PLIST_FILTER_USERS    0
+#define PLIST_FILTER_INDEXED  1
+#define PLIST_FILTER_COPY     2
+
+/**
+  Add a range of the file to the end of the filtered file.
+
+  A range that follows straight on from the last one is merged with it.
+
+  @param  Filter  The filter state.
+  @param  Offset  Offset of the range in the file.
+  @param  Length  Length of the range.
  */
 STATIC
-BOOLEAN
-KeepUser(IN CRYPTO_USER CONST *User)
+VOID
+EFIAPI
+AddRange(IN OUT PLIST_FILTER *Filter,
+         IN     UINTN         Offset,
+         IN     UINTN         Length)
 {
-  return USER_TYPE_DISK == User->UserType;
+  PLIST_RANGE *Range;
+
+  if(!Length)
+    return;
+  if(Filter->RangeCount) {
+    Range = Filter->Ranges + Filter->RangeCount - 1;
+    if(Range->Offset + Range->Length == Offset) {
+      Range->Length += Length;
+      return;
+    }
+  }
+  Range = Filter->Ranges + Filter->RangeCount++;
+  Range->Offset = Offset;
+  Range->Length = Length;
 }
 
 /**
-  Filter the EncryptedRoot.plist.wipekey file.
+  Pass the file through unchanged, from where the filter is up to.
 
-  The EncryptedRoot.plist.wipekey file contains a CryptoUsers array that
-  contains passphrase wrapped KEK structures for each user.  This function
-  attempts to remove all but one of the users: the disk password.
+  @param  Filter  The filter state.
+  @param  Offset  Offset in the file to pass it through to.
+ */
+STATIC
+VOID
+EFIAPI
+PassThrough(IN OUT PLIST_FILTER *Filter,
+            IN     UINTN         Offset)
+{
+  if(Offset > Filter->In) {
+    AddRange(Filter, Filter->In, Offset - Filter->In);
+    Filter->In = Offset;
+  }
+}
+
+/**
+  Start filtering the EncryptedRoot.plist.wipekey file.
 
-  @param  Src   Pointer to the original (decrypted) contents of the
-                EncryptedRoot.plist.wipekey file.
-  @param  Size  Size of the buffer pointed to by Src.
-  @param  Dest  Where to store the filtered version of the file.  This should
-                be at least Size bytes and may point to the same buffer as Src.
+  If Index is complete, the filter uses it instead of parsing the file, which
+  must then be the file that was indexed.  Otherwise the file is parsed, and
+  the index, if given, is built as the file is filtered.
 
-  @return The number of bytes stored in Dest.
+  @param  Filter  The filter state to initialise.
+  @param  Index   Optional index of the users in the file.
  */
-UINTN
+VOID
 EFIAPI
-PlistFilter(IN  CHAR8 CONST *Src,
-            IN  UINTN        Size,
-            OUT CHAR8       *Dest)
+PlistFilterInit(OUT    PLIST_FILTER      *Filter,
+                IN OUT CRYPTO_USER_INDEX *Index OPTIONAL)
 {
-  CRYPTO_USER  User;
-  CHAR8       *CryptoUserStart;
-  CHAR8       *UserArrayStart;
-  CHAR8       *UserArrayEnd;
-  CHAR8       *UserDictStart;
-  CHAR8       *UserDictEnd;
-  if((CryptoUserStart = FindKey(KEY_CRYPTOUSERS, Src, Size))) {
-    if((UserArrayStart = FindStartTag(TAG_ARRAY,
-                                      CryptoUserStart,
-                                      Size - (CryptoUserStart - Src))) &&
-       (UserArrayEnd = FindArrayEnd(UserArrayStart,
-                                    Size - (CryptoUserStart - Src)))) {
-      UserDictStart = FindStartTag(TAG_DICT,
-                                   UserArrayStart,
-                                   UserArrayEnd - UserArrayStart);
-      while(UserDictStart &&
-            (UserDictEnd = FindDictEnd(UserDictStart,
-                                       UserArrayEnd - UserDictStart))) {
-        User.UserType = GetUserType(UserDictStart, UserDictEnd - UserDictStart);
-        if(!GetUserIdent(UserDictStart,
-                         UserDictEnd - UserDictStart,
-                         &User.UserIdent)) {
-          gBS->SetMem(&User.UserIdent, sizeof(User.UserIdent), 0);
-        }
-        if(KeepUser(&User)) {
-          UINTN Length1 = UserArrayStart - Src + StartTagSize(TAG_ARRAY);
-          UINTN Length2 = UserDictEnd - UserDictStart + EndTagSize(TAG_DICT);
-          UINTN Length3 = Size - (UserArrayEnd - Src);
-          gBS->CopyMem(Dest, (VOID*)Src, Length1);
-          gBS->CopyMem(Dest + Length1, UserDictStart, Length2);
-          gBS->CopyMem(Dest + Length1 + Length2, UserArrayEnd, Length3);
-          return Length1 + Length2 + Length3;
-        }
-        UserDictStart = FindStartTag(TAG_DICT,
-                                     UserDictEnd,
-                                     UserArrayEnd - UserDictEnd);
+  gBS->SetMem(Filter, sizeof(*Filter), 0);
+  Filter->State       = PLIST_FILTER_USERS;
+  Filter->Users.State = CRYPTO_USERS_FIND;
+  Filter->Index       = Index;
+  if(Index && Index->FileSize) {
+    // Without a user to keep, the file is left unchanged
+    if(Index->KeptCount) {
+      Filter->Users.ArrayStart = Index->ArrayStart;
+      Filter->Users.ArrayEnd   = Index->ArrayEnd;
+      Filter->State            = PLIST_FILTER_INDEXED;
+    }
+    else
+      Filter->State = PLIST_FILTER_COPY;
+  }
+  else if(Index)
+    FreeCryptoUserIndex(Index);
+}
+
+/**
+  Filter the EncryptedRoot.plist.wipekey file as it becomes available.
+
+  Everything up to and including the <array> tag of the CryptoUsers array is
+  passed through.  The users in the array are then offered to the user
+  policy one dict at a time, as each becomes complete.  Once the whole array
+  has been seen, the users chosen follow the <array> tag, and the rest of the
+  array's contents are dropped.  The rest of the file, from the </array> tag,
+  follows the kept users.  If there is no user to keep, or the array is not
+  complete, the file is passed through unchanged.
+
+  With a complete index, the kept users and the end of the array are already
+  known, so the filter just waits for them to become available.  When the
+  index is built as the file is filtered, the same users are chosen from it.
+
+  The ranges of the filtered file only ever move forward through Buffer, and
+  each starts no earlier than its offset in the filtered file, so the
+  filtered file can be built in place in Buffer from them.
+
+  @param  Filter        The filter state.
+  @param  Buffer        The buffer holding the (decrypted) file.
+  @param  Size          How much of the file is available in Buffer.
+  @param  End           Whether this is the whole of the file.
+  @param  Ranges        On return, the ranges of Buffer that make up the final
+                        filtered data so far.  Once End is TRUE, these make up
+                        the whole filtered file.  They are held in the filter
+                        state.
+  @param  RangeCount    On return, the number of entries in Ranges.
+
+  @retval EFI_SUCCESS           The available data was filtered.
+  @retval EFI_INVALID_PARAMETER The file ended before the end of the CryptoUsers
+                                array of the index, after kept users had
+                                already been passed on.
+ */
+EFI_STATUS
+EFIAPI
+PlistFilterUpdate(IN OUT PLIST_FILTER       *Filter,
+                  IN     CHAR8 CONST        *Buffer,
+                  IN     UINTN               Size,
+                  IN     BOOLEAN             End,
+                  OUT    PLIST_RANGE CONST **Ranges,
+                  OUT    UINTN              *RangeCount)
+{
+  CRYPTO_USER        User;
+  CRYPTO_USER CONST *KeptUser;
+  EFI_STATUS         Status;
+  UINTN              Idx;
+
+  while(PLIST_FILTER_USERS == Filter->State) {
+    Status = NextCryptoUser(&Filter->Users, Buffer, Size, End, &User);
+    // Nothing is changed before the array, so it is passed through
+    PassThrough(Filter,
+                Filter->Users.ArrayStart? Filter->Users.ArrayStart:
+                                          Filter->Users.Tokenizer.Pos);
+    if(EFI_NOT_READY == Status)
+      break;
+    if(!EFI_ERROR(Status)) {
+      SelectUser(&Filter->Selection, &User);
+      // Without the memory to index every user, there is no index
+      if(Filter->Index && EFI_ERROR(AddIndexUser(Filter->Index, &User))) {
+        FreeCryptoUserIndex(Filter->Index);
+        Filter->Index = NULL;
       }
     }
+    else if(EFI_END_OF_FILE == Status) {
+      // Without a user to keep, the array is passed through as it is
+      FinishUserSelection(&Filter->Selection);
+      if(!Filter->Selection.Count)
+        PassThrough(Filter, Filter->Users.ArrayEnd);
+      for(Idx = 0; Idx < Filter->Selection.Count; Idx++) {
+        KeptUser = Filter->Selection.Users + Idx;
+        AddRange(Filter,
+                 KeptUser->DictStart,
+                 KeptUser->DictEnd - KeptUser->DictStart);
+      }
+      Filter->Kept  = Filter->Selection.Count;
+      Filter->In    = Filter->Users.ArrayEnd;
+      Filter->State = PLIST_FILTER_COPY;
+      if(Filter->Index) {
+        Filter->Index->ArrayStart = Filter->Users.ArrayStart;
+        Filter->Index->ArrayEnd   = Filter->Users.ArrayEnd;
+      }
+    }
+    else {
+      // The array is incomplete, so cannot be filtered
+      Filter->State = PLIST_FILTER_COPY;
+      if(Filter->Index)
+        Filter->Index->Count = 0;
+    }
   }
-  gBS->CopyMem(Dest, (VOID*)Src, Size);
-  return Size;
+
+  if(PLIST_FILTER_INDEXED == Filter->State) {
+    if(!Filter->Kept)
+      PassThrough(Filter, MIN(Size, Filter->Users.ArrayStart));
+    // The kept users follow each other in the order they appear in the file
+    for(; Filter->Next < Filter->Index->Count; Filter->Next++) {
+      KeptUser = Filter->Index->Users + Filter->Next;
+      if(!KeptUser->Keep)
+        continue;
+      if(Size < KeptUser->DictEnd)
+        break;
+      AddRange(Filter,
+               KeptUser->DictStart,
+               KeptUser->DictEnd - KeptUser->DictStart);
+      Filter->Kept++;
+    }
+    if(Filter->Next == Filter->Index->Count &&
+       Size >= Filter->Users.ArrayEnd) {
+      Filter->In    = Filter->Users.ArrayEnd;
+      Filter->State = PLIST_FILTER_COPY;
+    }
+    else if(End) {
+      // The file is shorter than the one that was indexed
+      if(Filter->Kept)
+        return EFI_INVALID_PARAMETER;
+      Filter->State = PLIST_FILTER_COPY;
+    }
+  }
+
+  if(PLIST_FILTER_COPY == Filter->State) {
+    PassThrough(Filter, Size);
+    if(End && Filter->Index && !Filter->Index->FileSize) {
+      Filter->Index->FileSize = Size;
+      SelectUsers(Filter->Index);
+    }
+  }
+
+  *Ranges     = Filter->Ranges;
+  *RangeCount = Filter->RangeCount;
+  return EFI_SUCCESS;
+}
+
+/**
+  Decode base64 data, as found in a plist <data> element.
+
+  Whitespace is ignored and decoding stops at the first '=' padding character.
+
+  @param  String      Pointer to the base64 data.
+  @param  Length      Length of the base64 data.
+  @param  Buffer      Where to store the decoded data.
+  @param  BufferSize  On entry, the size of Buffer.  On exit, the number of
+                      bytes decoded.
+
+  @retval EFI_SUCCESS           The data was decoded.
+  @retval EFI_BUFFER_TOO_SMALL  The decoded data does not fit in Buffer.
+  @retval EFI_INVALID_PARAMETER The data contains an invalid character.
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+Base64Decode(IN     CHAR8 CONST *String,
+             IN     UINTN        Length,
+             OUT    UINT8       *Buffer,
+             IN OUT UINTN       *BufferSize)
+{
+  UINT32 Bits  = 0;
+  UINTN  Count = 0;
+  UINTN  Size  = 0;
+  UINT8  Value;
+  CHAR8  Char;
+
+  for(; Length && '=' != *String; Length--) {
+    Char = *String++;
+    if('A' <= Char && Char <= 'Z')
+      Value = Char - 'A';
+    else if('a' <= Char && Char <= 'z')
+      Value = Char - 'a' + 26;
+    else if('0' <= Char && Char <= '9')
+      Value = Char - '0' + 52;
+    else if('+' == Char)
+      Value = 62;
+    else if('/' == Char)
+      Value = 63;
+    else if(' ' == Char || '\t' == Char || '\r' == Char || '\n' == Char)
+      continue;
+    else
+      return EFI_INVALID_PARAMETER;
+    Bits = (Bits << 6) | Value;
+    if(++Count == 4) {
+      if(Size + 3 > *BufferSize)
+        return EFI_BUFFER_TOO_SMALL;
+      Buffer[Size++] = (UINT8)(Bits >> 16);
+      Buffer[Size++] = (UINT8)(Bits >>  8);
+      Buffer[Size++] = (UINT8)(Bits >>  0);
+      Bits  = 0;
+      Count = 0;
+    }
+  }
+  // A final group of 2 or 3 characters holds 1 or 2 bytes
+  if(1 == Count)
+    return EFI_INVALID_PARAMETER;
+  if(Count) {
+    if(Size + Count - 1 > *BufferSize)
+      return EFI_BUFFER_TOO_SMALL;
+    Bits <<= 6 * (4 - Count);
+    Buffer[Size++] = (UINT8)(Bits >> 16);
+    if(3 == Count)
+      Buffer[Size++] = (UINT8)(Bits >> 8);
+  }
+  *BufferSize = Size;
+  return EFI_SUCCESS;
+}
+
+
+/**
+  Get the PassphraseWrappedKEKStruct of a CryptoUser.
+
+  @param  Src         Pointer to the decrypted contents of the
+                      EncryptedRoot.plist.wipekey file.
+  @param  User        The user, from the index of the file.
+  @param  KekStruct   Where to store the decoded structure.
+  @param  KekSize     On entry, the size of KekStruct.  On exit, the size of
+                      the decoded structure.
+
+  @retval EFI_SUCCESS           The structure was found and decoded.
+  @retval EFI_NOT_FOUND         The user does not have a
+                                PassphraseWrappedKEKStruct.
+  @retval EFI_BUFFER_TOO_SMALL  The structure does not fit in KekStruct.
+  @retval EFI_INVALID_PARAMETER The structure is not valid base64 data.
+ */
+EFI_STATUS
+EFIAPI
+GetWrappedKekStruct(IN     CHAR8 CONST       *Src,
+                    IN     CRYPTO_USER CONST *User,
+                    OUT    UINT8             *KekStruct,
+                    IN OUT UINTN             *KekSize)
+{
+  if(!Src || !User || !KekStruct || !KekSize)
+    return EFI_INVALID_PARAMETER;
+
+  if(!User->Kek)
+    return EFI_NOT_FOUND;
+
+  return Base64Decode(Src + User->Kek, User->KekLength, KekStruct, KekSize);
 }
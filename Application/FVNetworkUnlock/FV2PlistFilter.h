@@ -31,24 +31,248 @@
 #include <Uefi.h>
 
 /**
-  Filter the EncryptedRoot.plist.wipekey file.
- 
+  The most CryptoUsers that the filter will keep.
+ */
+#define MAX_KEPT_USERS  16
+
+/**
+  A user from the CryptoUsers array.
+
+  Offsets are from the start of the EncryptedRoot.plist.wipekey file.
+
+  UserType    The UserType value, or 0 if there is none.
+  UserIdent   The UserIdent GUID, or all zero if there is none.
+  DictStart   Offset of the <dict> tag of the user.
+  DictEnd     Offset just past the </dict> tag of the user.
+  Kek         Offset of the PassphraseWrappedKEKStruct data, or 0 if there is
+              none.
+  KekLength   Length of the PassphraseWrappedKEKStruct data.
+  Keep        Whether the user is kept, once its index is complete.
+ */
+typedef struct _CRYPTO_USER {
+  UINT32   UserType;
+  EFI_GUID UserIdent;
+  UINTN    DictStart;
+  UINTN    DictEnd;
+  UINTN    Kek;
+  UINTN    KekLength;
+  BOOLEAN  Keep;
+} CRYPTO_USER;
+
+/**
+  State for tokenizing the plist file in a single pass.
+
+  The contents should be treated as opaque.
+ */
+typedef struct _PLIST_TOKENIZER {
+  UINTN Pos;
+  UINTN Scan;
+} PLIST_TOKENIZER;
+
+/**
+  State for finding the users in the CryptoUsers array in a single pass.
+
+  The contents should be treated as opaque.
+ */
+typedef struct _CRYPTO_USERS {
+  PLIST_TOKENIZER Tokenizer;
+  UINTN           State;
+  UINTN           Depth;
+  UINTN           Key;
+  UINTN           ArrayStart;
+  UINTN           ArrayEnd;
+  CRYPTO_USER     User;
+} CRYPTO_USERS;
+
+/**
+  An index of the users in the CryptoUsers array of a wipekey.
+
+  The index is built by the first parse of the file, and lets later uses of
+  the same file find the users without parsing it again.
+
+  FileSize    Size of the file that was indexed, or 0 until the index is
+              complete.
+  ArrayStart  Offset just past the <array> tag of the CryptoUsers array, or 0
+              if there is no complete CryptoUsers array.
+  ArrayEnd    Offset of the </array> tag of the CryptoUsers array.
+  Count       Number of users in the array.
+  KeptCount   Number of users in the array that are kept.
+  Capacity    Number of users there is room for in Users.
+  Users       The users, in the order they appear in the array.
+ */
+typedef struct _CRYPTO_USER_INDEX {
+  UINTN        FileSize;
+  UINTN        ArrayStart;
+  UINTN        ArrayEnd;
+  UINTN        Count;
+  UINTN        KeptCount;
+  UINTN        Capacity;
+  CRYPTO_USER *Users;
+} CRYPTO_USER_INDEX;
+
+/**
+  A range of the EncryptedRoot.plist.wipekey file that is part of the
+  filtered file.
+
+  Offset      Offset of the range from the start of the file.
+  Length      Length of the range.
+ */
+typedef struct _PLIST_RANGE {
+  UINTN Offset;
+  UINTN Length;
+} PLIST_RANGE;
+
+/**
+  A choice of users to keep, made with the user policy.
+
+  The contents should be treated as opaque.
+ */
+typedef struct _USER_SELECTION {
+  UINTN       Count;
+  UINTN       Rank[MAX_KEPT_USERS];
+  CRYPTO_USER Users[MAX_KEPT_USERS];
+} USER_SELECTION;
+
+/**
+  State for filtering the EncryptedRoot.plist.wipekey file incrementally.
+
+  The filtered file is at most the part before the users, the kept users, and
+  the part after them, so there are never more than MAX_KEPT_USERS + 2 ranges.
+  The contents should be treated as opaque.
+ */
+typedef struct _PLIST_FILTER {
+  UINTN              State;
+  UINTN              In;
+  UINTN              Kept;
+  UINTN              Next;
+  CRYPTO_USERS       Users;
+  CRYPTO_USER_INDEX *Index;
+  USER_SELECTION     Selection;
+  UINTN              RangeCount;
+  PLIST_RANGE        Ranges[MAX_KEPT_USERS + 2];
+} PLIST_FILTER;
+
+/**
+  Parse the string representation of a GUID.
+
+  @param  String  Pointer to the string containing the GUID.
+  @param  Length  Maximum length of the string.
+  @param  Guid    Where to store the GUID.
+
+  @return A BOOLEAN indicating whether parsing was successful or not.
+ */
+BOOLEAN
+EFIAPI
+ParseGuid(IN  CHAR8 CONST *String,
+          IN  UINTN        Length,
+          OUT EFI_GUID    *Guid);
+
+/**
+  Build the index of the users in the EncryptedRoot.plist.wipekey file.
+
+  Anything already in the index is freed first.  The users to keep are chosen
+  by the user policy once the whole array has been indexed.
+
+  @param  Src     Pointer to the decrypted contents of the
+                  EncryptedRoot.plist.wipekey file.
+  @param  Size    Size of the buffer pointed to by Src.
+  @param  Index   The index to build.
+
+  @retval EFI_SUCCESS           The index was built.
+  @retval EFI_OUT_OF_RESOURCES  There is not enough memory for the index.
+ */
+EFI_STATUS
+EFIAPI
+BuildCryptoUserIndex(IN     CHAR8 CONST       *Src,
+                     IN     UINTN              Size,
+                     IN OUT CRYPTO_USER_INDEX *Index);
+
+/**
+  Erase and free the contents of an index, leaving it empty.
+
+  @param  Index   The index to free.
+ */
+VOID
+EFIAPI
+FreeCryptoUserIndex(IN OUT CRYPTO_USER_INDEX *Index);
+
+/**
+  Start filtering the EncryptedRoot.plist.wipekey file.
+
+  If Index is complete, the filter uses it instead of parsing the file, which
+  must then be the file that was indexed.  Otherwise the file is parsed, and
+  the index, if given, is built as the file is filtered.
+
+  @param  Filter  The filter state to initialise.
+  @param  Index   Optional index of the users in the file.
+ */
+VOID
+EFIAPI
+PlistFilterInit(OUT    PLIST_FILTER      *Filter,
+                IN OUT CRYPTO_USER_INDEX *Index OPTIONAL);
+
+/**
+  Filter the EncryptedRoot.plist.wipekey file as it becomes available.
+
   The EncryptedRoot.plist.wipekey file contains a CryptoUsers array that
   contains passphrase wrapped KEK structures for each user.  This function
-  attempts to remove all but one of the users: the disk password.
- 
-  @param  Src   Pointer to the original (decrypted) contents of the
-                EncryptedRoot.plist.wipekey file.
-  @param  Size  Size of the buffer pointed to by Src.
-  @param  Dest  Where to store the filtered version of the file.  This should
-                be at least Size bytes and may point to the same buffer as Src.
- 
-  @return The number of bytes stored in Dest.
- */
-UINTN
+  attempts to remove all but the users chosen by the user policy, which by
+  default keeps only the disk password.
+
+  The file can be passed in as it is decrypted: each call is given the same
+  buffer with more of the file available.  Nothing in the buffer is moved or
+  changed.  Instead, the filtered file is described by a list of ranges of
+  the buffer, to be taken in order.  The ranges returned are final: later
+  calls only add ranges or make the last one longer, and the filter will not
+  read the data in them again, so it can be re-encrypted straight away.  The
+  file is tokenized in a single pass, so each byte is only examined once
+  however many users there are.
+
+  @param  Filter        The filter state.
+  @param  Buffer        The buffer holding the (decrypted) file.
+  @param  Size          How much of the file is available in Buffer.
+  @param  End           Whether this is the whole of the file.
+  @param  Ranges        On return, the ranges of Buffer that make up the final
+                        filtered data so far.  Once End is TRUE, these make up
+                        the whole filtered file.  They are held in the filter
+                        state.
+  @param  RangeCount    On return, the number of entries in Ranges.
+
+  @retval EFI_SUCCESS           The available data was filtered.
+  @retval EFI_INVALID_PARAMETER The file ended before the end of the CryptoUsers
+                                array of the index, after kept users had
+                                already been passed on.
+ */
+EFI_STATUS
+EFIAPI
+PlistFilterUpdate(IN OUT PLIST_FILTER       *Filter,
+                  IN     CHAR8 CONST        *Buffer,
+                  IN     UINTN               Size,
+                  IN     BOOLEAN             End,
+                  OUT    PLIST_RANGE CONST **Ranges,
+                  OUT    UINTN              *RangeCount);
+
+/**
+  Get the PassphraseWrappedKEKStruct of a CryptoUser.
+
+  @param  Src         Pointer to the decrypted contents of the
+                      EncryptedRoot.plist.wipekey file.
+  @param  User        The user, from the index of the file.
+  @param  KekStruct   Where to store the decoded structure.
+  @param  KekSize     On entry, the size of KekStruct.  On exit, the size of
+                      the decoded structure.
+
+  @retval EFI_SUCCESS           The structure was found and decoded.
+  @retval EFI_NOT_FOUND         The user does not have a
+                                PassphraseWrappedKEKStruct.
+  @retval EFI_BUFFER_TOO_SMALL  The structure does not fit in KekStruct.
+  @retval EFI_INVALID_PARAMETER The structure is not valid base64 data.
+ */
+EFI_STATUS
 EFIAPI
-PlistFilter(IN  CHAR8 CONST *Src,
-            IN  UINTN        Size,
-            OUT CHAR8       *Dest);
+GetWrappedKekStruct(IN     CHAR8 CONST       *Src,
+                    IN     CRYPTO_USER CONST *User,
+                    OUT    UINT8             *KekStruct,
+                    IN OUT UINTN             *KekSize);
 
 #endif
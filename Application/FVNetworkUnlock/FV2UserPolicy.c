@@ -0,0 +1,411 @@
+/**
+ * Copyright (c) 2015, baskingshark
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <Uefi.h>
+#include <Library/BaseMemoryLib.h>
+#include "FV2UserPolicy.h"
+
+/**
+  Internal types
+ */
+#define USER_TYPE_DISK      0x10000001
+#define USER_TYPE_RECOVERY  0x10010005
+#define USER_TYPE_REGULAR   0x10060002
+
+/**
+  Limit on the size of a policy.
+ */
+#define MAX_USER_RULES  16
+
+/**
+  How a rule matches a user.
+
+  USER_MATCH_TYPE   The UserType of the user is the UserType of the rule.
+  USER_MATCH_IDENT  The UserIdent of the user is the UserIdent of the rule.
+ */
+#define USER_MATCH_TYPE   0
+#define USER_MATCH_IDENT  1
+
+typedef struct _USER_RULE {
+  UINTN    Match;
+  UINT32   UserType;
+  EFI_GUID UserIdent;
+} USER_RULE;
+
+/**
+  A compiled policy.
+
+  The rules are held in order of preference, so the rank of a user is simply
+  the position of the first rule it matches.
+ */
+typedef struct _USER_POLICY {
+  UINTN     KeepCount;
+  UINTN     RuleCount;
+  USER_RULE Rules[MAX_USER_RULES];
+} USER_POLICY;
+
+#define NO_RANK ((UINTN)-1)
+
+/**
+  The current policy, initially "keep disk".
+ */
+STATIC
+USER_POLICY
+mUserPolicy = { 1, 1, { { USER_MATCH_TYPE, USER_TYPE_DISK, { 0 } } } };
+
+/**
+  Macro Definitions ...
+
+  IsBlank   Check whether a character separates words in the policy
+  WordIs    Check whether a word of the policy is the given string
+ */
+
+#define IsBlank(Char) (' ' == (Char) || '\t' == (Char) || '\r' == (Char))
+#define WordIs(Text, Word, Length, String)                                \
+  (sizeof(String) - 1 == (Length) &&                                      \
+   !CompareMem((Text) + (Word), String, sizeof(String) - 1))
+
+/**
+  Find the rank of a user under a policy.
+
+  @param  Policy  The compiled policy.
+  @param  User    The user to rank.
+
+  @return The position of the first rule the user matches, or NO_RANK if it
+          does not match any rule.
+ */
+STATIC
+UINTN
+EFIAPI
+RankUser(IN USER_POLICY CONST *Policy,
+         IN CRYPTO_USER CONST *User)
+{
+  USER_RULE CONST *Rule;
+  UINTN            Rank;
+
+  for(Rank = 0, Rule = Policy->Rules; Rank < Policy->RuleCount; Rank++, Rule++)
+    if(USER_MATCH_TYPE == Rule->Match?
+         Rule->UserType == User->UserType:
+         CompareGuid(&Rule->UserIdent, &User->UserIdent))
+      return Rank;
+  return NO_RANK;
+}
+
+/**
+  Get the next word from a line of the policy.
+
+  @param  Text    The policy.
+  @param  Pos     The offset in Text to start from.  On return, the offset
+                  just past the word.
+  @param  Limit   The offset of the end of the line.
+  @param  Word    Where to store the offset of the word.
+  @param  Length  Where to store the length of the word.
+
+  @return A BOOLEAN indicating whether there was another word.
+ */
+STATIC
+BOOLEAN
+EFIAPI
+NextWord(IN     CHAR8 CONST *Text,
+         IN OUT UINTN       *Pos,
+         IN     UINTN        Limit,
+         OUT    UINTN       *Word,
+         OUT    UINTN       *Length)
+{
+  while(*Pos < Limit && IsBlank(Text[*Pos]))
+    (*Pos)++;
+  *Word = *Pos;
+  while(*Pos < Limit && !IsBlank(Text[*Pos]))
+    (*Pos)++;
+  *Length = *Pos - *Word;
+  return 0 != *Length;
+}
+
+/**
+  Parse a decimal, or 0x prefixed hexadecimal, number.
+
+  @param  String  Pointer to the number.
+  @param  Length  Length of the number.
+  @param  Value   Where to store the value.
+
+  @return A BOOLEAN indicating whether parsing was successful or not.
+ */
+STATIC
+BOOLEAN
+EFIAPI
+ParseNumber(IN  CHAR8 CONST *String,
+            IN  UINTN        Length,
+            OUT UINT32      *Value)
+{
+  UINT32 Base = 10;
+  UINT32 Digit;
+  CHAR8  Char;
+
+  if(Length > 2 && '0' == String[0] && ('x' == String[1] || 'X' == String[1])) {
+    Base     = 16;
+    String  += 2;
+    Length  -= 2;
+  }
+  if(!Length)
+    return FALSE;
+  for(*Value = 0; Length; Length--) {
+    Char = *String++;
+    if('0' <= Char && Char <= '9')
+      Digit = Char - '0';
+    else if(16 == Base && 'a' <= Char && Char <= 'f')
+      Digit = Char - 'a' + 10;
+    else if(16 == Base && 'A' <= Char && Char <= 'F')
+      Digit = Char - 'A' + 10;
+    else
+      return FALSE;
+    if(*Value > (MAX_UINT32 - Digit) / Base)
+      return FALSE;
+    *Value = *Value * Base + Digit;
+  }
+  return TRUE;
+}
+
+/**
+  Parse the user that a keep or prefer rule applies to.
+
+  @param  Text    The policy.
+  @param  Pos     The offset in Text of the user.  On return, the offset just
+                  past it.
+  @param  Limit   The offset of the end of the line.
+  @param  Rule    Where to store the rule.
+
+  @return A BOOLEAN indicating whether parsing was successful or not.
+ */
+STATIC
+BOOLEAN
+EFIAPI
+ParseUserRule(IN     CHAR8 CONST *Text,
+              IN OUT UINTN       *Pos,
+              IN     UINTN        Limit,
+              OUT    USER_RULE   *Rule)
+{
+  UINTN Word;
+  UINTN Length;
+
+  if(!NextWord(Text, Pos, Limit, &Word, &Length))
+    return FALSE;
+  SetMem(Rule, sizeof(*Rule), 0);
+  Rule->Match = USER_MATCH_TYPE;
+  if(WordIs(Text, Word, Length, "disk"))
+    Rule->UserType = USER_TYPE_DISK;
+  else if(WordIs(Text, Word, Length, "recovery"))
+    Rule->UserType = USER_TYPE_RECOVERY;
+  else if(WordIs(Text, Word, Length, "regular"))
+    Rule->UserType = USER_TYPE_REGULAR;
+  else if(WordIs(Text, Word, Length, "type"))
+    return NextWord(Text, Pos, Limit, &Word, &Length) &&
+           ParseNumber(Text + Word, Length, &Rule->UserType);
+  else if(WordIs(Text, Word, Length, "ident")) {
+    Rule->Match = USER_MATCH_IDENT;
+    return NextWord(Text, Pos, Limit, &Word, &Length) &&
+           (36 == Length || 38 == Length) &&
+           ParseGuid(Text + Word, Length, &Rule->UserIdent);
+  }
+  else
+    return FALSE;
+  return TRUE;
+}
+
+/**
+  Set the policy that chooses which CryptoUsers the filter keeps.
+
+  The keep rules are gathered separately while the policy is parsed, and
+  follow the prefer rules in the compiled decision table.
+
+  @param  Policy      The contents of the policy file.
+  @param  PolicySize  The size of the policy file.
+
+  @retval EFI_SUCCESS           The policy was set.
+  @retval EFI_INVALID_PARAMETER The policy is not valid, or has no keep or
+                                prefer rules.  The policy is not changed.
+  @retval EFI_UNSUPPORTED       The policy has too many rules, or a count that
+                                is too large.  The policy is not changed.
+ */
+EFI_STATUS
+EFIAPI
+SetUserPolicy(IN CHAR8 CONST *Policy,
+              IN UINTN        PolicySize)
+{
+  USER_POLICY Compiled;
+  USER_RULE   KeepRules[MAX_USER_RULES];
+  USER_RULE   Rule;
+  UINTN       KeepRuleCount;
+  UINTN       Line;
+  UINTN       Limit;
+  UINTN       Pos;
+  UINTN       Word;
+  UINTN       Length;
+  UINT32      Count;
+
+  if(!Policy && PolicySize)
+    return EFI_INVALID_PARAMETER;
+
+  SetMem(&Compiled, sizeof(Compiled), 0);
+  Compiled.KeepCount = 1;
+  KeepRuleCount      = 0;
+  for(Line = 0; Line < PolicySize; Line = Limit + 1) {
+    for(Limit = Line; Limit < PolicySize && '\n' != Policy[Limit]; Limit++)
+      ;
+    // Ignore comments
+    for(Pos = Line; Pos < Limit && '#' != Policy[Pos]; Pos++)
+      ;
+    if(!NextWord(Policy, &Line, Pos, &Word, &Length))
+      continue;
+
+    if(WordIs(Policy, Word, Length, "count")) {
+      if(!NextWord(Policy, &Line, Pos, &Word, &Length) ||
+         !ParseNumber(Policy + Word, Length, &Count) || !Count)
+        return EFI_INVALID_PARAMETER;
+      if(Count > MAX_KEPT_USERS)
+        return EFI_UNSUPPORTED;
+      Compiled.KeepCount = Count;
+    }
+    else if(WordIs(Policy, Word, Length, "keep") ||
+            WordIs(Policy, Word, Length, "prefer")) {
+      if(!ParseUserRule(Policy, &Line, Pos, &Rule))
+        return EFI_INVALID_PARAMETER;
+      if(Compiled.RuleCount + KeepRuleCount == MAX_USER_RULES)
+        return EFI_UNSUPPORTED;
+      if(WordIs(Policy, Word, Length, "keep"))
+        CopyMem(KeepRules + KeepRuleCount++, &Rule, sizeof(Rule));
+      else
+        CopyMem(Compiled.Rules + Compiled.RuleCount++, &Rule, sizeof(Rule));
+    }
+    else
+      return EFI_INVALID_PARAMETER;
+
+    // Nothing may follow a rule but a comment
+    if(NextWord(Policy, &Line, Pos, &Word, &Length))
+      return EFI_INVALID_PARAMETER;
+  }
+
+  if(!(Compiled.RuleCount + KeepRuleCount))
+    return EFI_INVALID_PARAMETER;
+  CopyMem(Compiled.Rules + Compiled.RuleCount,
+          KeepRules,
+          KeepRuleCount * sizeof(USER_RULE));
+  Compiled.RuleCount += KeepRuleCount;
+  CopyMem(&mUserPolicy, &Compiled, sizeof(Compiled));
+  return EFI_SUCCESS;
+}
+
+/**
+  Offer a user for a selection.
+
+  The best users offered so far are held in order of rank, and a later user
+  only takes the place of one with a worse rank, so users of the same rank
+  are kept in the order they appear in the file.
+
+  @param  Selection The selection, which is empty when zeroed.
+  @param  User      The user, offered in the order they appear in the file.
+ */
+VOID
+EFIAPI
+SelectUser(IN OUT USER_SELECTION    *Selection,
+           IN     CRYPTO_USER CONST *User)
+{
+  UINTN Rank;
+  UINTN Pos;
+
+  if(NO_RANK == (Rank = RankUser(&mUserPolicy, User)))
+    return;
+  if(Selection->Count == mUserPolicy.KeepCount) {
+    if(Rank >= Selection->Rank[Selection->Count - 1])
+      return;
+    Selection->Count--;
+  }
+  for(Pos = Selection->Count; Pos && Selection->Rank[Pos - 1] > Rank; Pos--) {
+    Selection->Rank[Pos] = Selection->Rank[Pos - 1];
+    CopyMem(Selection->Users + Pos,
+            Selection->Users + Pos - 1,
+            sizeof(CRYPTO_USER));
+  }
+  Selection->Rank[Pos] = Rank;
+  CopyMem(Selection->Users + Pos, User, sizeof(CRYPTO_USER));
+  Selection->Count++;
+}
+
+/**
+  Finish a selection, putting the users kept into the order they appear in
+  the file.  No more users may be offered afterwards.
+
+  @param  Selection The selection.
+ */
+VOID
+EFIAPI
+FinishUserSelection(IN OUT USER_SELECTION *Selection)
+{
+  CRYPTO_USER User;
+  UINTN       Idx;
+  UINTN       Pos;
+
+  for(Idx = 1; Idx < Selection->Count; Idx++) {
+    CopyMem(&User, Selection->Users + Idx, sizeof(User));
+    for(Pos = Idx;
+        Pos && Selection->Users[Pos - 1].DictStart > User.DictStart;
+        Pos--)
+      CopyMem(Selection->Users + Pos,
+              Selection->Users + Pos - 1,
+              sizeof(CRYPTO_USER));
+    CopyMem(Selection->Users + Pos, &User, sizeof(User));
+  }
+}
+
+/**
+  Choose the users to keep from a complete index of the CryptoUsers array.
+
+  @param  Index   The complete index of the users.
+ */
+VOID
+EFIAPI
+SelectUsers(IN OUT CRYPTO_USER_INDEX *Index)
+{
+  USER_SELECTION Selection;
+  UINTN          Idx;
+  UINTN          Pos;
+
+  SetMem(&Selection, sizeof(Selection), 0);
+  for(Idx = 0; Idx < Index->Count; Idx++) {
+    Index->Users[Idx].Keep = FALSE;
+    SelectUser(&Selection, Index->Users + Idx);
+  }
+  FinishUserSelection(&Selection);
+
+  // Both are in file order, so the kept users are marked in a single pass
+  for(Idx = Pos = 0; Idx < Index->Count && Pos < Selection.Count; Idx++)
+    if(Index->Users[Idx].DictStart == Selection.Users[Pos].DictStart) {
+      Index->Users[Idx].Keep = TRUE;
+      Pos++;
+    }
+  Index->KeptCount = Selection.Count;
+}
@@ -0,0 +1,116 @@
+/**
+ * Copyright (c) 2015, baskingshark
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __FV2_USER_POLICY_H__
+#define __FV2_USER_POLICY_H__
+
+#include <Uefi.h>
+#include "FV2PlistFilter.h"
+
+/**
+  Set the policy that chooses which CryptoUsers the filter keeps.
+
+  The policy is a text file with one rule per line.  Blank lines and anything
+  from a '#' to the end of a line are ignored.  The rules are:
+
+    keep <user>     Keep users matching <user>.
+    prefer <user>   Keep users matching <user> ahead of those matched by any
+                    keep rule.
+    count <n>       Keep at most <n> users (1 if there is no count rule).
+
+  where <user> is one of:
+
+    disk            A user of the disk password type.
+    recovery        A user of the institutional recovery key type.
+    regular         A user of the regular user type.
+    type <n>        A user with UserType <n>.
+    ident <guid>    The user with UserIdent <guid>.
+
+  Numbers may be decimal or hexadecimal with a 0x prefix.  Users matching an
+  earlier keep (or prefer) rule are preferred to those matching a later one,
+  and users are otherwise preferred in the order they appear in the file.
+
+  The rules are compiled into a decision table once, here.  Until this is
+  called successfully, the policy is "keep disk".
+
+  @param  Policy      The contents of the policy file.
+  @param  PolicySize  The size of the policy file.
+
+  @retval EFI_SUCCESS           The policy was set.
+  @retval EFI_INVALID_PARAMETER The policy is not valid, or has no keep or
+                                prefer rules.  The policy is not changed.
+  @retval EFI_UNSUPPORTED       The policy has too many rules, or a count that
+                                is too large.  The policy is not changed.
+ */
+EFI_STATUS
+EFIAPI
+SetUserPolicy(IN CHAR8 CONST *Policy,
+              IN UINTN        PolicySize);
+
+/**
+  Offer a user for a selection.
+
+  The users of the CryptoUsers array are offered one at a time, in the order
+  they appear in the file, and the selection holds the best of them so far.
+  This lets the users be chosen in a single pass without keeping the whole
+  array.
+
+  @param  Selection The selection, which is empty when zeroed.
+  @param  User      The user to offer.
+ */
+VOID
+EFIAPI
+SelectUser(IN OUT USER_SELECTION    *Selection,
+           IN     CRYPTO_USER CONST *User);
+
+/**
+  Finish a selection once every user in the array has been offered.
+
+  The users kept are put into the order they appear in the file.  No more
+  users may be offered afterwards.
+
+  @param  Selection The selection.
+ */
+VOID
+EFIAPI
+FinishUserSelection(IN OUT USER_SELECTION *Selection);
+
+/**
+  Choose the users to keep from a complete index of the CryptoUsers array.
+
+  The users are offered to a selection in turn, so the same users are chosen
+  as when the file is filtered without an index.  The Keep flag of each user
+  is set, and the number of users kept is stored in the index.
+
+  @param  Index   The complete index of the users.
+ */
+VOID
+EFIAPI
+SelectUsers(IN OUT CRYPTO_USER_INDEX *Index);
+
+#endif
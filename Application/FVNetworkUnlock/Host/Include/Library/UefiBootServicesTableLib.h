@@ -0,0 +1,57 @@
+/**
+ * Copyright (c) 2015, baskingshark
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/**
+ * Host replacement for the EDK2 UefiBootServicesTableLib, providing just the
+ * boot services used by the plist filter.  The host check supplies gBS.
+ */
+#ifndef __UEFI_BOOT_SERVICES_TABLE_LIB_H__
+#define __UEFI_BOOT_SERVICES_TABLE_LIB_H__
+
+#include <Uefi.h>
+
+typedef enum {
+  EfiBootServicesData = 4
+} EFI_MEMORY_TYPE;
+
+typedef struct {
+  EFI_STATUS (EFIAPI *AllocatePool)(IN  EFI_MEMORY_TYPE   PoolType,
+                                    IN  UINTN             Size,
+                                    OUT VOID            **Buffer);
+  EFI_STATUS (EFIAPI *FreePool)(IN VOID *Buffer);
+  VOID       (EFIAPI *CopyMem)(IN VOID  *Destination,
+                               IN VOID  *Source,
+                               IN UINTN  Length);
+  VOID       (EFIAPI *SetMem)(IN VOID  *Buffer,
+                              IN UINTN  Size,
+                              IN UINT8  Value);
+} EFI_BOOT_SERVICES;
+
+extern EFI_BOOT_SERVICES *gBS;
+
+#endif
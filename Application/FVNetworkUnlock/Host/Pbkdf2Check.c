@@ -0,0 +1,456 @@
+/**
+ * Copyright (c) 2015, baskingshark
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Host check of the key derivation used to verify the password.
+ *
+ * The SHA-256, HMAC-SHA256 and PBKDF2-HMAC-SHA256 code of Pbkdf2.c is
+ * checked against the known answers of FIPS 180-2, RFC 4231 and RFC 7914,
+ * with the messages hashed whole and in pieces.  A PassphraseWrappedKEKStruct
+ * is then built by wrapping a KEK under a key derived from a password, and
+ * UnwrapKekStruct of FV2Passphrase.c must unlock it with that password and
+ * only that password.
+ *
+ * Usage: Pbkdf2Check
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The internal functions are checked too, so they are built here
+#include "../Pbkdf2.c"
+#include "../FV2Passphrase.c"
+
+/**
+ * Boot services for VerifyPassword and the filter it uses, using the C
+ * library.
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+HostAllocatePool(IN  EFI_MEMORY_TYPE   PoolType,
+                 IN  UINTN             Size,
+                 OUT VOID            **Buffer) {
+  *Buffer = malloc(Size);
+  return *Buffer ? EFI_SUCCESS : EFI_OUT_OF_RESOURCES;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+HostFreePool(IN VOID *Buffer) {
+  free(Buffer);
+  return EFI_SUCCESS;
+}
+
+STATIC
+VOID
+EFIAPI
+HostCopyMem(IN VOID  *Destination,
+            IN VOID  *Source,
+            IN UINTN  Length) {
+  memmove(Destination, Source, Length);
+}
+
+STATIC
+VOID
+EFIAPI
+HostSetMem(IN VOID  *Buffer,
+           IN UINTN  Size,
+           IN UINT8  Value) {
+  memset(Buffer, Value, Size);
+}
+
+STATIC EFI_BOOT_SERVICES HostBootServices = {
+  HostAllocatePool, HostFreePool, HostCopyMem, HostSetMem
+};
+
+EFI_BOOT_SERVICES *gBS = &HostBootServices;
+
+/**
+ * VerifyPassword reads the wipekey from the disk, which is not checked here,
+ * so there is never a file to find.
+ */
+EFI_STATUS
+EFIAPI
+LoadFile(IN  EFI_HANDLE   Device,
+         IN  CHAR16      *FilePath,
+         OUT UINTN       *Size,
+         OUT VOID       **Buffer) {
+  return EFI_NOT_FOUND;
+}
+
+EFI_STATUS
+EFIAPI
+GetXtsAesContext(IN  FV2_VOLUME             *FV2Volume,
+                 OUT XTS_AES_CONTEXT CONST **Context) {
+  return EFI_NOT_FOUND;
+}
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+STATIC UINTN Failures;
+
+/**
+ * Report a failure, printing only the first few.
+ */
+STATIC
+VOID
+Fail(IN CONST CHAR8 *Format,
+     ...) {
+  va_list Args;
+
+  if(Failures++ >= 20)
+    return;
+  va_start(Args, Format);
+  vprintf(Format, Args);
+  va_end(Args);
+  printf("\n");
+}
+
+/**
+ * Convert a known answer from hex, returning its size in bytes.
+ */
+STATIC
+UINTN
+FromHex(IN  CONST CHAR8 *Hex,
+        OUT UINT8       *Bytes) {
+  UINTN  Size;
+  UINT32 Byte;
+
+  for(Size = 0; Hex[2 * Size]; Size++) {
+    sscanf(Hex + 2 * Size, "%2x", &Byte);
+    Bytes[Size] = (UINT8)Byte;
+  }
+  return Size;
+}
+
+/**
+ * Compare a result with its known answer in hex.
+ */
+STATIC
+VOID
+CheckAnswer(IN CONST UINT8 *Result,
+            IN UINTN        Size,
+            IN CONST CHAR8 *Expected,
+            IN CONST CHAR8 *Format,
+            ...) {
+  UINT8   Answer[64];
+  va_list Args;
+  UINTN   Idx;
+
+  if(FromHex(Expected, Answer) == Size && !memcmp(Result, Answer, Size))
+    return;
+  if(Failures < 20) {
+    va_start(Args, Format);
+    vprintf(Format, Args);
+    va_end(Args);
+    printf(": got ");
+    for(Idx = 0; Idx < Size; Idx++)
+      printf("%02x", Result[Idx]);
+    printf(", expected %s\n", Expected);
+  }
+  Failures++;
+}
+
+/**
+ * SHA-256 known answers.  The 56 byte message needs a second block for its
+ * length, and the 64 byte one a whole block of padding.
+ */
+typedef struct _SHA256_KAT {
+  CONST CHAR8 *Message;
+  UINTN        Repeat;
+  CONST CHAR8 *Digest;
+} SHA256_KAT;
+
+STATIC SHA256_KAT CONST Sha256Kats[] = {
+  { "", 1,
+    "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+  { "abc", 1,
+    "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+  { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+    "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+  { "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmno", 1,
+    "2ff100b36c386c65a1afc462ad53e25479bec9498ed00aa5a04de584bc25301b" },
+  { "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+    "aaaaaaaaaaaaaaaaaaaaaaaaaaaa", 10000,
+    "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" }
+};
+
+/**
+ * Hash each message whole, a byte at a time, and in pieces that straddle the
+ * blocks.
+ */
+STATIC
+VOID
+CheckSha256(VOID) {
+  STATIC UINTN CONST Pieces[] = { 0, 1, 63 };
+  SHA256_CONTEXT     Context;
+  UINT8              Digest[SHA256_DIGEST_SIZE];
+  UINTN              Kat;
+  UINTN              Piece;
+  UINTN              Length;
+  UINTN              Repeat;
+  UINTN              Done;
+  UINTN              Count;
+
+  for(Kat = 0; Kat < ARRAY_SIZE(Sha256Kats); Kat++) {
+    Length = strlen(Sha256Kats[Kat].Message);
+    for(Piece = 0; Piece < ARRAY_SIZE(Pieces); Piece++) {
+      Sha256Init(&Context);
+      for(Repeat = 0; Repeat < Sha256Kats[Kat].Repeat; Repeat++)
+        for(Done = 0; Done < Length; Done += Count) {
+          Count = Pieces[Piece] ? MIN(Pieces[Piece], Length - Done) : Length;
+          Sha256Update(&Context,
+                       (CONST UINT8*)Sha256Kats[Kat].Message + Done,
+                       Count);
+        }
+      Sha256Final(&Context, Digest);
+      CheckAnswer(Digest, sizeof(Digest), Sha256Kats[Kat].Digest,
+                  "SHA-256 of message %lu in pieces of %lu",
+                  (unsigned long)Kat, (unsigned long)Pieces[Piece]);
+    }
+  }
+}
+
+/**
+ * HMAC-SHA256 known answers of test cases 1, 2, 3 and 6 of RFC 4231.  A key
+ * or message given as a single byte is that byte repeated.  The key of case 6
+ * is longer than a block, so it is hashed first.
+ */
+typedef struct _HMAC_KAT {
+  CONST CHAR8 *Key;
+  UINTN        KeyLength;
+  CONST CHAR8 *Data;
+  UINTN        DataLength;
+  CONST CHAR8 *Mac;
+} HMAC_KAT;
+
+STATIC HMAC_KAT CONST HmacKats[] = {
+  { "\x0b", 20, "Hi There", 8,
+    "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7" },
+  { "Jefe", 4, "what do ya want for nothing?", 28,
+    "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843" },
+  { "\xaa", 20, "\xdd", 50,
+    "773ea91e36800e46854db8ebd09181a72959098b3ef8c122d9635514ced565fe" },
+  { "\xaa", 131, "Test Using Larger Than Block-Size Key - Hash Key First", 54,
+    "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54" }
+};
+
+STATIC
+VOID
+Expand(IN  CONST CHAR8 *Text,
+       IN  UINTN        Length,
+       OUT UINT8       *Bytes) {
+  if(1 == strlen(Text))
+    memset(Bytes, Text[0], Length);
+  else
+    memcpy(Bytes, Text, Length);
+}
+
+/**
+ * Compute each MAC with the message whole, and split between the message and
+ * the extra data as PBKDF2 does with the block index.
+ */
+STATIC
+VOID
+CheckHmac(VOID) {
+  HMAC_SHA256_CONTEXT Keyed;
+  UINT8               Key[256];
+  UINT8               Data[256];
+  UINT8               Mac[SHA256_DIGEST_SIZE];
+  UINTN               Kat;
+  UINTN               Split;
+
+  for(Kat = 0; Kat < ARRAY_SIZE(HmacKats); Kat++) {
+    Expand(HmacKats[Kat].Key, HmacKats[Kat].KeyLength, Key);
+    Expand(HmacKats[Kat].Data, HmacKats[Kat].DataLength, Data);
+    HmacSha256Init(&Keyed, Key, HmacKats[Kat].KeyLength);
+
+    HmacSha256(&Keyed, Data, HmacKats[Kat].DataLength, NULL, 0, Mac);
+    CheckAnswer(Mac, sizeof(Mac), HmacKats[Kat].Mac,
+                "HMAC-SHA256 of message %lu", (unsigned long)Kat);
+
+    Split = HmacKats[Kat].DataLength / 2;
+    HmacSha256(&Keyed, Data, Split,
+               Data + Split, HmacKats[Kat].DataLength - Split, Mac);
+    CheckAnswer(Mac, sizeof(Mac), HmacKats[Kat].Mac,
+                "HMAC-SHA256 of message %lu split", (unsigned long)Kat);
+  }
+}
+
+/**
+ * PBKDF2-HMAC-SHA256 known answers.  The first three are those usually
+ * quoted for RFC 6070 with SHA-256 in place of SHA-1, and the last is from
+ * section 11 of RFC 7914, taking a second block of which only part is used.
+ */
+typedef struct _PBKDF2_KAT {
+  CONST CHAR8 *Password;
+  CONST CHAR8 *Salt;
+  UINT32       Iterations;
+  CONST CHAR8 *Key;
+} PBKDF2_KAT;
+
+STATIC PBKDF2_KAT CONST Pbkdf2Kats[] = {
+  { "password", "salt", 1,
+    "120fb6cffcf8b32c43e7225256c4f837a86548c92ccc35480805987cb70be17b" },
+  { "password", "salt", 2,
+    "ae4d0c95af6b46d32d0adff928f06dd02a303f8ef3c251dfd6e2d85a95474c43" },
+  { "password", "salt", 4096,
+    "c5e478d59288c841aa530db6845c4c8d962893a001ce4e11a4963873aa98134a" },
+  { "passwordPASSWORDpassword", "saltSALTsaltSALTsaltSALTsaltSALTsalt", 4096,
+    "348c89dbcbd32b2f32d814b8116e84cf2b17347ebc1800181c4e2a1fb8dd53e1"
+    "c635518c7dac47e9" }
+};
+
+STATIC
+VOID
+CheckPbkdf2(VOID) {
+  UINT8      Key[64];
+  UINTN      Kat;
+  EFI_STATUS Status;
+
+  for(Kat = 0; Kat < ARRAY_SIZE(Pbkdf2Kats); Kat++) {
+    Status = Pbkdf2HmacSha256((CONST UINT8*)Pbkdf2Kats[Kat].Password,
+                              strlen(Pbkdf2Kats[Kat].Password),
+                              (CONST UINT8*)Pbkdf2Kats[Kat].Salt,
+                              strlen(Pbkdf2Kats[Kat].Salt),
+                              Pbkdf2Kats[Kat].Iterations,
+                              strlen(Pbkdf2Kats[Kat].Key) / 2,
+                              Key);
+    if(EFI_ERROR(Status))
+      Fail("PBKDF2 key %lu: status %lx", (unsigned long)Kat,
+           (unsigned long)Status);
+    else
+      CheckAnswer(Key, strlen(Pbkdf2Kats[Kat].Key) / 2, Pbkdf2Kats[Kat].Key,
+                  "PBKDF2 key %lu", (unsigned long)Kat);
+  }
+
+  if(EFI_INVALID_PARAMETER != Pbkdf2HmacSha256((CONST UINT8*)"password", 8,
+                                               (CONST UINT8*)"salt", 4,
+                                               0, sizeof(Key), Key))
+    Fail("PBKDF2 with no iterations was not rejected");
+}
+
+/**
+ * Build a PassphraseWrappedKEKStruct holding a KEK wrapped under the key
+ * derived from Password, with the unused parts of the structure filled with
+ * junk.
+ */
+STATIC
+VOID
+BuildKekStruct(IN  CONST CHAR8 *Password,
+               IN  UINT32       Iterations,
+               OUT UINT8        KekStruct[KEK_STRUCT_SIZE]) {
+  AES_CONTEXT Context;
+  UINT8       DerivedKey[KEK_DERIVED_KEY_SIZE];
+  UINT8       Kek[KEK_WRAPPED_SIZE - 8];
+  UINTN       Idx;
+
+  for(Idx = 0; Idx < KEK_STRUCT_SIZE; Idx++)
+    KekStruct[Idx] = (UINT8)(Idx * 131 + 7);
+  for(Idx = 0; Idx < sizeof(Kek); Idx++)
+    Kek[Idx] = (UINT8)(0xf0 - Idx);
+  KekStruct[KEK_ITERATIONS_OFFSET + 0] = (UINT8)(Iterations >>  0);
+  KekStruct[KEK_ITERATIONS_OFFSET + 1] = (UINT8)(Iterations >>  8);
+  KekStruct[KEK_ITERATIONS_OFFSET + 2] = (UINT8)(Iterations >> 16);
+  KekStruct[KEK_ITERATIONS_OFFSET + 3] = (UINT8)(Iterations >> 24);
+
+  if(EFI_ERROR(Pbkdf2HmacSha256((CONST UINT8*)Password,
+                                strlen(Password),
+                                KekStruct + KEK_SALT_OFFSET,
+                                KEK_SALT_SIZE,
+                                Iterations,
+                                sizeof(DerivedKey),
+                                DerivedKey)) ||
+     EFI_ERROR(AesInitContext(sizeof(DerivedKey) * 8, DerivedKey, &Context)) ||
+     EFI_ERROR(AesKeyWrap(&Context,
+                          sizeof(Kek),
+                          Kek,
+                          KekStruct + KEK_WRAPPED_OFFSET)))
+    Fail("Could not build a PassphraseWrappedKEKStruct");
+}
+
+STATIC
+VOID
+CheckUnwrap(IN CONST UINT8 *KekStruct,
+            IN CONST CHAR8 *Password,
+            IN EFI_STATUS   Expected,
+            IN CONST CHAR8 *What) {
+  EFI_STATUS Status;
+
+  Status = UnwrapKekStruct(KekStruct, Password, strlen(Password));
+  if(Expected != Status)
+    Fail("Unwrapping %s: status %lx, expected %lx", What,
+         (unsigned long)Status, (unsigned long)Expected);
+}
+
+/**
+ * Only the password the structure was built with may unlock it.
+ */
+STATIC
+VOID
+CheckKekStruct(VOID) {
+  UINT8 KekStruct[KEK_STRUCT_SIZE];
+
+  BuildKekStruct("correct horse", 1000, KekStruct);
+  CheckUnwrap(KekStruct, "correct horse", EFI_SUCCESS,
+              "with the password");
+  CheckUnwrap(KekStruct, "correct hors", EFI_SECURITY_VIOLATION,
+              "with a shorter password");
+  CheckUnwrap(KekStruct, "Correct horse", EFI_SECURITY_VIOLATION,
+              "with a different password");
+  CheckUnwrap(KekStruct, "", EFI_SECURITY_VIOLATION,
+              "with no password");
+
+  KekStruct[KEK_SALT_OFFSET] ^= 1;
+  CheckUnwrap(KekStruct, "correct horse", EFI_SECURITY_VIOLATION,
+              "with a different salt");
+  KekStruct[KEK_SALT_OFFSET] ^= 1;
+  KekStruct[KEK_WRAPPED_OFFSET + KEK_WRAPPED_SIZE - 1] ^= 1;
+  CheckUnwrap(KekStruct, "correct horse", EFI_SECURITY_VIOLATION,
+              "a corrupted KEK");
+
+  BuildKekStruct("", 1, KekStruct);
+  CheckUnwrap(KekStruct, "", EFI_SUCCESS,
+              "with an empty password");
+  SetMem(KekStruct + KEK_ITERATIONS_OFFSET, 4, 0);
+  CheckUnwrap(KekStruct, "", EFI_UNSUPPORTED,
+              "with no iterations");
+}
+
+int
+main(VOID) {
+  CheckSha256();
+  CheckHmac();
+  CheckPbkdf2();
+  CheckKekStruct();
+
+  printf("Pbkdf2Check: %lu failures\n", (unsigned long)Failures);
+  return Failures ? 1 : 0;
+}
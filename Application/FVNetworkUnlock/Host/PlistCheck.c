@@ -0,0 +1,1275 @@
+/**
+ * Copyright (c) 2015, baskingshark
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Host check of the plist filter of FVNetworkUnlock.
+ *
+ * Random EncryptedRoot.plist.wipekey files are generated, recording the
+ * offsets of the CryptoUsers array and of each user as they are written.  The
+ * users found by the tokenizer, their PassphraseWrappedKEKStructs and the
+ * filtered file are then compared with what those records say they should
+ * be.  The files have comments, a DOCTYPE, nested dicts holding decoy keys,
+ * empty users, keys in any order, large base64 data and trailing NULs, and
+ * some are cut short.  The filtered file is also re-encrypted in place with
+ * XTS-AES, as FV2Hook does.
+ *
+ * Usage: PlistCheck [-n cases] [-s seed]
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The internal functions of the filter are checked too, so it is built here
+#include "../FV2PlistFilter.c"
+
+// After the filter, which calls the boot services of the same names
+#include <Library/BaseMemoryLib.h>
+#include <Library/Aes.h>
+
+/**
+ * Boot services for the filter, using the C library.
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+HostAllocatePool(IN  EFI_MEMORY_TYPE   PoolType,
+                 IN  UINTN             Size,
+                 OUT VOID            **Buffer) {
+  *Buffer = malloc(Size);
+  return *Buffer ? EFI_SUCCESS : EFI_OUT_OF_RESOURCES;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+HostFreePool(IN VOID *Buffer) {
+  free(Buffer);
+  return EFI_SUCCESS;
+}
+
+STATIC
+VOID
+EFIAPI
+HostCopyMem(IN VOID  *Destination,
+            IN VOID  *Source,
+            IN UINTN  Length) {
+  memmove(Destination, Source, Length);
+}
+
+STATIC
+VOID
+EFIAPI
+HostSetMem(IN VOID  *Buffer,
+           IN UINTN  Size,
+           IN UINT8  Value) {
+  memset(Buffer, Value, Size);
+}
+
+STATIC EFI_BOOT_SERVICES HostBootServices = {
+  HostAllocatePool, HostFreePool, HostCopyMem, HostSetMem
+};
+
+EFI_BOOT_SERVICES *gBS = &HostBootServices;
+
+/**
+ * Limits of the generated files.
+ */
+#define MAX_PLIST_SIZE  (1024 * 1024)
+#define MAX_GEN_USERS   24
+#define MAX_KEK_SIZE    20000
+
+// As in FV2UserPolicy.c
+#define MAX_POLICY_RULES    16
+#define USER_TYPE_DISK      0x10000001
+#define USER_TYPE_RECOVERY  0x10010005
+#define USER_TYPE_REGULAR   0x10060002
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/**
+ * A user written to a generated file.  Kek is the offset of its decoded
+ * PassphraseWrappedKEKStruct in the Keks of the file.
+ */
+typedef struct _GEN_USER {
+  UINTN    DictStart;
+  UINTN    DictEnd;
+  UINT32   UserType;
+  EFI_GUID UserIdent;
+  BOOLEAN  HasKek;
+  UINTN    Kek;
+  UINTN    KekSize;
+} GEN_USER;
+
+/**
+ * A generated file.  HasArray is whether the whole CryptoUsers array is in
+ * the file, and UserCount counts the users that are.
+ */
+typedef struct _GEN_PLIST {
+  CHAR8    Data[MAX_PLIST_SIZE];
+  UINTN    Size;
+  BOOLEAN  HasArray;
+  UINTN    ArrayStart;
+  UINTN    ArrayEnd;
+  UINTN    UserCount;
+  GEN_USER Users[MAX_GEN_USERS];
+  UINT8    Keks[MAX_GEN_USERS * MAX_KEK_SIZE];
+  UINTN    KeksSize;
+} GEN_PLIST;
+
+/**
+ * A simple model of the user policy: the rules in order of preference.
+ */
+typedef struct _MODEL_RULE {
+  BOOLEAN  Ident;
+  UINT32   UserType;
+  EFI_GUID UserIdent;
+} MODEL_RULE;
+
+typedef struct _MODEL_POLICY {
+  UINTN      KeepCount;
+  UINTN      RuleCount;
+  MODEL_RULE Rules[MAX_POLICY_RULES];
+} MODEL_POLICY;
+
+STATIC GEN_PLIST    Plist;
+STATIC MODEL_POLICY Model = { 1, 1, { { FALSE, USER_TYPE_DISK, { 0 } } } };
+STATIC CHAR8        Expected[MAX_PLIST_SIZE];
+STATIC UINTN        ExpectedSize;
+STATIC CHAR8        Work[MAX_PLIST_SIZE + 64];
+STATIC UINT8        KekBuffer[MAX_KEK_SIZE];
+STATIC UINT8        Encrypted[MAX_PLIST_SIZE];
+STATIC UINT8        Reference[MAX_PLIST_SIZE];
+STATIC UINTN        Failures;
+
+/**
+ * State of the xorshift64* generator used for the files, so that a failing
+ * run can be repeated with the same seed.
+ */
+STATIC UINT64 RandomState = 1;
+
+STATIC
+UINT64
+Random(VOID) {
+  RandomState ^= RandomState >> 12;
+  RandomState ^= RandomState << 25;
+  RandomState ^= RandomState >> 27;
+  return RandomState * 0x2545f4914f6cdd1dULL;
+}
+
+STATIC
+UINTN
+RandomBelow(IN UINTN Limit) {
+  return (UINTN)((Random() >> 11) % Limit);
+}
+
+/**
+ * Report a failure, printing only the first few.  Checks that are not of a
+ * generated file pass NO_CASE.
+ */
+#define NO_CASE ((UINTN)-1)
+
+STATIC
+VOID
+Fail(IN UINTN        Case,
+     IN CONST CHAR8 *Format,
+     ...) {
+  va_list Args;
+
+  if(Failures++ >= 20)
+    return;
+  if(NO_CASE != Case)
+    printf("case %lu: ", (unsigned long)Case);
+  va_start(Args, Format);
+  vprintf(Format, Args);
+  va_end(Args);
+  printf("\n");
+}
+
+/**
+ * Append to the generated file.
+ */
+STATIC
+VOID
+Emit(IN CONST CHAR8 *Format,
+     ...) {
+  va_list Args;
+
+  va_start(Args, Format);
+  Plist.Size += vsnprintf(Plist.Data + Plist.Size,
+                          MAX_PLIST_SIZE - Plist.Size,
+                          Format,
+                          Args);
+  va_end(Args);
+}
+
+/**
+ * Append the whitespace, and now and then a comment, found between elements.
+ */
+STATIC
+VOID
+EmitSpace(VOID) {
+  STATIC CONST CHAR8 *Spaces[] = { "", "\n", "\n\t", "\n\t\t", " " };
+
+  Emit("%s", Spaces[RandomBelow(ARRAY_SIZE(Spaces))]);
+  if(!RandomBelow(16))
+    Emit("<!-- <dict><key>UserType</key> </array> -->%s",
+         Spaces[RandomBelow(ARRAY_SIZE(Spaces))]);
+}
+
+/**
+ * Append data as base64, broken into lines as in a plist.
+ */
+STATIC
+VOID
+EmitBase64(IN UINT8 CONST *Data,
+           IN UINTN        Size) {
+  STATIC CONST CHAR8 Digits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  UINT32 Bits;
+  UINTN  Idx;
+  UINTN  Count;
+  UINTN  Line = 0;
+
+  for(Idx = 0; Idx < Size; Idx += 3) {
+    Count = MIN(Size - Idx, 3);
+    Bits = (UINT32)Data[Idx] << 16;
+    if(Count > 1)
+      Bits |= (UINT32)Data[Idx + 1] << 8;
+    if(Count > 2)
+      Bits |= Data[Idx + 2];
+    Emit("%c%c%c%c",
+         Digits[(Bits >> 18) & 63],
+         Digits[(Bits >> 12) & 63],
+         Count > 1 ? Digits[(Bits >> 6) & 63] : '=',
+         Count > 2 ? Digits[Bits & 63] : '=');
+    if(++Line == 13 && Idx + 3 < Size) {
+      Emit("\n\t\t");
+      Line = 0;
+    }
+  }
+}
+
+/**
+ * Append a GUID in either case.
+ */
+STATIC
+VOID
+EmitGuid(IN EFI_GUID CONST *Guid) {
+  Emit(RandomBelow(2) ? "%08X-%04X-%04X-%02X%02X-%02X%02X%02X%02X%02X%02X" :
+                        "%08x-%04x-%04x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+       Guid->Data1, Guid->Data2, Guid->Data3,
+       Guid->Data4[0], Guid->Data4[1], Guid->Data4[2], Guid->Data4[3],
+       Guid->Data4[4], Guid->Data4[5], Guid->Data4[6], Guid->Data4[7]);
+}
+
+/**
+ * A UserIdent from a small pool, so that users share them now and then.
+ */
+STATIC
+VOID
+RandomIdent(OUT EFI_GUID *Guid) {
+  STATIC CONST EFI_GUID Base = {
+    0, 0x1111, 0x2222, { 0x33, 0x33, 0x44, 0x44, 0x55, 0x55, 0x66, 0x66 }
+  };
+
+  CopyMem(Guid, &Base, sizeof(*Guid));
+  Guid->Data1 = (UINT32)RandomBelow(4);
+}
+
+/**
+ * Append a user, with its keys in a random order.
+ */
+STATIC
+VOID
+GenUser(OUT GEN_USER *User) {
+  STATIC CONST UINT32 Types[] = {
+    USER_TYPE_DISK, USER_TYPE_RECOVERY, USER_TYPE_REGULAR
+  };
+  UINTN Items[7];
+  UINTN Count;
+  UINTN Idx;
+  UINTN Swap;
+  UINTN Size;
+
+  SetMem(User, sizeof(*User), 0);
+  User->DictStart = Plist.Size;
+  if(!RandomBelow(16)) {
+    Emit("<dict></dict>");
+    User->DictEnd = Plist.Size;
+    return;
+  }
+
+  // Each key is present more or less often, and the keys are shuffled
+  for(Count = Idx = 0; Idx < ARRAY_SIZE(Items); Idx++)
+    if(RandomBelow(8) < (Idx < 3 ? 7 : 4))
+      Items[Count++] = Idx;
+  for(Idx = Count; Idx > 1; Idx--) {
+    Swap = RandomBelow(Idx);
+    Size = Items[Idx - 1];
+    Items[Idx - 1] = Items[Swap];
+    Items[Swap] = Size;
+  }
+
+  Emit("<dict>");
+  for(Idx = 0; Idx < Count; Idx++) {
+    EmitSpace();
+    switch(Items[Idx]) {
+    case 0:
+      User->UserType = RandomBelow(4) ? Types[RandomBelow(3)] :
+                                        (UINT32)RandomBelow(1000000) + 1;
+      Emit("<key>UserType</key>");
+      EmitSpace();
+      Emit("<integer>%u</integer>", User->UserType);
+      break;
+    case 1:
+      RandomIdent(&User->UserIdent);
+      Emit("<key>UserIdent</key>");
+      EmitSpace();
+      Emit("<string>");
+      EmitGuid(&User->UserIdent);
+      Emit("</string>");
+      break;
+    case 2:
+      User->HasKek  = TRUE;
+      User->Kek     = Plist.KeksSize;
+      User->KekSize = RandomBelow(16) ? RandomBelow(400) :
+                                        RandomBelow(MAX_KEK_SIZE + 1);
+      for(Size = 0; Size < User->KekSize; Size++)
+        Plist.Keks[Plist.KeksSize++] = (UINT8)Random();
+      Emit("<key>PassphraseWrappedKEKStruct</key>");
+      EmitSpace();
+      Emit(User->KekSize ? "<data>\n\t\t" : "<data>");
+      EmitBase64(Plist.Keks + User->Kek, User->KekSize);
+      Emit(User->KekSize ? "\n\t\t</data>" : "</data>");
+      break;
+    case 3:
+      Emit("<key>WrapVersion</key><integer>1</integer>");
+      break;
+    case 4:
+      // Keys of a nested dict are not keys of the user
+      Emit("<key>PassphraseHint</key>");
+      EmitSpace();
+      Emit("<dict><key>UserType</key><integer>%u</integer>"
+           "<key>UserIdent</key><string>00000000-1111-2222-3333-444455556666"
+           "</string><key>PassphraseWrappedKEKStruct</key><data>AAAA</data>"
+           "</dict>", USER_TYPE_DISK);
+      break;
+    case 5:
+      Emit("<key>UserNamesData</key><array><data>QUJD</data><true/></array>");
+      break;
+    case 6:
+      Emit("<key>EFILoginGraphics</key><false/>");
+      break;
+    }
+  }
+  EmitSpace();
+  Emit("</dict>");
+  User->DictEnd = Plist.Size;
+}
+
+/**
+ * Generate a file, which might not have a CryptoUsers array, or might be cut
+ * short.
+ */
+STATIC
+VOID
+GenPlist(VOID) {
+  UINTN Count;
+  UINTN Idx;
+  UINTN Size;
+
+  Plist.Size       = 0;
+  Plist.KeksSize   = 0;
+  Plist.HasArray   = FALSE;
+  Plist.ArrayStart = 0;
+  Plist.ArrayEnd   = 0;
+  Count            = 0;
+
+  Emit("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+  if(RandomBelow(2))
+    Emit("<!DOCTYPE plist PUBLIC \"-//Apple//DTD PLIST 1.0//EN\" "
+         "\"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n");
+  Emit("<plist version=\"1.0\">\n<dict>");
+  EmitSpace();
+  if(RandomBelow(2)) {
+    Emit("<key>ConversionInfo</key>");
+    EmitSpace();
+    Emit("<dict><key>CryptoUsers</key><string>not the array</string>"
+         "<key>TargetContext</key><integer>1</integer></dict>");
+    EmitSpace();
+  }
+
+  if(RandomBelow(8)) {
+    Plist.HasArray = TRUE;
+    Emit("<key>CryptoUsers</key>");
+    EmitSpace();
+    Emit("<array>");
+    Plist.ArrayStart = Plist.Size;
+    Count = RandomBelow(4) ? RandomBelow(7) : RandomBelow(MAX_GEN_USERS + 1);
+    for(Idx = 0; Idx < Count; Idx++) {
+      EmitSpace();
+      if(!RandomBelow(16)) {
+        Emit("<string>not a user</string>");
+        EmitSpace();
+      }
+      GenUser(Plist.Users + Idx);
+    }
+    EmitSpace();
+    Plist.ArrayEnd = Plist.Size;
+    Emit("</array>");
+    EmitSpace();
+  }
+
+  Emit("<key>WrappedVolumeKeys</key>");
+  EmitSpace();
+  Emit("<array><dict><key>KEKWrappedVolumeKeyStruct</key><data>QUJDRA==</data>"
+       "</dict></array>\n</dict>\n</plist>\n");
+  if(!RandomBelow(4)) {
+    Size = RandomBelow(40);
+    SetMem(Plist.Data + Plist.Size, Size, 0);
+    Plist.Size += Size;
+  }
+
+  // Only what is before the cut is in the file
+  if(!RandomBelow(8))
+    Plist.Size = RandomBelow(Plist.Size);
+  if(Plist.ArrayEnd + sizeof("</array>") - 1 > Plist.Size)
+    Plist.HasArray = FALSE;
+  for(Plist.UserCount = 0;
+      Plist.UserCount < Count &&
+      Plist.Users[Plist.UserCount].DictEnd <= Plist.Size;
+      Plist.UserCount++)
+    ;
+}
+
+/**
+ * The rank of a user under the model policy, or -1 if it does not match.
+ */
+STATIC
+INTN
+ModelRank(IN GEN_USER CONST *User) {
+  UINTN Rank;
+
+  for(Rank = 0; Rank < Model.RuleCount; Rank++)
+    if(Model.Rules[Rank].Ident ?
+         CompareGuid(&Model.Rules[Rank].UserIdent, &User->UserIdent) :
+         Model.Rules[Rank].UserType == User->UserType)
+      return (INTN)Rank;
+  return -1;
+}
+
+/**
+ * Work out which users the model policy keeps, and the filtered file.
+ */
+STATIC
+VOID
+ModelFilter(OUT BOOLEAN *Kept) {
+  UINTN Count = 0;
+  UINTN Rank;
+  UINTN Idx;
+
+  SetMem(Kept, MAX_GEN_USERS * sizeof(*Kept), 0);
+  if(Plist.HasArray)
+    for(Rank = 0; Rank < Model.RuleCount; Rank++)
+      for(Idx = 0; Idx < Plist.UserCount && Count < Model.KeepCount; Idx++)
+        if(ModelRank(Plist.Users + Idx) == (INTN)Rank) {
+          Kept[Idx] = TRUE;
+          Count++;
+        }
+
+  if(!Count) {
+    CopyMem(Expected, Plist.Data, Plist.Size);
+    ExpectedSize = Plist.Size;
+    return;
+  }
+  CopyMem(Expected, Plist.Data, Plist.ArrayStart);
+  ExpectedSize = Plist.ArrayStart;
+  for(Idx = 0; Idx < Plist.UserCount; Idx++)
+    if(Kept[Idx]) {
+      CopyMem(Expected + ExpectedSize,
+              Plist.Data + Plist.Users[Idx].DictStart,
+              Plist.Users[Idx].DictEnd - Plist.Users[Idx].DictStart);
+      ExpectedSize += Plist.Users[Idx].DictEnd - Plist.Users[Idx].DictStart;
+    }
+  CopyMem(Expected + ExpectedSize,
+          Plist.Data + Plist.ArrayEnd,
+          Plist.Size - Plist.ArrayEnd);
+  ExpectedSize += Plist.Size - Plist.ArrayEnd;
+}
+
+/**
+ * Check the PassphraseWrappedKEKStruct of a user.
+ */
+STATIC
+VOID
+CheckKek(IN UINTN              Case,
+         IN CRYPTO_USER CONST *User,
+         IN GEN_USER CONST    *Gen) {
+  EFI_STATUS Status;
+  UINTN      Size;
+
+  Size = sizeof(KekBuffer);
+  Status = GetWrappedKekStruct(Plist.Data, User, KekBuffer, &Size);
+  if(!Gen->HasKek) {
+    if(EFI_NOT_FOUND != Status)
+      Fail(Case, "user at %lu: KEK found where there is none",
+           (unsigned long)Gen->DictStart);
+    return;
+  }
+  if(EFI_ERROR(Status) || Size != Gen->KekSize ||
+     CompareMem(KekBuffer, Plist.Keks + Gen->Kek, Size)) {
+    Fail(Case, "user at %lu: KEK of %lu bytes decoded wrongly",
+         (unsigned long)Gen->DictStart, (unsigned long)Gen->KekSize);
+    return;
+  }
+  if(Gen->KekSize) {
+    Size = Gen->KekSize - 1;
+    Status = GetWrappedKekStruct(Plist.Data, User, KekBuffer, &Size);
+    if(EFI_BUFFER_TOO_SMALL != Status)
+      Fail(Case, "user at %lu: KEK overflows a short buffer",
+           (unsigned long)Gen->DictStart);
+  }
+}
+
+/**
+ * Check the users found in the file, and the offsets of the array.
+ */
+STATIC
+VOID
+CheckUsers(IN UINTN Case) {
+  CRYPTO_USERS    Users;
+  CRYPTO_USER     User;
+  GEN_USER CONST *Gen;
+  EFI_STATUS      Status;
+  UINTN           Idx = 0;
+
+  SetMem(&Users, sizeof(Users), 0);
+  Users.State = CRYPTO_USERS_FIND;
+  while(!EFI_ERROR(Status = NextCryptoUser(&Users, Plist.Data, Plist.Size,
+                                           TRUE, &User))) {
+    if(Idx == Plist.UserCount) {
+      Fail(Case, "unexpected user at %lu", (unsigned long)User.DictStart);
+      return;
+    }
+    Gen = Plist.Users + Idx++;
+    if(User.DictStart != Gen->DictStart || User.DictEnd != Gen->DictEnd ||
+       User.UserType != Gen->UserType ||
+       !CompareGuid(&User.UserIdent, &Gen->UserIdent)) {
+      Fail(Case, "user at %lu: found %lu-%lu type %u, expected %lu-%lu type %u",
+           (unsigned long)Gen->DictStart,
+           (unsigned long)User.DictStart, (unsigned long)User.DictEnd,
+           User.UserType,
+           (unsigned long)Gen->DictStart, (unsigned long)Gen->DictEnd,
+           Gen->UserType);
+      return;
+    }
+    CheckKek(Case, &User, Gen);
+  }
+  if(Idx != Plist.UserCount)
+    Fail(Case, "found %lu of %lu users", (unsigned long)Idx,
+         (unsigned long)Plist.UserCount);
+  else if(Plist.HasArray &&
+          (EFI_END_OF_FILE != Status ||
+           Users.ArrayStart != Plist.ArrayStart ||
+           Users.ArrayEnd != Plist.ArrayEnd))
+    Fail(Case, "array %lu-%lu, expected %lu-%lu",
+         (unsigned long)Users.ArrayStart, (unsigned long)Users.ArrayEnd,
+         (unsigned long)Plist.ArrayStart, (unsigned long)Plist.ArrayEnd);
+  else if(!Plist.HasArray && EFI_NOT_FOUND != Status)
+    Fail(Case, "array found in a file without one");
+}
+
+/**
+ * Gather the ranges of a filtered file into Work, checking that each lies
+ * within the file, after the previous one and no earlier than its place in
+ * the filtered file.
+ */
+STATIC
+BOOLEAN
+GatherRanges(IN  UINTN              Case,
+             IN  PLIST_RANGE CONST *Ranges,
+             IN  UINTN              RangeCount,
+             OUT UINTN             *Size) {
+  UINTN Idx;
+  UINTN Last = 0;
+
+  *Size = 0;
+  for(Idx = 0; Idx < RangeCount; Idx++) {
+    if(Ranges[Idx].Offset < Last || Ranges[Idx].Offset < *Size ||
+       Ranges[Idx].Offset + Ranges[Idx].Length > Plist.Size) {
+      Fail(Case, "range %lu at %lu+%lu is out of place", (unsigned long)Idx,
+           (unsigned long)Ranges[Idx].Offset,
+           (unsigned long)Ranges[Idx].Length);
+      return FALSE;
+    }
+    CopyMem(Work + *Size, Plist.Data + Ranges[Idx].Offset, Ranges[Idx].Length);
+    *Size += Ranges[Idx].Length;
+    Last   = Ranges[Idx].Offset + Ranges[Idx].Length;
+  }
+  return TRUE;
+}
+
+/**
+ * Check FindChar against a byte at a time search, at every alignment and with
+ * the buffer ending where its allocation does, so that reading past the end
+ * is caught by a memory checker.  The bytes are mostly ones that differ from
+ * the character only in the high bit, or are 0 or 0xFF.
+ */
+STATIC
+VOID
+CheckFindChar(IN UINTN Case) {
+  CHAR8 *Allocation;
+  CHAR8 *Buffer;
+  UINTN  Align;
+  UINTN  Size;
+  UINTN  Offset;
+  UINTN  Found;
+  UINTN  Idx;
+  CHAR8  Char;
+  CHAR8  Bytes[4];
+
+  Align = RandomBelow(sizeof(UINTN));
+  Size  = RandomBelow(301);
+  Char  = (CHAR8)(RandomBelow(4) ? Random() : RandomBelow(2) ? 0 : 0xFF);
+  Bytes[0] = Char ^ (CHAR8)0x80;
+  Bytes[1] = 0;
+  Bytes[2] = (CHAR8)0xFF;
+  Bytes[3] = Char;
+
+  Allocation = malloc(MAX(Align + Size, 1));
+  Buffer     = Allocation + Align;
+  for(Idx = 0; Idx < Size; Idx++)
+    Buffer[Idx] = RandomBelow(4) ? (CHAR8)Random() :
+                  Bytes[RandomBelow(RandomBelow(8) ? 3 : 4)];
+  if(!RandomBelow(8))
+    for(Idx = 0; Idx < Size; Idx++)
+      if(Buffer[Idx] == Char)
+        Buffer[Idx] = Bytes[0];
+
+  Offset = RandomBelow(Size + 1);
+  Found  = FindChar(Buffer, Offset, Size, Char);
+  for(Idx = Offset; Idx < Size && Buffer[Idx] != Char; Idx++)
+    ;
+  if(Found != Idx)
+    Fail(Case, "FindChar of 0x%02X from %lu in %lu bytes at alignment %lu "
+         "found %lu, expected %lu", (UINT8)Char, (unsigned long)Offset,
+         (unsigned long)Size, (unsigned long)Align, (unsigned long)Found,
+         (unsigned long)Idx);
+  free(Allocation);
+}
+
+/**
+ * Filter the whole file in one go.
+ */
+STATIC
+VOID
+CheckFilter(IN UINTN Case) {
+  PLIST_FILTER       Filter;
+  PLIST_RANGE CONST *Ranges;
+  UINTN              RangeCount;
+  UINTN              Size;
+  EFI_STATUS         Status;
+
+  PlistFilterInit(&Filter, NULL);
+  Status = PlistFilterUpdate(&Filter, Plist.Data, Plist.Size, TRUE,
+                             &Ranges, &RangeCount);
+  if(EFI_ERROR(Status))
+    Fail(Case, "filter failed");
+  else if(GatherRanges(Case, Ranges, RangeCount, &Size) &&
+          (Size != ExpectedSize || CompareMem(Work, Expected, Size)))
+    Fail(Case, "filtered file of %lu bytes, expected %lu",
+         (unsigned long)Size, (unsigned long)ExpectedSize);
+}
+
+/**
+ * Filter the file as it arrives in windows of up to MaxWindow bytes, building
+ * the filtered file in place as FV2Hook does.  What has not arrived yet is
+ * garbage, and what has been moved is scribbled over, so the filter must
+ * neither read ahead nor look back at data it has finished with.
+ */
+STATIC
+VOID
+CheckWindows(IN     UINTN              Case,
+             IN OUT CRYPTO_USER_INDEX *Index,
+             IN     UINTN              MaxWindow) {
+  PLIST_FILTER       Filter;
+  PLIST_RANGE CONST *Ranges;
+  UINTN              RangeCount;
+  UINTN              Range = 0;
+  UINTN              RangeUsed = 0;
+  UINTN              Available = 0;
+  UINTN              Out = 0;
+  UINTN              Source;
+  UINTN              Length;
+  UINTN              Idx;
+  BOOLEAN            End;
+  EFI_STATUS         Status;
+
+  for(Idx = 0; Idx < Plist.Size; Idx++)
+    Work[Idx] = (CHAR8)Random();
+  PlistFilterInit(&Filter, Index);
+  do {
+    Length = RandomBelow(MaxWindow) + 1;
+    Length = MIN(Plist.Size - Available, Length);
+    CopyMem(Work + Available, Plist.Data + Available, Length);
+    Available += Length;
+    End        = Available == Plist.Size;
+    Status = PlistFilterUpdate(&Filter, Work, Available, End,
+                               &Ranges, &RangeCount);
+    if(EFI_ERROR(Status)) {
+      Fail(Case, "filter failed at %lu", (unsigned long)Available);
+      return;
+    }
+    for(; Range < RangeCount; Range++, RangeUsed = 0) {
+      Source = Ranges[Range].Offset + RangeUsed;
+      Length = Ranges[Range].Length - RangeUsed;
+      if(Source < Out || Source + Length > Available) {
+        Fail(Case, "range %lu at %lu+%lu is out of place at %lu",
+             (unsigned long)Range, (unsigned long)Ranges[Range].Offset,
+             (unsigned long)Ranges[Range].Length, (unsigned long)Available);
+        return;
+      }
+      CopyMem(Work + Out, Work + Source, Length);
+      Out       += Length;
+      RangeUsed += Length;
+      SetMem(Work + Out, Source + Length - Out, '#');
+      // The last range may still grow
+      if(Range + 1 == RangeCount)
+        break;
+    }
+  } while(!End);
+
+  if(Out != ExpectedSize || CompareMem(Work, Expected, Out))
+    Fail(Case, "filtered file of %lu bytes in windows of %lu, expected %lu",
+         (unsigned long)Out, (unsigned long)MaxWindow,
+         (unsigned long)ExpectedSize);
+}
+
+/**
+ * Decrypt, filter and re-encrypt the file in place as it arrives in windows,
+ * as FilterEncryptedFile in FV2Hook does, and check the result against the
+ * expected filtered file encrypted in one go.  The file is a single XTS-AES
+ * data unit, so it must be at least 16 bytes.
+ */
+STATIC
+VOID
+CheckEncryption(IN UINTN Case) {
+  XTS_AES_CONTEXT    Key;
+  XTS_AES_STREAM     Decrypt;
+  XTS_AES_STREAM     Encrypt;
+  PLIST_FILTER       Filter;
+  PLIST_RANGE CONST *Ranges;
+  UINT8             *FileData = (UINT8*)Work;
+  UINT8              KeyBytes[64];
+  UINT8              Tweak[16] = {0};
+  UINTN              KeySize;
+  UINTN              ReadSize = 0;
+  UINTN              DecryptedSize = 0;
+  UINTN              EncryptedSize = 0;
+  UINTN              WindowSize;
+  UINTN              ProcessedSize;
+  UINTN              RangeCount;
+  UINTN              Range = 0;
+  UINTN              RangeUsed = 0;
+  UINTN              Length;
+  UINTN              Idx;
+  BOOLEAN            End = FALSE;
+  EFI_STATUS         Status;
+
+  if(Plist.Size < 16)
+    return;
+  KeySize = RandomBelow(2) ? 256 : 512;
+  for(Idx = 0; Idx < KeySize / 8; Idx++)
+    KeyBytes[Idx] = (UINT8)Random();
+  Status = XtsAesInitContext(KeySize, KeyBytes, &Key);
+  if(!EFI_ERROR(Status))
+    Status = XtsAesCipher(KeySize, KeyBytes, Tweak, Plist.Size,
+                          (UINT8*)Plist.Data, Encrypted);
+  if(!EFI_ERROR(Status))
+    Status = XtsAesCipher(KeySize, KeyBytes, Tweak, ExpectedSize,
+                          (UINT8*)Expected, Reference);
+  if(EFI_ERROR(Status)) {
+    Fail(Case, "file of %lu bytes not encrypted", (unsigned long)Plist.Size);
+    return;
+  }
+
+  PlistFilterInit(&Filter, NULL);
+  XtsAesStreamInit(&Decrypt, &Key, Tweak, FALSE);
+  XtsAesStreamInit(&Encrypt, &Key, Tweak, TRUE);
+  while(!End) {
+    WindowSize = RandomBelow(5000) + 1;
+    WindowSize = MIN(Plist.Size - ReadSize, WindowSize);
+    CopyMem(FileData + ReadSize, Encrypted + ReadSize, WindowSize);
+    End = Plist.Size == ReadSize + WindowSize;
+    XtsAesStreamUpdate(&Decrypt, WindowSize, FileData + ReadSize,
+                       FileData + DecryptedSize, &ProcessedSize);
+    ReadSize      += WindowSize;
+    DecryptedSize += ProcessedSize;
+    if(End) {
+      XtsAesStreamFinal(&Decrypt, FileData + DecryptedSize, &ProcessedSize);
+      DecryptedSize += ProcessedSize;
+    }
+
+    Status = PlistFilterUpdate(&Filter, (CHAR8*)FileData, DecryptedSize, End,
+                               &Ranges, &RangeCount);
+    if(EFI_ERROR(Status)) {
+      Fail(Case, "filter of the decrypted file failed at %lu",
+           (unsigned long)DecryptedSize);
+      return;
+    }
+    for(; Range < RangeCount; Range++, RangeUsed = 0) {
+      Length = Ranges[Range].Length - RangeUsed;
+      XtsAesStreamUpdate(&Encrypt, Length,
+                         FileData + Ranges[Range].Offset + RangeUsed,
+                         FileData + EncryptedSize, &ProcessedSize);
+      RangeUsed     += Length;
+      EncryptedSize += ProcessedSize;
+      // The last range may still grow
+      if(Range + 1 == RangeCount)
+        break;
+    }
+    if(End) {
+      XtsAesStreamFinal(&Encrypt, FileData + EncryptedSize, &ProcessedSize);
+      EncryptedSize += ProcessedSize;
+    }
+  }
+
+  if(EncryptedSize != ExpectedSize ||
+     CompareMem(FileData, Reference, EncryptedSize))
+    Fail(Case, "re-encrypted file of %lu bytes, expected %lu",
+         (unsigned long)EncryptedSize, (unsigned long)ExpectedSize);
+}
+
+/**
+ * Check that two indexes of the file are the same.
+ */
+STATIC
+BOOLEAN
+SameIndex(IN CRYPTO_USER_INDEX CONST *Index,
+          IN CRYPTO_USER_INDEX CONST *Other) {
+  CRYPTO_USER CONST *User;
+  CRYPTO_USER CONST *OtherUser;
+  UINTN              Idx;
+
+  if(Index->FileSize != Other->FileSize || Index->Count != Other->Count ||
+     Index->KeptCount != Other->KeptCount ||
+     (Index->Count &&
+      (Index->ArrayStart != Other->ArrayStart ||
+       Index->ArrayEnd != Other->ArrayEnd)))
+    return FALSE;
+  for(Idx = 0; Idx < Index->Count; Idx++) {
+    User      = Index->Users + Idx;
+    OtherUser = Other->Users + Idx;
+    if(User->UserType != OtherUser->UserType ||
+       !CompareGuid(&User->UserIdent, &OtherUser->UserIdent) ||
+       User->DictStart != OtherUser->DictStart ||
+       User->DictEnd != OtherUser->DictEnd ||
+       User->Kek != OtherUser->Kek ||
+       User->KekLength != OtherUser->KekLength ||
+       !User->Keep != !OtherUser->Keep)
+      return FALSE;
+  }
+  return TRUE;
+}
+
+/**
+ * Check the index of the file, built in one go and recorded as the file is
+ * filtered in windows, and then filter the file again with it.
+ */
+STATIC
+VOID
+CheckIndex(IN UINTN          Case,
+           IN BOOLEAN CONST *Kept) {
+  CRYPTO_USER_INDEX  Built;
+  CRYPTO_USER_INDEX  Recorded;
+  CRYPTO_USER CONST *User;
+  UINTN              KeptCount = 0;
+  UINTN              Count;
+  UINTN              Idx;
+
+  SetMem(&Built, sizeof(Built), 0);
+  SetMem(&Recorded, sizeof(Recorded), 0);
+  if(EFI_ERROR(BuildCryptoUserIndex(Plist.Data, Plist.Size, &Built))) {
+    Fail(Case, "index not built");
+    return;
+  }
+
+  Count = Plist.HasArray ? Plist.UserCount : 0;
+  for(Idx = 0; Idx < Count; Idx++)
+    KeptCount += Kept[Idx] ? 1 : 0;
+  if(Built.FileSize != Plist.Size || Built.Count != Count ||
+     Built.KeptCount != KeptCount ||
+     (Count && (Built.ArrayStart != Plist.ArrayStart ||
+                Built.ArrayEnd != Plist.ArrayEnd)))
+    Fail(Case, "index of %lu users keeping %lu, expected %lu keeping %lu",
+         (unsigned long)Built.Count, (unsigned long)Built.KeptCount,
+         (unsigned long)Count, (unsigned long)KeptCount);
+  else
+    for(Idx = 0; Idx < Count; Idx++) {
+      User = Built.Users + Idx;
+      if(User->DictStart != Plist.Users[Idx].DictStart ||
+         User->DictEnd != Plist.Users[Idx].DictEnd ||
+         User->UserType != Plist.Users[Idx].UserType ||
+         !CompareGuid(&User->UserIdent, &Plist.Users[Idx].UserIdent) ||
+         !User->Keep != !Kept[Idx]) {
+        Fail(Case, "index user %lu does not match the file",
+             (unsigned long)Idx);
+        break;
+      }
+    }
+
+  // An empty index is recorded while filtering, and a complete one is used
+  CheckWindows(Case, &Recorded, 64);
+  if(!SameIndex(&Recorded, &Built))
+    Fail(Case, "recorded index differs from the built one");
+  CheckWindows(Case, &Built, 5000);
+
+  FreeCryptoUserIndex(&Built);
+  FreeCryptoUserIndex(&Recorded);
+}
+
+/**
+ * Policies with the status SetUserPolicy should return for them.
+ */
+typedef struct _POLICY_PARSE {
+  EFI_STATUS   Status;
+  CHAR8 CONST *Policy;
+} POLICY_PARSE;
+
+STATIC POLICY_PARSE CONST PolicyParses[] = {
+  { EFI_SUCCESS,           "keep disk\n" },
+  { EFI_SUCCESS,           "keep disk" },
+  { EFI_SUCCESS,           "  keep\tregular\r\n\n# keep recovery\n" },
+  { EFI_SUCCESS,           "keep disk # the disk password\n" },
+  { EFI_SUCCESS,           "keep disk#no space\n" },
+  { EFI_SUCCESS,           "prefer recovery\nkeep disk\ncount 2\n" },
+  { EFI_INVALID_PARAMETER, "" },
+  { EFI_INVALID_PARAMETER, "\n# nothing but a comment\n\n" },
+  { EFI_INVALID_PARAMETER, "count 2\n" },
+  { EFI_INVALID_PARAMETER, "count 0\nkeep disk\n" },
+  { EFI_SUCCESS,           "count 1\nkeep disk\n" },
+  { EFI_SUCCESS,           "count 16\nkeep disk\n" },
+  { EFI_SUCCESS,           "count 0x10\nkeep disk\n" },
+  { EFI_UNSUPPORTED,       "count 17\nkeep disk\n" },
+  { EFI_UNSUPPORTED,       "count 0x11\nkeep disk\n" },
+  { EFI_INVALID_PARAMETER, "count\nkeep disk\n" },
+  { EFI_INVALID_PARAMETER, "count -1\nkeep disk\n" },
+  { EFI_INVALID_PARAMETER, "count 4294967296\nkeep disk\n" },
+  { EFI_SUCCESS,           "keep type 268435457\n" },
+  { EFI_SUCCESS,           "keep type 0x10000001\n" },
+  { EFI_SUCCESS,           "keep type 0XaBc\n" },
+  { EFI_SUCCESS,           "keep type 0xFFFFFFFF\n" },
+  { EFI_INVALID_PARAMETER, "keep type 0x100000000\n" },
+  { EFI_INVALID_PARAMETER, "keep type 0x1G\n" },
+  { EFI_INVALID_PARAMETER, "keep type 12a\n" },
+  { EFI_INVALID_PARAMETER, "keep type\n" },
+  { EFI_SUCCESS,           "keep ident"
+                           " 00000001-1111-2222-3333-444455556666\n" },
+  { EFI_SUCCESS,           "keep ident"
+                           " {00000001-1111-2222-3333-444455556666}\n" },
+  { EFI_INVALID_PARAMETER, "keep ident 00000001-1111-2222-3333-44445555666\n" },
+  { EFI_INVALID_PARAMETER, "keep ident"
+                           " 00000001-1111-2222-3333-4444555566667\n" },
+  { EFI_INVALID_PARAMETER, "keep ident 0000000111112222333344445555666600\n" },
+  { EFI_INVALID_PARAMETER, "keep ident"
+                           " 0000000X-1111-2222-3333-444455556666\n" },
+  { EFI_INVALID_PARAMETER, "keep ident\n" },
+  { EFI_INVALID_PARAMETER, "keep disk please\n" },
+  { EFI_INVALID_PARAMETER, "keep type 5 6\n" },
+  { EFI_INVALID_PARAMETER, "count 2 users\nkeep disk\n" },
+  { EFI_INVALID_PARAMETER, "keep ident"
+                           " 00000001-1111-2222-3333-444455556666 x\n" },
+  { EFI_INVALID_PARAMETER, "keep\n" },
+  { EFI_INVALID_PARAMETER, "prefer\n" },
+  { EFI_INVALID_PARAMETER, "Keep disk\n" },
+  { EFI_INVALID_PARAMETER, "keep Disk\n" },
+  { EFI_INVALID_PARAMETER, "keep everyone\n" },
+  { EFI_INVALID_PARAMETER, "remove disk\n" },
+  { EFI_INVALID_PARAMETER, "keep disk\nkeep\n" },
+};
+
+/**
+ * Users offered to a policy, by their UserType, with the users it should
+ * keep as a bit mask of their positions.  The UserIdent of each user is that
+ * of RandomIdent, with Data1 set to its position.
+ */
+typedef struct _POLICY_CHOICE {
+  CHAR8 CONST *Policy;
+  UINTN        Count;
+  UINT32       Types[6];
+  UINTN        Kept;
+} POLICY_CHOICE;
+
+#define D USER_TYPE_DISK
+#define R USER_TYPE_REGULAR
+
+STATIC POLICY_CHOICE CONST PolicyChoices[] = {
+  // Prefer rules come before every keep rule, wherever they are
+  { "keep disk\nprefer regular\n",            2, { D, R },            0x02 },
+  { "prefer regular\nkeep disk\n",            2, { D, R },            0x02 },
+  { "keep disk\nprefer type 0x10060002\n",    2, { D, R },            0x02 },
+  // Earlier rules of a kind come first
+  { "keep regular\nkeep disk\n",              2, { D, R },            0x02 },
+  { "keep disk\nkeep regular\n",              2, { R, D },            0x02 },
+  { "keep disk\nkeep regular\ncount 3\n",     5, { R, D, R, D, R },   0x0B },
+  { "keep regular\nprefer ident {00000002-1111-2222-3333-444455556666}\n"
+    "count 2\n",                              4, { D, R, D, R },      0x06 },
+  // Users that rank the same are kept in file order
+  { "keep disk\ncount 2\n",                   4, { D, R, D, D },      0x05 },
+  { "keep type 0x10060002\ncount 16\n",       4, { R, R, D, R },      0x0B },
+  { "keep regular\nkeep disk\ncount 0x10\n",  6, { D, R, D, R, D, R }, 0x3F },
+  // A user may be preferred by ident over the disk password before it
+  { "prefer ident 00000002-1111-2222-3333-444455556666\nkeep disk\n"
+    "count 1\n",                              3, { D, R, R },         0x04 },
+  // No user might be kept
+  { "keep recovery\n",                        2, { D, R },            0x00 },
+};
+
+#undef D
+#undef R
+
+/**
+ * Choose users with the policy that is set, both as the filter does and from
+ * an index, and check the two agree.
+ *
+ * @return The users kept, as a bit mask of their positions.
+ */
+STATIC
+UINTN
+ChooseUsers(IN UINT32 CONST *Types,
+            IN UINTN         Count) {
+  USER_SELECTION    Selection;
+  CRYPTO_USER_INDEX Index;
+  CRYPTO_USER       Users[8];
+  UINTN             Kept = 0;
+  UINTN             IndexKept = 0;
+  UINTN             Idx;
+
+  SetMem(&Selection, sizeof(Selection), 0);
+  SetMem(&Index, sizeof(Index), 0);
+  SetMem(Users, sizeof(Users), 0);
+  for(Idx = 0; Idx < Count; Idx++) {
+    Users[Idx].UserType  = Types[Idx];
+    RandomIdent(&Users[Idx].UserIdent);
+    Users[Idx].UserIdent.Data1 = (UINT32)Idx;
+    Users[Idx].DictStart = 100 * (Idx + 1);
+    Users[Idx].DictEnd   = 100 * (Idx + 1) + 50;
+    SelectUser(&Selection, Users + Idx);
+  }
+  FinishUserSelection(&Selection);
+  for(Idx = 0; Idx < Selection.Count; Idx++)
+    Kept |= (UINTN)1 << (Selection.Users[Idx].DictStart / 100 - 1);
+
+  Index.Count    = Count;
+  Index.Capacity = ARRAY_SIZE(Users);
+  Index.Users    = Users;
+  SelectUsers(&Index);
+  for(Idx = 0; Idx < Count; Idx++)
+    if(Users[Idx].Keep)
+      IndexKept |= (UINTN)1 << Idx;
+  if(IndexKept != Kept || Index.KeptCount != Selection.Count)
+    Fail(NO_CASE, "users 0x%lX kept from an index, and 0x%lX without",
+         (unsigned long)IndexKept, (unsigned long)Kept);
+  return Kept;
+}
+
+/**
+ * Check the parsing of policies, and the users they keep.
+ */
+STATIC
+VOID
+CheckPolicies(VOID) {
+  STATIC CONST UINT32 Types[] = { USER_TYPE_DISK, USER_TYPE_REGULAR };
+  CHAR8               Policy[(MAX_POLICY_RULES + 1) * 16];
+  EFI_STATUS          Status;
+  UINTN               Count;
+  UINTN               Size;
+  UINTN               Idx;
+  UINTN               Kept;
+
+  // A policy that is not valid leaves the one before it in place
+  for(Idx = 0; Idx < ARRAY_SIZE(PolicyParses); Idx++) {
+    SetUserPolicy("keep regular\n", 13);
+    Status = SetUserPolicy(PolicyParses[Idx].Policy,
+                           strlen(PolicyParses[Idx].Policy));
+    if(Status != PolicyParses[Idx].Status)
+      Fail(NO_CASE, "policy \"%s\" gave status 0x%lx, expected 0x%lx",
+           PolicyParses[Idx].Policy, (unsigned long)Status,
+           (unsigned long)PolicyParses[Idx].Status);
+    else if(EFI_ERROR(Status) && 0x02 != ChooseUsers(Types, 2))
+      Fail(NO_CASE, "policy \"%s\" changed the policy",
+           PolicyParses[Idx].Policy);
+  }
+
+  // As many rules of either kind as there is room for, and one too many
+  for(Count = MAX_POLICY_RULES; Count <= MAX_POLICY_RULES + 1; Count++) {
+    for(Size = Idx = 0; Idx < Count; Idx++)
+      Size += snprintf(Policy + Size, sizeof(Policy) - Size, "%s type %lu\n",
+                       Idx & 1 ? "keep" : "prefer", (unsigned long)Idx + 1);
+    Status = SetUserPolicy(Policy, Size);
+    if(Status != (Count > MAX_POLICY_RULES ? EFI_UNSUPPORTED : EFI_SUCCESS))
+      Fail(NO_CASE, "policy of %lu rules gave status 0x%lx",
+           (unsigned long)Count, (unsigned long)Status);
+  }
+
+  for(Idx = 0; Idx < ARRAY_SIZE(PolicyChoices); Idx++) {
+    Status = SetUserPolicy(PolicyChoices[Idx].Policy,
+                           strlen(PolicyChoices[Idx].Policy));
+    Kept = EFI_ERROR(Status) ? 0 : ChooseUsers(PolicyChoices[Idx].Types,
+                                              PolicyChoices[Idx].Count);
+    if(EFI_ERROR(Status) || Kept != PolicyChoices[Idx].Kept)
+      Fail(NO_CASE, "policy \"%s\" kept users 0x%lX, expected 0x%lX",
+           PolicyChoices[Idx].Policy, (unsigned long)Kept,
+           (unsigned long)PolicyChoices[Idx].Kept);
+  }
+}
+
+/**
+ * Set a random policy, and the model of it.  Half the time this is the
+ * default policy.
+ */
+STATIC
+VOID
+RandomPolicy(IN UINTN Case) {
+  STATIC CONST CHAR8  *Names[]   = { "disk", "recovery", "regular" };
+  STATIC CONST UINT32  Types[]   = {
+    USER_TYPE_DISK, USER_TYPE_RECOVERY, USER_TYPE_REGULAR
+  };
+  STATIC CHAR8         Policy[MAX_POLICY_RULES * 80];
+  MODEL_RULE           Keeps[MAX_POLICY_RULES];
+  MODEL_RULE          *Rule;
+  UINTN                KeepCount = 0;
+  UINTN                RuleCount;
+  UINTN                CountAt;
+  UINTN                Size = 0;
+  UINTN                Idx;
+  UINTN                Kind;
+  BOOLEAN              Prefer;
+  BOOLEAN              Braces;
+  EFI_STATUS           Status;
+
+  Model.KeepCount = 1;
+  Model.RuleCount = 0;
+  if(RandomBelow(2)) {
+    Size = snprintf(Policy, sizeof(Policy), "keep disk\n");
+    Model.RuleCount = 1;
+    SetMem(Model.Rules, sizeof(Model.Rules[0]), 0);
+    Model.Rules[0].UserType = USER_TYPE_DISK;
+  }
+  else {
+    RuleCount = RandomBelow(4) ? RandomBelow(4) + 1 :
+                                 RandomBelow(MAX_POLICY_RULES) + 1;
+    CountAt   = RandomBelow(RuleCount + 2);
+    for(Idx = 0; Idx <= RuleCount; Idx++) {
+      if(Idx == CountAt) {
+        Model.KeepCount = RandomBelow(4) ? RandomBelow(3) + 1 :
+                                           RandomBelow(MAX_KEPT_USERS) + 1;
+        Size += snprintf(Policy + Size, sizeof(Policy) - Size,
+                         RandomBelow(2) ? "count %lu\n" : "count 0x%lx\n",
+                         (unsigned long)Model.KeepCount);
+      }
+      if(Idx == RuleCount)
+        break;
+
+      Prefer = RandomBelow(3) == 0;
+      Rule   = Prefer ? Model.Rules + Model.RuleCount++ : Keeps + KeepCount++;
+      SetMem(Rule, sizeof(*Rule), 0);
+      Size += snprintf(Policy + Size, sizeof(Policy) - Size, "%s%s ",
+                       RandomBelow(4) ? "" : " \t",
+                       Prefer ? "prefer" : "keep");
+      Kind = RandomBelow(5);
+      if(Kind < 3) {
+        Rule->UserType = Types[Kind];
+        Size += snprintf(Policy + Size, sizeof(Policy) - Size, "%s",
+                         Names[Kind]);
+      }
+      else if(Kind == 3) {
+        Rule->UserType = Types[RandomBelow(3)];
+        Size += snprintf(Policy + Size, sizeof(Policy) - Size,
+                         RandomBelow(2) ? "type %u" : "type 0x%X",
+                         Rule->UserType);
+      }
+      else {
+        Rule->Ident = TRUE;
+        RandomIdent(&Rule->UserIdent);
+        Braces = RandomBelow(2);
+        Size += snprintf(Policy + Size, sizeof(Policy) - Size,
+                         "ident %s%08X-1111-2222-3333-444455556666%s",
+                         Braces ? "{" : "", Rule->UserIdent.Data1,
+                         Braces ? "}" : "");
+      }
+      Size += snprintf(Policy + Size, sizeof(Policy) - Size, "%s\n",
+                       RandomBelow(4) ? "" : RandomBelow(2) ? " # a comment" :
+                                                           "\r");
+    }
+    CopyMem(Model.Rules + Model.RuleCount, Keeps,
+            KeepCount * sizeof(Keeps[0]));
+    Model.RuleCount += KeepCount;
+  }
+
+  Status = SetUserPolicy(Policy, Size);
+  if(EFI_ERROR(Status))
+    Fail(Case, "policy \"%.*s\" gave status 0x%lx", (int)Size, Policy,
+         (unsigned long)Status);
+}
+
+int
+main(int argc, char **argv) {
+  BOOLEAN Kept[MAX_GEN_USERS];
+  UINTN   Cases = 2000;
+  UINTN   Case;
+  int     Arg = 1;
+
+  while(Arg + 1 < argc && argv[Arg][0] == '-') {
+    if(!strcmp(argv[Arg], "-n"))
+      Cases = MAX(strtoul(argv[Arg + 1], NULL, 0), 1);
+    else if(!strcmp(argv[Arg], "-s"))
+      RandomState = strtoull(argv[Arg + 1], NULL, 0) | 1;
+    else
+      break;
+    Arg += 2;
+  }
+
+  CheckPolicies();
+  for(Case = 0; Case < Cases; Case++) {
+    RandomPolicy(Case);
+    GenPlist();
+    ModelFilter(Kept);
+    CheckUsers(Case);
+    CheckFilter(Case);
+    CheckWindows(Case, NULL, 64);
+    CheckWindows(Case, NULL, 5000);
+    CheckFindChar(Case);
+    CheckIndex(Case, Kept);
+    CheckEncryption(Case);
+  }
+
+  printf("PlistCheck: %lu cases, %lu failures\n", (unsigned long)Cases,
+         (unsigned long)Failures);
+  return Failures ? 1 : 0;
+}
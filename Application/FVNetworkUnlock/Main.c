@@ -34,6 +34,8 @@
 #include "FileLoad.h"
 #include "FV2.h"
 #include "FV2Hook.h"
+#include "FV2Passphrase.h"
+#include "FV2UserPolicy.h"
 #include "KeyboardHook.h"
 #include "SmBios.h"
 
@@ -177,22 +179,20 @@ LoadPassword(OUT UINTN   *FileSize,
 }
 
 /**
-  Load splash screen image from boot device.
+  Load a file named after the serial number from the boot device.
 
-  The image is stored in one of the following files:
-    * A file based on the serial number of the machine (as obtained from
-      the SMBIOS configuration tables) with a '.png' extension.  Any invalid
-      characters are replaced with _s)
-    * A default file called logo.png
+  The file is named after the serial number of the machine (as obtained from
+  the SMBIOS configuration tables) with the given extension.  Any invalid
+  characters are replaced with _s)
 
-  @param  FileSize      Where to store the size of the password file.
-  @param  FileBuffer    Where to store the pointer to the password data.
+  @param  Extension     The extension of the file, without the '.'.
+  @param  FileSize      Where to store the size of the file.
+  @param  FileBuffer    Where to store the pointer to the file data.
 
   @retval EFI_SUCCESS           The file was loaded successfully.
   @retval EFI_OUT_OF_RESOURCES  There was insufficient memory to load the file.
   @retval EFI_NOT_FOUND         The serial number was not found.
   @retval EFI_NOT_FOUND         The file was not found.
-  @retval EFI_INVALID_PARAMETER One or more of the parameters was invalid.
   @retval EFI_UNSUPPORTED       The device does not support any of the
                                 required protocols.
 
@@ -200,34 +200,33 @@ LoadPassword(OUT UINTN   *FileSize,
                                 System Protocol or Load File Protocol when
                                 reading files may also be returned.
  */
+STATIC
 EFI_STATUS
 EFIAPI
-LoadSplashScreen(OUT UINTN   *FileSize,
-                 OUT VOID   **FileBuffer)
+LoadSerialNumberFile(IN  CHAR16 CONST *Extension,
+                     OUT UINTN        *FileSize,
+                     OUT VOID        **FileBuffer)
 {
   CHAR16      *SerialNumber;
   CHAR16      *Filename;
   UINTN        SerialNumberSize;
-  UINTN        Idx;
+  UINTN        ExtensionSize;
   EFI_STATUS   Status;
 
-  if(!FileSize || !FileBuffer)
-    return EFI_INVALID_PARAMETER;
-
   SerialNumber = GetSafeSerialNumber();
   if(SerialNumber) {
     SerialNumberSize = StrLen(SerialNumber);
+    ExtensionSize    = StrLen(Extension);
     Status = gBS->AllocatePool(EfiBootServicesData,
-                               (SerialNumberSize + 5) * sizeof(CHAR16),
+                               (SerialNumberSize + ExtensionSize + 2) *
+                                 sizeof(CHAR16),
                                (VOID**)&Filename);
     if(!EFI_ERROR(Status)) {
-      for(Idx = 0; Idx < SerialNumberSize; Idx++)
-        Filename[Idx] = SerialNumber[Idx];
-      Filename[Idx++] = L'.';
-      Filename[Idx++] = L'p';
-      Filename[Idx++] = L'n';
-      Filename[Idx++] = L'g';
-      Filename[Idx++] = 0;
+      CopyMem(Filename, SerialNumber, SerialNumberSize * sizeof(CHAR16));
+      Filename[SerialNumberSize] = L'.';
+      CopyMem(Filename + SerialNumberSize + 1,
+              Extension,
+              (ExtensionSize + 1) * sizeof(CHAR16));
       // Attempt to load file
       Status = LoadFileFromBootDevice(Filename,
                                       FileSize,
@@ -238,11 +237,83 @@ LoadSplashScreen(OUT UINTN   *FileSize,
   }
   else
     Status = EFI_NOT_FOUND;
+  return Status;
+}
+
+/**
+  Load splash screen image from boot device.
+
+  The image is stored in one of the following files:
+    * A file based on the serial number of the machine (as obtained from
+      the SMBIOS configuration tables) with a '.png' extension.  Any invalid
+      characters are replaced with _s)
+    * A default file called logo.png
+
+  @param  FileSize      Where to store the size of the password file.
+  @param  FileBuffer    Where to store the pointer to the password data.
+
+  @retval EFI_SUCCESS           The file was loaded successfully.
+  @retval EFI_OUT_OF_RESOURCES  There was insufficient memory to load the file.
+  @retval EFI_NOT_FOUND         The serial number was not found.
+  @retval EFI_NOT_FOUND         The file was not found.
+  @retval EFI_INVALID_PARAMETER One or more of the parameters was invalid.
+  @retval EFI_UNSUPPORTED       The device does not support any of the
+                                required protocols.
+
+  @retval ...                   Any of the errors generated by the Simple File
+                                System Protocol or Load File Protocol when
+                                reading files may also be returned.
+ */
+EFI_STATUS
+EFIAPI
+LoadSplashScreen(OUT UINTN   *FileSize,
+                 OUT VOID   **FileBuffer)
+{
+  EFI_STATUS   Status;
+
+  if(!FileSize || !FileBuffer)
+    return EFI_INVALID_PARAMETER;
+
+  Status = LoadSerialNumberFile(L"png", FileSize, FileBuffer);
   if(EFI_ERROR(Status))
     Status = LoadFileFromBootDevice(L"logo.png", FileSize, FileBuffer);
   return Status;
 }
 
+/**
+  Load the user policy from boot device.
+
+  The policy chooses which CryptoUsers are kept in the wipekey (see
+  SetUserPolicy()).  It is stored in a file based on the serial number of the
+  machine (as obtained from the SMBIOS configuration tables) with a '.policy'
+  extension.  Any invalid characters are replaced with _s)
+
+  @param  FileSize      Where to store the size of the policy file.
+  @param  FileBuffer    Where to store the pointer to the policy data.
+
+  @retval EFI_SUCCESS           The file was loaded successfully.
+  @retval EFI_OUT_OF_RESOURCES  There was insufficient memory to load the file.
+  @retval EFI_NOT_FOUND         The serial number was not found.
+  @retval EFI_NOT_FOUND         The file was not found.
+  @retval EFI_INVALID_PARAMETER One or more of the parameters was invalid.
+  @retval EFI_UNSUPPORTED       The device does not support any of the
+                                required protocols.
+
+  @retval ...                   Any of the errors generated by the Simple File
+                                System Protocol or Load File Protocol when
+                                reading files may also be returned.
+ */
+EFI_STATUS
+EFIAPI
+LoadUserPolicy(OUT UINTN   *FileSize,
+               OUT VOID   **FileBuffer)
+{
+  if(!FileSize || !FileBuffer)
+    return EFI_INVALID_PARAMETER;
+
+  return LoadSerialNumberFile(L"policy", FileSize, FileBuffer);
+}
+
 /* Default time to display splash screen */
 #ifndef SPLASH_SCREEN_DELAY
 #define SPLASH_SCREEN_DELAY 2500000
@@ -270,6 +341,8 @@ UefiMain(IN EFI_HANDLE        ImageHandle,
   CHAR8            *FileBuffer;
   UINTN             SplashScreenSize;
   VOID             *SplashScreen;
+  UINTN             PolicySize;
+  CHAR8            *Policy;
   UINTN             Idx;
 
   Status = LoadSplashScreen(&SplashScreenSize, &SplashScreen);
@@ -291,12 +364,26 @@ UefiMain(IN EFI_HANDLE        ImageHandle,
   Status = LocateFV2Volumes(&VolumeCount, &Volumes);
   if(!EFI_ERROR(Status)) {
     Print(L"Got %d boot loaders\n", VolumeCount);
-    for(Idx = 0; Idx < VolumeCount; Idx++)
-      HookVolume(&Volumes[Idx]);
     Status = LoadPassword(&FileSize, (VOID**)&FileBuffer);
     if(!EFI_ERROR(Status)) {
       Print(L"Got %d bytes at %p\n", FileSize, FileBuffer);
-      Status = HookKeyboard(FileBuffer, FileSize);
+      // Without a policy file, only the disk password user is kept
+      if(!EFI_ERROR(LoadUserPolicy(&PolicySize, (VOID**)&Policy))) {
+        Status = SetUserPolicy(Policy, PolicySize);
+        if(EFI_ERROR(Status))
+          Print(L"Ignoring invalid user policy - %r\n", Status);
+        gBS->FreePool(Policy);
+      }
+      // Check the password before hooking, so the unfiltered wipekey is read.
+      // Only a definite mismatch stops the boot.
+      Status = VerifyPassword(&Volumes[0], FileBuffer, FileSize);
+      if(EFI_SECURITY_VIOLATION != Status) {
+        if(EFI_ERROR(Status))
+          Print(L"Unable to verify password - %r\n", Status);
+        for(Idx = 0; Idx < VolumeCount; Idx++)
+          HookVolume(&Volumes[Idx]);
+        Status = HookKeyboard(FileBuffer, FileSize);
+      }
       // Erase File Buffer now!
       SetMem(FileBuffer, FileSize, 0);
       gBS->FreePool(FileBuffer);
@@ -317,6 +404,8 @@ UefiMain(IN EFI_HANDLE        ImageHandle,
           Print(L"Failed to load boot loader - %r\n", Status);
         UnhookKeyboard();
       }
+      else if(EFI_SECURITY_VIOLATION == Status)
+        Print(L"Password does not unlock the disk - not booting\n");
       else
         Print(L"Failed to create new system table - %r\n", Status);
     }
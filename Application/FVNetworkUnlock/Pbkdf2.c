@@ -0,0 +1,369 @@
+/**
+ * Copyright (c) 2015, baskingshark
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <Uefi.h>
+#include <Library/BaseMemoryLib.h>
+#include "Pbkdf2.h"
+
+/**
+  SHA-256 (see FIPS 180-4).
+ */
+#define SHA256_BLOCK_SIZE   64
+
+typedef struct _SHA256_CONTEXT {
+  UINT32 State[8];
+  UINT8  Buffer[SHA256_BLOCK_SIZE];
+  UINTN  BufferLength;
+  UINT64 Length;
+} SHA256_CONTEXT;
+
+STATIC
+CONST
+UINT32
+K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+  0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+  0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+  0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+  0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+  0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define Ror(x, n)   (((x) >> (n)) | ((x) << (32 - (n))))
+#define Ch(x, y, z) (((x) & (y)) ^ (~(x) & (z)))
+#define Maj(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define Sigma0(x)   (Ror(x,  2) ^ Ror(x, 13) ^ Ror(x, 22))
+#define Sigma1(x)   (Ror(x,  6) ^ Ror(x, 11) ^ Ror(x, 25))
+#define Gamma0(x)   (Ror(x,  7) ^ Ror(x, 18) ^ ((x) >>  3))
+#define Gamma1(x)   (Ror(x, 17) ^ Ror(x, 19) ^ ((x) >> 10))
+
+/**
+  Process a single 64 byte block.
+
+  @param  State   The hash state to update.
+  @param  Block   The block to process.
+ */
+STATIC
+VOID
+EFIAPI
+Sha256Transform(IN OUT UINT32       State[8],
+                IN     CONST UINT8  Block[SHA256_BLOCK_SIZE])
+{
+  UINT32 W[64];
+  UINT32 a, b, c, d, e, f, g, h;
+  UINT32 T1, T2;
+  UINTN  Idx;
+
+  for(Idx = 0; Idx < 16; Idx++)
+    W[Idx] = ((UINT32)Block[4*Idx+0] << 24) | ((UINT32)Block[4*Idx+1] << 16) |
+             ((UINT32)Block[4*Idx+2] <<  8) | ((UINT32)Block[4*Idx+3] <<  0);
+  for(; Idx < 64; Idx++)
+    W[Idx] = Gamma1(W[Idx-2]) + W[Idx-7] + Gamma0(W[Idx-15]) + W[Idx-16];
+
+  a = State[0];
+  b = State[1];
+  c = State[2];
+  d = State[3];
+  e = State[4];
+  f = State[5];
+  g = State[6];
+  h = State[7];
+  for(Idx = 0; Idx < 64; Idx++) {
+    T1 = h + Sigma1(e) + Ch(e, f, g) + K[Idx] + W[Idx];
+    T2 = Sigma0(a) + Maj(a, b, c);
+    h = g;
+    g = f;
+    f = e;
+    e = d + T1;
+    d = c;
+    c = b;
+    b = a;
+    a = T1 + T2;
+  }
+  State[0] += a;
+  State[1] += b;
+  State[2] += c;
+  State[3] += d;
+  State[4] += e;
+  State[5] += f;
+  State[6] += g;
+  State[7] += h;
+
+  SetMem(W, sizeof(W), 0);
+}
+
+/**
+  Initialise a SHA-256 context.
+
+  @param  Context The context to initialise.
+ */
+STATIC
+VOID
+EFIAPI
+Sha256Init(OUT SHA256_CONTEXT *Context)
+{
+  STATIC CONST UINT32 InitialState[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+
+  CopyMem(Context->State, InitialState, sizeof(InitialState));
+  Context->BufferLength = 0;
+  Context->Length       = 0;
+}
+
+/**
+  Add data to a SHA-256 hash.
+
+  @param  Context The context to update.
+  @param  Data    The data to add.
+  @param  Length  Length of the data in bytes.
+ */
+STATIC
+VOID
+EFIAPI
+Sha256Update(IN OUT SHA256_CONTEXT *Context,
+             IN     CONST UINT8    *Data,
+             IN     UINTN           Length)
+{
+  UINTN Count;
+
+  Context->Length += Length;
+  while(Length) {
+    if(!Context->BufferLength && Length >= SHA256_BLOCK_SIZE) {
+      Sha256Transform(Context->State, Data);
+      Data   += SHA256_BLOCK_SIZE;
+      Length -= SHA256_BLOCK_SIZE;
+      continue;
+    }
+    Count = MIN(Length, SHA256_BLOCK_SIZE - Context->BufferLength);
+    CopyMem(Context->Buffer + Context->BufferLength, Data, Count);
+    Context->BufferLength += Count;
+    Data   += Count;
+    Length -= Count;
+    if(SHA256_BLOCK_SIZE == Context->BufferLength) {
+      Sha256Transform(Context->State, Context->Buffer);
+      Context->BufferLength = 0;
+    }
+  }
+}
+
+/**
+  Complete a SHA-256 hash.
+
+  @param  Context The context to complete.  This is zeroed afterwards.
+  @param  Digest  Where to store the digest.
+ */
+STATIC
+VOID
+EFIAPI
+Sha256Final(IN OUT SHA256_CONTEXT *Context,
+            OUT    UINT8           Digest[SHA256_DIGEST_SIZE])
+{
+  UINT64 Bits = Context->Length * 8;
+  UINTN  Idx;
+
+  Context->Buffer[Context->BufferLength++] = 0x80;
+  if(Context->BufferLength > SHA256_BLOCK_SIZE - 8) {
+    SetMem(Context->Buffer + Context->BufferLength,
+           SHA256_BLOCK_SIZE - Context->BufferLength,
+           0);
+    Sha256Transform(Context->State, Context->Buffer);
+    Context->BufferLength = 0;
+  }
+  SetMem(Context->Buffer + Context->BufferLength,
+         SHA256_BLOCK_SIZE - 8 - Context->BufferLength,
+         0);
+  for(Idx = 0; Idx < 8; Idx++)
+    Context->Buffer[SHA256_BLOCK_SIZE - 1 - Idx] = (UINT8)(Bits >> (8 * Idx));
+  Sha256Transform(Context->State, Context->Buffer);
+
+  for(Idx = 0; Idx < 8; Idx++) {
+    Digest[4*Idx+0] = (UINT8)(Context->State[Idx] >> 24);
+    Digest[4*Idx+1] = (UINT8)(Context->State[Idx] >> 16);
+    Digest[4*Idx+2] = (UINT8)(Context->State[Idx] >>  8);
+    Digest[4*Idx+3] = (UINT8)(Context->State[Idx] >>  0);
+  }
+  SetMem(Context, sizeof(*Context), 0);
+}
+
+/**
+  HMAC-SHA256 (see RFC 2104).
+
+  The inner and outer hashes of the key padding are computed once, so that
+  each HMAC of a PBKDF2 iteration only needs two compression functions.
+ */
+typedef struct _HMAC_SHA256_CONTEXT {
+  SHA256_CONTEXT Inner;
+  SHA256_CONTEXT Outer;
+} HMAC_SHA256_CONTEXT;
+
+/**
+  Initialise an HMAC-SHA256 context with a key.
+
+  @param  Context   The context to initialise.
+  @param  Key       The key.
+  @param  KeyLength Length of the key in bytes.
+ */
+STATIC
+VOID
+EFIAPI
+HmacSha256Init(OUT HMAC_SHA256_CONTEXT *Context,
+               IN  CONST UINT8         *Key,
+               IN  UINTN                KeyLength)
+{
+  UINT8 Pad[SHA256_BLOCK_SIZE];
+  UINTN Idx;
+
+  SetMem(Pad, sizeof(Pad), 0);
+  if(KeyLength > SHA256_BLOCK_SIZE) {
+    Sha256Init(&Context->Inner);
+    Sha256Update(&Context->Inner, Key, KeyLength);
+    Sha256Final(&Context->Inner, Pad);
+  }
+  else
+    CopyMem(Pad, Key, KeyLength);
+
+  for(Idx = 0; Idx < sizeof(Pad); Idx++)
+    Pad[Idx] ^= 0x36;
+  Sha256Init(&Context->Inner);
+  Sha256Update(&Context->Inner, Pad, sizeof(Pad));
+  for(Idx = 0; Idx < sizeof(Pad); Idx++)
+    Pad[Idx] ^= 0x36 ^ 0x5c;
+  Sha256Init(&Context->Outer);
+  Sha256Update(&Context->Outer, Pad, sizeof(Pad));
+
+  SetMem(Pad, sizeof(Pad), 0);
+}
+
+/**
+  Compute the HMAC of a message using a keyed context.
+
+  @param  Keyed   Context initialised by HmacSha256Init, left unchanged.
+  @param  Data    The message.
+  @param  Length  Length of the message in bytes.
+  @param  Extra   Optional data appended to the message.
+  @param  ExtraLength Length of Extra in bytes.
+  @param  Mac     Where to store the MAC.
+ */
+STATIC
+VOID
+EFIAPI
+HmacSha256(IN  CONST HMAC_SHA256_CONTEXT *Keyed,
+           IN  CONST UINT8               *Data,
+           IN  UINTN                      Length,
+           IN  CONST UINT8               *Extra OPTIONAL,
+           IN  UINTN                      ExtraLength,
+           OUT UINT8                      Mac[SHA256_DIGEST_SIZE])
+{
+  SHA256_CONTEXT Context;
+
+  CopyMem(&Context, &Keyed->Inner, sizeof(Context));
+  Sha256Update(&Context, Data, Length);
+  if(Extra)
+    Sha256Update(&Context, Extra, ExtraLength);
+  Sha256Final(&Context, Mac);
+
+  CopyMem(&Context, &Keyed->Outer, sizeof(Context));
+  Sha256Update(&Context, Mac, SHA256_DIGEST_SIZE);
+  Sha256Final(&Context, Mac);
+}
+
+/**
+  Derive a key from a password using PBKDF2 with HMAC-SHA256 as the
+  pseudorandom function (see section 5.2 of RFC 2898).
+
+  @param  Password        The password.
+  @param  PasswordLength  Length of the password in bytes.
+  @param  Salt            The salt.
+  @param  SaltLength      Length of the salt in bytes.
+  @param  Iterations      The iteration count.
+  @param  KeyLength       Length of the key to derive in bytes.
+  @param  Key             Where to store the derived key.
+
+  @retval EFI_SUCCESS           The key was derived.
+  @retval EFI_INVALID_PARAMETER One or more of the parameters are invalid.
+ */
+EFI_STATUS
+EFIAPI
+Pbkdf2HmacSha256(IN  CONST UINT8 *Password,
+                 IN  UINTN        PasswordLength,
+                 IN  CONST UINT8 *Salt,
+                 IN  UINTN        SaltLength,
+                 IN  UINT32       Iterations,
+                 IN  UINTN        KeyLength,
+                 OUT UINT8       *Key)
+{
+  HMAC_SHA256_CONTEXT Prf;
+  UINT8               U[SHA256_DIGEST_SIZE];
+  UINT8               T[SHA256_DIGEST_SIZE];
+  UINT8               BlockIndex[4];
+  UINT32              Block;
+  UINT32              Iteration;
+  UINTN               Count;
+  UINTN               Idx;
+
+  if((PasswordLength && !Password) || (SaltLength && !Salt) ||
+     !Iterations || !Key)
+    return EFI_INVALID_PARAMETER;
+
+  HmacSha256Init(&Prf, Password, PasswordLength);
+  for(Block = 1; KeyLength; Block++) {
+    // U_1 = PRF(Password, Salt || INT(Block))
+    BlockIndex[0] = (UINT8)(Block >> 24);
+    BlockIndex[1] = (UINT8)(Block >> 16);
+    BlockIndex[2] = (UINT8)(Block >>  8);
+    BlockIndex[3] = (UINT8)(Block >>  0);
+    HmacSha256(&Prf, Salt, SaltLength, BlockIndex, sizeof(BlockIndex), U);
+    CopyMem(T, U, sizeof(T));
+    // U_c = PRF(Password, U_{c-1})
+    for(Iteration = 1; Iteration < Iterations; Iteration++) {
+      HmacSha256(&Prf, U, sizeof(U), NULL, 0, U);
+      for(Idx = 0; Idx < sizeof(T); Idx++)
+        T[Idx] ^= U[Idx];
+    }
+    Count = MIN(KeyLength, sizeof(T));
+    CopyMem(Key, T, Count);
+    Key       += Count;
+    KeyLength -= Count;
+  }
+
+  SetMem(&Prf, sizeof(Prf), 0);
+  SetMem(U, sizeof(U), 0);
+  SetMem(T, sizeof(T), 0);
+  return EFI_SUCCESS;
+}
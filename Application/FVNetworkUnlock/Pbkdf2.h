@@ -0,0 +1,63 @@
+/**
+ * Copyright (c) 2015, baskingshark
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __PBKDF2_H__
+#define __PBKDF2_H__
+
+#include <Uefi.h>
+
+/**
+  Size (in bytes) of a SHA-256 digest.
+ */
+#define SHA256_DIGEST_SIZE  32
+
+/**
+  Derive a key from a password using PBKDF2 with HMAC-SHA256 as the
+  pseudorandom function (see section 5.2 of RFC 2898).
+
+  @param  Password        The password.
+  @param  PasswordLength  Length of the password in bytes.
+  @param  Salt            The salt.
+  @param  SaltLength      Length of the salt in bytes.
+  @param  Iterations      The iteration count.
+  @param  KeyLength       Length of the key to derive in bytes.
+  @param  Key             Where to store the derived key.
+
+  @retval EFI_SUCCESS           The key was derived.
+  @retval EFI_INVALID_PARAMETER One or more of the parameters are invalid.
+ */
+EFI_STATUS
+EFIAPI
+Pbkdf2HmacSha256(IN  CONST UINT8 *Password,
+                 IN  UINTN        PasswordLength,
+                 IN  CONST UINT8 *Salt,
+                 IN  UINTN        SaltLength,
+                 IN  UINT32       Iterations,
+                 IN  UINTN        KeyLength,
+                 OUT UINT8       *Key);
+
+#endif
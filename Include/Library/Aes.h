@@ -30,6 +30,165 @@
 
 #include <Uefi.h>
 
+/**
+ * Maximum number of rounds (for a 256 bit key) - see section 5 of FIPS 197.
+ */
+#define AES_MAX_ROUNDS  14
+
+typedef struct _AES_CONTEXT AES_CONTEXT;
+
+/**
+ * Encrypt or decrypt a number of consecutive blocks with an expanded key.
+ *
+ * @param Context   Expanded key
+ * @param Blocks    Number of blocks
+ * @param In        Data to encrypt or decrypt (16 * Blocks bytes)
+ * @param Out       Where to store the result (may be the same as In)
+ */
+typedef
+VOID
+(EFIAPI *AES_BLOCKS_FUNCTION)(IN  AES_CONTEXT CONST *Context,
+                              IN  UINTN              Blocks,
+                              IN  UINT8       CONST *In,
+                              OUT UINT8             *Out);
+
+/**
+ * An expanded AES key.
+ *
+ * This holds the encryption and decryption key schedules so that the key
+ * expansion only has to be performed once per key, rather than once per block.
+ * The functions used for AesCipherBlocks and InvAesCipherBlocks are also
+ * chosen when the key is expanded, so that implementations specialised for
+ * the key size can be used without checking it on every call.
+ * The contents should be treated as opaque.  As the schedules are derived from
+ * the key, the context should be zeroed once it is no longer required.
+ */
+struct _AES_CONTEXT {
+  UINTN               Rounds;
+  AES_BLOCKS_FUNCTION CipherBlocks;
+  AES_BLOCKS_FUNCTION InvCipherBlocks;
+  UINT32              EncKey[4 * (AES_MAX_ROUNDS + 1)];
+  UINT32              DecKey[4 * (AES_MAX_ROUNDS + 1)];
+};
+
+/**
+ * An expanded XTS-AES key pair.
+ *
+ * This holds the expanded data and tweak keys, so that a key which is used for
+ * more than one data unit only has to be expanded once.  As with AES_CONTEXT,
+ * the context should be zeroed once it is no longer required.
+ */
+typedef struct {
+  AES_CONTEXT DataKey;
+  AES_CONTEXT TweakKey;
+} XTS_AES_CONTEXT;
+
+/**
+ * State for encrypting or decrypting a single XTS-AES data unit in pieces,
+ * with XtsAesStreamInit, XtsAesStreamUpdate and XtsAesStreamFinal.
+ *
+ * This refers to the expanded key, and holds the tweak for the next block and
+ * up to 31 bytes of data which have not yet been processed.  The contents
+ * should be treated as opaque.  XtsAesStreamFinal zeroes the context, but if
+ * the stream is abandoned before then, the context should be zeroed by the
+ * caller.
+ */
+typedef struct {
+  XTS_AES_CONTEXT CONST *Key;
+  UINT8                  Tweak[16];
+  UINT8                  Buffer[32];
+  UINTN                  Buffered;
+  BOOLEAN                Encrypt;
+} XTS_AES_STREAM;
+
+/**
+ * Expand an AES key for use with AesCipherBlock(s) and InvAesCipherBlock(s).
+ *
+ * @param Keysize   Size of the key in bits - must be 128, 192 or 256
+ * @param Key       Key to use (must match size in keysize)
+ * @param Context   Where to store the expanded key
+ *
+ * @retval EFI_SUCCESS            The key was successfully expanded
+ * @retval EFI_INVALID_PARAMETER  One of the parameters was incorrect
+ */
+EFI_STATUS
+EFIAPI
+AesInitContext(IN  UINTN CONST  Keysize,
+               IN  UINT8 CONST  Key[static Keysize/8],
+               OUT AES_CONTEXT *Context);
+
+/**
+ * Encrypt a single block using an expanded key.
+ *
+ * @param Context   Expanded key, as initialised by AesInitContext
+ * @param In        Data to encrypt (16 bytes)
+ * @param Out       Where to store the encrypted data (may be the same as In)
+ *
+ * @retval EFI_SUCCESS            The data was successfully encrypted
+ * @retval EFI_INVALID_PARAMETER  One of the parameters was incorrect
+ */
+EFI_STATUS
+EFIAPI
+AesCipherBlock(IN  AES_CONTEXT CONST *Context,
+               IN  UINT8       CONST  In[16],
+               OUT UINT8              Out[16]);
+
+/**
+ * Decrypt a single block using an expanded key.
+ *
+ * @param Context   Expanded key, as initialised by AesInitContext
+ * @param In        Data to decrypt (16 bytes)
+ * @param Out       Where to store the decrypted data (may be the same as In)
+ *
+ * @retval EFI_SUCCESS            The data was successfully decrypted
+ * @retval EFI_INVALID_PARAMETER  One of the parameters was incorrect
+ */
+EFI_STATUS
+EFIAPI
+InvAesCipherBlock(IN  AES_CONTEXT CONST *Context,
+                  IN  UINT8       CONST  In[16],
+                  OUT UINT8              Out[16]);
+
+/**
+ * Encrypt a number of consecutive blocks using an expanded key.
+ *
+ * Each block is encrypted independently (as in ECB mode), which allows the
+ * implementation to work on several blocks at once.  Modes of operation
+ * should prepare as many blocks as they can and pass them in one call.
+ *
+ * @param Context   Expanded key, as initialised by AesInitContext
+ * @param Blocks    Number of blocks to encrypt (may be zero)
+ * @param In        Data to encrypt (16 * Blocks bytes)
+ * @param Out       Where to store the encrypted data (may be the same as In)
+ *
+ * @retval EFI_SUCCESS            The data was successfully encrypted
+ * @retval EFI_INVALID_PARAMETER  One of the parameters was incorrect
+ */
+EFI_STATUS
+EFIAPI
+AesCipherBlocks(IN  AES_CONTEXT CONST *Context,
+                IN  UINTN              Blocks,
+                IN  UINT8       CONST *In,
+                OUT UINT8             *Out);
+
+/**
+ * Decrypt a number of consecutive blocks using an expanded key.
+ *
+ * @param Context   Expanded key, as initialised by AesInitContext
+ * @param Blocks    Number of blocks to decrypt (may be zero)
+ * @param In        Data to decrypt (16 * Blocks bytes)
+ * @param Out       Where to store the decrypted data (may be the same as In)
+ *
+ * @retval EFI_SUCCESS            The data was successfully decrypted
+ * @retval EFI_INVALID_PARAMETER  One of the parameters was incorrect
+ */
+EFI_STATUS
+EFIAPI
+InvAesCipherBlocks(IN  AES_CONTEXT CONST *Context,
+                   IN  UINTN              Blocks,
+                   IN  UINT8       CONST *In,
+                   OUT UINT8             *Out);
+
 /**
  * Implementation of the AES Cipher - see section 5.1 of FIPS 197.
  *
@@ -67,6 +226,127 @@ InvAesCipher(IN  UINTN CONST Keysize,
              IN  UINT8 CONST Key[static Keysize/8],
              OUT UINT8       Out[16]);
 
+/**
+ * Expand an XTS-AES key for use with XtsAesCipherUnit, InvXtsAesCipherUnit
+ * and XtsAesStreamInit.
+ *
+ * @param KeySize   Size of the key in bits - must be 256 or 512.
+ * @param Key       Pointer to the key - the first half is used to encrypt the
+ *                  data, while the second half is used to encrypt the initial
+ *                  tweak.
+ * @param Context   Where to store the expanded key.
+ *
+ * @retval  EFI_SUCCESS             The key was expanded.
+ * @retval  EFI_INVALID_PARAMETER   One or more of the parameters were invalid.
+ */
+EFI_STATUS
+EFIAPI
+XtsAesInitContext(IN  UINTN           CONST KeySize,
+                  IN  UINT8           CONST Key[static KeySize/8],
+                  OUT XTS_AES_CONTEXT      *Context);
+
+/**
+ * XTS-AES encryption of a data unit with an expanded key.
+ *
+ * @param Context   Expanded key, as initialised by XtsAesInitContext.
+ * @param IV        Pointer to the tweak IV.
+ * @param Size      Size of the data (in bytes) - must be at least 16 bytes.
+ * @param Src       Pointer to the data.
+ * @param Dest      Pointer to the location to store the encrypted data (this
+ *                  may be the same as Src).
+ *
+ * @retval  EFI_SUCCESS             The data was encrypted.
+ * @retval  EFI_INVALID_PARAMETER   One or more of the parameters were invalid.
+ */
+EFI_STATUS
+EFIAPI
+XtsAesCipherUnit(IN  XTS_AES_CONTEXT CONST *Context,
+                 IN  UINT8           CONST  IV[static 16],
+                 IN  UINTN           CONST  Size,
+                 IN  UINT8           CONST  Src[static Size],
+                 OUT UINT8                  Dest[static Size]);
+
+/**
+ * XTS-AES decryption of a data unit with an expanded key.
+ *
+ * @param Context   Expanded key, as initialised by XtsAesInitContext.
+ * @param IV        Pointer to the tweak IV.
+ * @param Size      Size of the data (in bytes) - must be at least 16 bytes.
+ * @param Src       Pointer to the encrypted data.
+ * @param Dest      Pointer to the location to store the decrypted data (this
+ *                  may be the same as Src).
+ *
+ * @retval  EFI_SUCCESS             The data was decrypted.
+ * @retval  EFI_INVALID_PARAMETER   One or more of the parameters were invalid.
+ */
+EFI_STATUS
+EFIAPI
+InvXtsAesCipherUnit(IN  XTS_AES_CONTEXT CONST *Context,
+                    IN  UINT8           CONST  IV[static 16],
+                    IN  UINTN           CONST  Size,
+                    IN  UINT8           CONST  Src[static Size],
+                    OUT UINT8                  Dest[static Size]);
+
+/**
+ * XTS-AES encryption of whole blocks from anywhere within a data unit.
+ *
+ * The tweak for the first block is calculated directly from its index, so a
+ * range of blocks can be processed without the blocks before it.  The last
+ * two blocks of a data unit whose size is not a multiple of 16 bytes are
+ * changed by ciphertext stealing, and have to be processed together with
+ * XtsAesCipherUnit instead.
+ *
+ * @param Context     Expanded key, as initialised by XtsAesInitContext.
+ * @param IV          Pointer to the tweak IV of the data unit.
+ * @param BlockIndex  Index of the first block within the data unit.
+ * @param Size        Size of the data (in bytes) - must be a non-zero multiple
+ *                    of 16 bytes.
+ * @param Src         Pointer to the data.
+ * @param Dest        Pointer to the location to store the encrypted data (this
+ *                    may be the same as Src).
+ *
+ * @retval  EFI_SUCCESS             The data was encrypted.
+ * @retval  EFI_INVALID_PARAMETER   One or more of the parameters were invalid.
+ */
+EFI_STATUS
+EFIAPI
+XtsAesCipherBlocksAt(IN  XTS_AES_CONTEXT CONST *Context,
+                     IN  UINT8           CONST  IV[static 16],
+                     IN  UINT64          CONST  BlockIndex,
+                     IN  UINTN           CONST  Size,
+                     IN  UINT8           CONST  Src[static Size],
+                     OUT UINT8                  Dest[static Size]);
+
+/**
+ * XTS-AES decryption of whole blocks from anywhere within a data unit.
+ *
+ * The tweak for the first block is calculated directly from its index, so a
+ * range of blocks can be processed without the blocks before it.  The last
+ * two blocks of a data unit whose size is not a multiple of 16 bytes are
+ * changed by ciphertext stealing, and have to be processed together with
+ * InvXtsAesCipherUnit instead.
+ *
+ * @param Context     Expanded key, as initialised by XtsAesInitContext.
+ * @param IV          Pointer to the tweak IV of the data unit.
+ * @param BlockIndex  Index of the first block within the data unit.
+ * @param Size        Size of the data (in bytes) - must be a non-zero multiple
+ *                    of 16 bytes.
+ * @param Src         Pointer to the encrypted data.
+ * @param Dest        Pointer to the location to store the decrypted data (this
+ *                    may be the same as Src).
+ *
+ * @retval  EFI_SUCCESS             The data was decrypted.
+ * @retval  EFI_INVALID_PARAMETER   One or more of the parameters were invalid.
+ */
+EFI_STATUS
+EFIAPI
+InvXtsAesCipherBlocksAt(IN  XTS_AES_CONTEXT CONST *Context,
+                        IN  UINT8           CONST  IV[static 16],
+                        IN  UINT64          CONST  BlockIndex,
+                        IN  UINTN           CONST  Size,
+                        IN  UINT8           CONST  Src[static Size],
+                        OUT UINT8                  Dest[static Size]);
+
 /**
  * XTS-AES encryption.
  *
@@ -117,4 +397,176 @@ InvXtsAesCipher(IN  UINTN CONST KeySize,
                 IN  UINT8 CONST Src[static Size],
                 OUT UINT8       Dest[static Size]);
 
+/**
+ * XTS-AES encryption of consecutive data units (e.g. disk sectors).
+ *
+ * @param KeySize       Size of the key in bits - must be 256 or 512.
+ * @param Key           Pointer to the key - the first half is used to encrypt
+ *                      the data, while the second half is used to encrypt the
+ *                      initial tweaks.
+ * @param DataUnit      Number of the first data unit.  Each following data
+ *                      unit has the next number.
+ * @param DataUnitSize  Size of each data unit in bytes, typically 512 or 4096 -
+ *                      must be a non-zero multiple of 16 bytes.
+ * @param Size          Size of the data (in bytes) - must be a non-zero
+ *                      multiple of DataUnitSize.
+ * @param Src           Pointer to the data.
+ * @param Dest          Pointer to the location to store the encrypted data
+ *                      (this may be the same as Src).
+ *
+ * @retval  EFI_SUCCESS             The data was encrypted.
+ * @retval  EFI_INVALID_PARAMETER   One or more of the parameters were invalid.
+ */
+EFI_STATUS
+EFIAPI
+XtsAesCipherDataUnits(IN  UINTN  CONST KeySize,
+                      IN  UINT8  CONST Key[static KeySize/8],
+                      IN  UINT64 CONST DataUnit,
+                      IN  UINTN  CONST DataUnitSize,
+                      IN  UINTN  CONST Size,
+                      IN  UINT8  CONST Src[static Size],
+                      OUT UINT8        Dest[static Size]);
+
+/**
+ * XTS-AES decryption of consecutive data units (e.g. disk sectors).
+ *
+ * @param KeySize       Size of the key in bits - must be 256 or 512.
+ * @param Key           Pointer to the key - the first half is used to encrypt
+ *                      the data, while the second half is used to encrypt the
+ *                      initial tweaks.
+ * @param DataUnit      Number of the first data unit.  Each following data
+ *                      unit has the next number.
+ * @param DataUnitSize  Size of each data unit in bytes, typically 512 or 4096 -
+ *                      must be a non-zero multiple of 16 bytes.
+ * @param Size          Size of the data (in bytes) - must be a non-zero
+ *                      multiple of DataUnitSize.
+ * @param Src           Pointer to the encrypted data.
+ * @param Dest          Pointer to the location to store the decrypted data
+ *                      (this may be the same as Src).
+ *
+ * @retval  EFI_SUCCESS             The data was decrypted.
+ * @retval  EFI_INVALID_PARAMETER   One or more of the parameters were invalid.
+ */
+EFI_STATUS
+EFIAPI
+InvXtsAesCipherDataUnits(IN  UINTN  CONST KeySize,
+                         IN  UINT8  CONST Key[static KeySize/8],
+                         IN  UINT64 CONST DataUnit,
+                         IN  UINTN  CONST DataUnitSize,
+                         IN  UINTN  CONST Size,
+                         IN  UINT8  CONST Src[static Size],
+                         OUT UINT8        Dest[static Size]);
+
+/**
+ * Start encrypting or decrypting a single data unit in pieces.
+ *
+ * @param Stream    The stream context to initialise.
+ * @param Context   Expanded key, as initialised by XtsAesInitContext.  The
+ *                  stream refers to this, rather than taking a copy, so it
+ *                  must not be changed or freed until the stream is finished.
+ * @param IV        Pointer to the tweak IV.
+ * @param Encrypt   TRUE to encrypt the data, FALSE to decrypt it.
+ *
+ * @retval  EFI_SUCCESS             The stream was initialised.
+ * @retval  EFI_INVALID_PARAMETER   One or more of the parameters were invalid.
+ */
+EFI_STATUS
+EFIAPI
+XtsAesStreamInit(OUT XTS_AES_STREAM        *Stream,
+                 IN  XTS_AES_CONTEXT CONST *Context,
+                 IN  UINT8           CONST  IV[static 16],
+                 IN  BOOLEAN                Encrypt);
+
+/**
+ * Encrypt or decrypt the next piece of a data unit.
+ *
+ * The last 16 to 31 bytes seen are held back in the stream, as they may be
+ * needed for ciphertext stealing once the end of the data is known, so the
+ * output lags the input by up to 31 bytes.
+ *
+ * @param Stream    The stream context.
+ * @param Size      Size of the piece (in bytes) - this can be any size.
+ * @param Src       Pointer to the piece of data.
+ * @param Dest      Where to store the processed data - up to Size + 15 bytes
+ *                  are written.  This may overlap Src as long as it does not
+ *                  start after it, so a buffer can be processed in place by
+ *                  passing the buffer offset by the total size processed so
+ *                  far.
+ * @param Processed On return, the number of bytes stored at Dest.
+ *
+ * @retval  EFI_SUCCESS             The data was processed.
+ * @retval  EFI_INVALID_PARAMETER   One or more of the parameters were invalid.
+ */
+EFI_STATUS
+EFIAPI
+XtsAesStreamUpdate(IN OUT XTS_AES_STREAM       *Stream,
+                   IN     UINTN                 Size,
+                   IN     UINT8          CONST *Src,
+                   OUT    UINT8                *Dest,
+                   OUT    UINTN                *Processed);
+
+/**
+ * Finish encrypting or decrypting a data unit.
+ *
+ * This processes the data held back by XtsAesStreamUpdate, using ciphertext
+ * stealing if the size of the data was not a multiple of 16 bytes, and then
+ * clears the stream context.
+ *
+ * @param Stream    The stream context.
+ * @param Dest      Where to store the rest of the data - up to 31 bytes.
+ * @param Processed On return, the number of bytes stored at Dest.
+ *
+ * @retval  EFI_SUCCESS             The data was processed.
+ * @retval  EFI_INVALID_PARAMETER   One or more of the parameters were invalid,
+ *                                  or the data was less than 16 bytes in total.
+ */
+EFI_STATUS
+EFIAPI
+XtsAesStreamFinal(IN OUT XTS_AES_STREAM *Stream,
+                  OUT    UINT8          *Dest,
+                  OUT    UINTN          *Processed);
+
+/**
+ * AES Key Wrap - see section 2.2.1 of RFC 3394.
+ *
+ * @param Context   Expanded key encryption key, as initialised by
+ *                  AesInitContext
+ * @param Size      Size of the key to wrap in bytes - must be a multiple of 8
+ *                  and at least 16
+ * @param Key       Key to wrap
+ * @param Wrapped   Where to store the wrapped key (Size + 8 bytes)
+ *
+ * @retval EFI_SUCCESS            The key was wrapped
+ * @retval EFI_INVALID_PARAMETER  One of the parameters was incorrect
+ */
+EFI_STATUS
+EFIAPI
+AesKeyWrap(IN  AES_CONTEXT CONST *Context,
+           IN  UINTN              Size,
+           IN  UINT8       CONST *Key,
+           OUT UINT8             *Wrapped);
+
+/**
+ * AES Key Unwrap - see section 2.2.2 of RFC 3394.
+ *
+ * @param Context   Expanded key encryption key, as initialised by
+ *                  AesInitContext
+ * @param Size      Size of the wrapped key in bytes - must be a multiple of 8
+ *                  and at least 24
+ * @param Wrapped   Wrapped key
+ * @param Key       Where to store the unwrapped key (Size - 8 bytes)
+ *
+ * @retval EFI_SUCCESS              The key was unwrapped and passed the
+ *                                  integrity check
+ * @retval EFI_SECURITY_VIOLATION   The integrity check failed, so the key
+ *                                  encryption key is wrong.  Key is zeroed.
+ * @retval EFI_INVALID_PARAMETER    One of the parameters was incorrect
+ */
+EFI_STATUS
+EFIAPI
+AesKeyUnwrap(IN  AES_CONTEXT CONST *Context,
+             IN  UINTN              Size,
+             IN  UINT8       CONST *Wrapped,
+             OUT UINT8             *Key);
+
 #endif
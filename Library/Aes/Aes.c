@@ -0,0 +1,293 @@
+/**
+ * Copyright (c) 2015, baskingshark
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <Uefi.h>
+#include <Library/Aes.h>
+#include <Library/BaseMemoryLib.h>
+#include "AesEngine.h"
+
+/**
+ * Constants:
+ *  Nk: Number of 32-bit words compising the Cipher Key.
+ *      This can be 4, 6 or 8 for 128 bit, 192 bit or 256 bit respectively.
+ */
+#define NkFromKeySize(x)  ((x)/32)
+
+/**
+ * The engine used for all AES operations.
+ *
+ * Building with AES_REFERENCE defined selects the byte-oriented FIPS 197
+ * reference code, which is useful for verifying the optimised engines, and
+ * AES_TABLES selects the T-table engine.  Otherwise the constant-time
+ * bitsliced engine is used, unless AesLibConstructor finds a faster one
+ * supported by the processor.
+ */
+STATIC
+AES_ENGINE CONST *
+Engine =
+#if defined(AES_REFERENCE)
+  &gAesGenericEngine;
+#elif defined(AES_TABLES)
+  &gAesTableEngine;
+#else
+  &gAesBitslicedEngine;
+#endif
+
+/**
+ * Library constructor - select the AES engine, and the GF(2^128) multiply
+ * used for XTS-AES.
+ *
+ * @param ImageHandle   The firmware allocated handle for the EFI image
+ * @param SystemTable   A pointer to the EFI System Table
+ *
+ * @retval EFI_SUCCESS  Always
+ */
+EFI_STATUS
+EFIAPI
+AesLibConstructor(IN EFI_HANDLE        ImageHandle,
+                  IN EFI_SYSTEM_TABLE *SystemTable) {
+#if !defined(AES_REFERENCE) && !defined(AES_TABLES) && \
+    (defined(MDE_CPU_IA32) || defined(MDE_CPU_X64))
+  if(AesNiSupported())
+    Engine = &gAesNiEngine;
+  else if(AesSsse3Supported())
+    Engine = &gAesSsse3Engine;
+#endif
+#if defined(MDE_CPU_IA32) || defined(MDE_CPU_X64)
+  if(XtsPclmulSupported())
+    XtsAesSetGfMul(XtsPclmulMul);
+#endif
+
+  return EFI_SUCCESS;
+}
+
+/**
+ * Select the engine used for all subsequent AES operations.
+ *
+ * Contexts initialised with a different engine must not be used afterwards.
+ *
+ * @param NewEngine   The engine to use
+ */
+VOID
+EFIAPI
+AesSetEngine(IN AES_ENGINE CONST *NewEngine) {
+  Engine = NewEngine;
+}
+
+/**
+ * Expand an AES key for use with AesCipherBlock(s) and InvAesCipherBlock(s).
+ *
+ * @param Keysize   Size of the key in bits - must be 128, 192 or 256
+ * @param Key       Key to use (must match size in keysize)
+ * @param Context   Where to store the expanded key
+ *
+ * @retval EFI_SUCCESS            The key was successfully expanded
+ * @retval EFI_INVALID_PARAMETER  One of the parameters was incorrect
+ */
+EFI_STATUS
+EFIAPI
+AesInitContext(IN  UINTN CONST  Keysize,
+               IN  UINT8 CONST  Key[static Keysize/8],
+               OUT AES_CONTEXT *Context) {
+  if((128 != Keysize && 192 != Keysize && 256 != Keysize) ||
+     !Key || !Context)
+    return EFI_INVALID_PARAMETER;
+
+  Context->CipherBlocks = Engine->CipherBlocks;
+  Context->InvCipherBlocks = Engine->InvCipherBlocks;
+  Engine->InitContext(NkFromKeySize(Keysize), Key, Context);
+
+  return EFI_SUCCESS;
+}
+
+/**
+ * Encrypt a single block using an expanded key.
+ *
+ * @param Context   Expanded key, as initialised by AesInitContext
+ * @param In        Data to encrypt (16 bytes)
+ * @param Out       Where to store the encrypted data (may be the same as In)
+ *
+ * @retval EFI_SUCCESS            The data was successfully encrypted
+ * @retval EFI_INVALID_PARAMETER  One of the parameters was incorrect
+ */
+EFI_STATUS
+EFIAPI
+AesCipherBlock(IN  AES_CONTEXT CONST *Context,
+               IN  UINT8       CONST  In[16],
+               OUT UINT8              Out[16]) {
+  if(!Context || !In || !Out)
+    return EFI_INVALID_PARAMETER;
+
+  Engine->Cipher(Context, In, Out);
+
+  return EFI_SUCCESS;
+}
+
+/**
+ * Decrypt a single block using an expanded key.
+ *
+ * @param Context   Expanded key, as initialised by AesInitContext
+ * @param In        Data to decrypt (16 bytes)
+ * @param Out       Where to store the decrypted data (may be the same as In)
+ *
+ * @retval EFI_SUCCESS            The data was successfully decrypted
+ * @retval EFI_INVALID_PARAMETER  One of the parameters was incorrect
+ */
+EFI_STATUS
+EFIAPI
+InvAesCipherBlock(IN  AES_CONTEXT CONST *Context,
+                  IN  UINT8       CONST  In[16],
+                  OUT UINT8              Out[16]) {
+  if(!Context || !In || !Out)
+    return EFI_INVALID_PARAMETER;
+
+  Engine->InvCipher(Context, In, Out);
+
+  return EFI_SUCCESS;
+}
+
+/**
+ * Encrypt a number of consecutive blocks using an expanded key.
+ *
+ * @param Context   Expanded key, as initialised by AesInitContext
+ * @param Blocks    Number of blocks to encrypt (may be zero)
+ * @param In        Data to encrypt (16 * Blocks bytes)
+ * @param Out       Where to store the encrypted data (may be the same as In)
+ *
+ * @retval EFI_SUCCESS            The data was successfully encrypted
+ * @retval EFI_INVALID_PARAMETER  One of the parameters was incorrect
+ */
+EFI_STATUS
+EFIAPI
+AesCipherBlocks(IN  AES_CONTEXT CONST *Context,
+                IN  UINTN              Blocks,
+                IN  UINT8       CONST *In,
+                OUT UINT8             *Out) {
+  UINTN Idx;
+
+  if(!Context || !In || !Out)
+    return EFI_INVALID_PARAMETER;
+
+  if(Context->CipherBlocks) {
+    Context->CipherBlocks(Context, Blocks, In, Out);
+  } else {
+    for(Idx = 0; Idx < Blocks; Idx++)
+      Engine->Cipher(Context, In + 16*Idx, Out + 16*Idx);
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+ * Decrypt a number of consecutive blocks using an expanded key.
+ *
+ * @param Context   Expanded key, as initialised by AesInitContext
+ * @param Blocks    Number of blocks to decrypt (may be zero)
+ * @param In        Data to decrypt (16 * Blocks bytes)
+ * @param Out       Where to store the decrypted data (may be the same as In)
+ *
+ * @retval EFI_SUCCESS            The data was successfully decrypted
+ * @retval EFI_INVALID_PARAMETER  One of the parameters was incorrect
+ */
+EFI_STATUS
+EFIAPI
+InvAesCipherBlocks(IN  AES_CONTEXT CONST *Context,
+                   IN  UINTN              Blocks,
+                   IN  UINT8       CONST *In,
+                   OUT UINT8             *Out) {
+  UINTN Idx;
+
+  if(!Context || !In || !Out)
+    return EFI_INVALID_PARAMETER;
+
+  if(Context->InvCipherBlocks) {
+    Context->InvCipherBlocks(Context, Blocks, In, Out);
+  } else {
+    for(Idx = 0; Idx < Blocks; Idx++)
+      Engine->InvCipher(Context, In + 16*Idx, Out + 16*Idx);
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+ * Implementation of the AES Cipher - see section 5.1 of FIPS 197.
+ *
+ * @param keysize   Size of the key in bits - must be 128, 192 or 256
+ * @param in        Data to encrypt (16 bytes)
+ * @param key       Key to use (must match size in keysize)
+ * @param out       Where to store the encrypted data
+ *
+ * @retval EFI_SUCCESS            The data was successfully encrypted
+ * @retval EFI_INVALID_PARAMETER  One of the parameters was incorrect
+ */
+EFI_STATUS
+EFIAPI
+AesCipher(IN  UINTN CONST Keysize,
+          IN  UINT8 CONST In[16],
+          IN  UINT8 CONST Key[static Keysize/8],
+          OUT UINT8       Out[16]) {
+  AES_CONTEXT Context;
+  EFI_STATUS  Status;
+
+  Status = AesInitContext(Keysize, Key, &Context);
+  if(!EFI_ERROR(Status)) {
+    Status = AesCipherBlock(&Context, In, Out);
+    ZeroMem(&Context, sizeof(Context));
+  }
+
+  return Status;
+}
+
+/**
+ * Implementation of the Inverse AES Cipher - see section 5.3 of FIPS 197.
+ *
+ * @param Keysize   Size of the key in bits - must be 128, 192 or 256
+ * @param In        Data to decrypt (16 bytes)
+ * @param Key       Key to use (must match size in keysize)
+ * @param Out       Where to store the decrypted data
+ *
+ * @retval EFI_SUCCESS            The data was successfully encrypted
+ * @retval EFI_INVALID_PARAMETER  One of the parameters was incorrect
+ */
+EFI_STATUS
+EFIAPI
+InvAesCipher(IN  CONST UINTN Keysize,
+             IN  CONST UINT8 In[16],
+             IN  CONST UINT8 Key[static Keysize/8],
+             OUT       UINT8 Out[16]) {
+  AES_CONTEXT Context;
+  EFI_STATUS  Status;
+
+  Status = AesInitContext(Keysize, Key, &Context);
+  if(!EFI_ERROR(Status)) {
+    Status = InvAesCipherBlock(&Context, In, Out);
+    ZeroMem(&Context, sizeof(Context));
+  }
+
+  return Status;
+}
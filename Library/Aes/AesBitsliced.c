@@ -0,0 +1,841 @@
+/**
+ * Copyright (c) 2015, baskingshark
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * This is a bitsliced, constant-time implementation of the AES algorithm
+ * described in FIPS 197.
+ *
+ * Up to four blocks are held in eight 64-bit words, with word n holding bit n
+ * of every byte, so that SubBytes can be computed with logic operations
+ * rather than table lookups indexed by secret data.  Two such groups are
+ * processed side by side, so each call handles up to eight blocks.
+ *
+ * The S-box circuit is the one published by Boyar and Peralta in "A new
+ * combinational logic minimization technique with applications to
+ * cryptology", and the data layout follows the "ct64" code in BearSSL.
+ *
+ * The encryption round keys are stored bitsliced, but compressed into EncKey
+ * as two 64-bit words per round key (each of the four 16-bit lanes of a word
+ * holds the same value, so only one nibble per lane needs to be kept).  They
+ * are expanded on the stack for each call.
+ */
+#include <Uefi.h>
+#include <Library/Aes.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include "AesEngine.h"
+#include "AesGeneric.h"
+
+/**
+ * Number of blocks processed by one pass through the rounds.
+ */
+#define BLOCKS_PER_GROUP    4
+#define GROUPS              2
+#define BITSLICED_BLOCKS    (BLOCKS_PER_GROUP * GROUPS)
+
+/**
+ * Get/put a little-endian word from/to a byte array.
+ */
+#define GetWordLe(p) \
+  (((UINT32)(p)[0] <<  0) | ((UINT32)(p)[1] <<  8) | \
+   ((UINT32)(p)[2] << 16) | ((UINT32)(p)[3] << 24))
+#define PutWordLe(p, w) do { \
+    (p)[0] = (UINT8)((w) >>  0); \
+    (p)[1] = (UINT8)((w) >>  8); \
+    (p)[2] = (UINT8)((w) >> 16); \
+    (p)[3] = (UINT8)((w) >> 24); \
+  } while(0)
+
+/**
+ * Bitsliced SubBytes.
+ *
+ * Note that the circuit numbers its inputs (x) and outputs (s) from the most
+ * significant bit, so x0 is Q[7] and x7 is Q[0].
+ *
+ * @param Q   Bitsliced state to update.
+ */
+STATIC
+VOID
+EFIAPI
+Sbox(IN OUT UINT64 Q[8]) {
+  UINT64 x0, x1, x2, x3, x4, x5, x6, x7;
+  UINT64 y1, y2, y3, y4, y5, y6, y7, y8, y9;
+  UINT64 y10, y11, y12, y13, y14, y15, y16, y17, y18, y19;
+  UINT64 y20, y21;
+  UINT64 z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+  UINT64 z10, z11, z12, z13, z14, z15, z16, z17;
+  UINT64 t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+  UINT64 t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+  UINT64 t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+  UINT64 t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+  UINT64 t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+  UINT64 t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+  UINT64 t60, t61, t62, t63, t64, t65, t66, t67;
+  UINT64 s0, s1, s2, s3, s4, s5, s6, s7;
+
+  x0 = Q[7];
+  x1 = Q[6];
+  x2 = Q[5];
+  x3 = Q[4];
+  x4 = Q[3];
+  x5 = Q[2];
+  x6 = Q[1];
+  x7 = Q[0];
+
+  // Top linear transformation
+  y14 = x3 ^ x5;
+  y13 = x0 ^ x6;
+  y9 = x0 ^ x3;
+  y8 = x0 ^ x5;
+  t0 = x1 ^ x2;
+  y1 = t0 ^ x7;
+  y4 = y1 ^ x3;
+  y12 = y13 ^ y14;
+  y2 = y1 ^ x0;
+  y5 = y1 ^ x6;
+  y3 = y5 ^ y8;
+  t1 = x4 ^ y12;
+  y15 = t1 ^ x5;
+  y20 = t1 ^ x1;
+  y6 = y15 ^ x7;
+  y10 = y15 ^ t0;
+  y11 = y20 ^ y9;
+  y7 = x7 ^ y11;
+  y17 = y10 ^ y11;
+  y19 = y10 ^ y8;
+  y16 = t0 ^ y11;
+  y21 = y13 ^ y16;
+  y18 = x0 ^ y16;
+
+  // Non-linear section
+  t2 = y12 & y15;
+  t3 = y3 & y6;
+  t4 = t3 ^ t2;
+  t5 = y4 & x7;
+  t6 = t5 ^ t2;
+  t7 = y13 & y16;
+  t8 = y5 & y1;
+  t9 = t8 ^ t7;
+  t10 = y2 & y7;
+  t11 = t10 ^ t7;
+  t12 = y9 & y11;
+  t13 = y14 & y17;
+  t14 = t13 ^ t12;
+  t15 = y8 & y10;
+  t16 = t15 ^ t12;
+  t17 = t4 ^ t14;
+  t18 = t6 ^ t16;
+  t19 = t9 ^ t14;
+  t20 = t11 ^ t16;
+  t21 = t17 ^ y20;
+  t22 = t18 ^ y19;
+  t23 = t19 ^ y21;
+  t24 = t20 ^ y18;
+
+  t25 = t21 ^ t22;
+  t26 = t21 & t23;
+  t27 = t24 ^ t26;
+  t28 = t25 & t27;
+  t29 = t28 ^ t22;
+  t30 = t23 ^ t24;
+  t31 = t22 ^ t26;
+  t32 = t31 & t30;
+  t33 = t32 ^ t24;
+  t34 = t23 ^ t33;
+  t35 = t27 ^ t33;
+  t36 = t24 & t35;
+  t37 = t36 ^ t34;
+  t38 = t27 ^ t36;
+  t39 = t29 & t38;
+  t40 = t25 ^ t39;
+
+  t41 = t40 ^ t37;
+  t42 = t29 ^ t33;
+  t43 = t29 ^ t40;
+  t44 = t33 ^ t37;
+  t45 = t42 ^ t41;
+  z0 = t44 & y15;
+  z1 = t37 & y6;
+  z2 = t33 & x7;
+  z3 = t43 & y16;
+  z4 = t40 & y1;
+  z5 = t29 & y7;
+  z6 = t42 & y11;
+  z7 = t45 & y17;
+  z8 = t41 & y10;
+  z9 = t44 & y12;
+  z10 = t37 & y3;
+  z11 = t33 & y4;
+  z12 = t43 & y13;
+  z13 = t40 & y5;
+  z14 = t29 & y2;
+  z15 = t42 & y9;
+  z16 = t45 & y14;
+  z17 = t41 & y8;
+
+  // Bottom linear transformation
+  t46 = z15 ^ z16;
+  t47 = z10 ^ z11;
+  t48 = z5 ^ z13;
+  t49 = z9 ^ z10;
+  t50 = z2 ^ z12;
+  t51 = z2 ^ z5;
+  t52 = z7 ^ z8;
+  t53 = z0 ^ z3;
+  t54 = z6 ^ z7;
+  t55 = z16 ^ z17;
+  t56 = z12 ^ t48;
+  t57 = t50 ^ t53;
+  t58 = z4 ^ t46;
+  t59 = z3 ^ t54;
+  t60 = t46 ^ t57;
+  t61 = z14 ^ t57;
+  t62 = t52 ^ t58;
+  t63 = t49 ^ t58;
+  t64 = z4 ^ t59;
+  t65 = t61 ^ t62;
+  t66 = z1 ^ t63;
+  s0 = t59 ^ t63;
+  s6 = t56 ^ ~t62;
+  s7 = t48 ^ ~t60;
+  t67 = t64 ^ t65;
+  s3 = t53 ^ t66;
+  s4 = t51 ^ t66;
+  s5 = t47 ^ t65;
+  s1 = t64 ^ ~s3;
+  s2 = t55 ^ ~t67;
+
+  Q[7] = s0;
+  Q[6] = s1;
+  Q[5] = s2;
+  Q[4] = s3;
+  Q[3] = s4;
+  Q[2] = s5;
+  Q[1] = s6;
+  Q[0] = s7;
+}
+
+/**
+ * The inverse of the affine transformation of the S-box (with its constant
+ * folded in as the complemented bits).  Applying it before and after the
+ * forward S-box circuit gives the inverse S-box, since inversion in GF(2^8)
+ * is its own inverse.
+ *
+ * @param Q   Bitsliced state to update.
+ */
+STATIC
+VOID
+EFIAPI
+InvAffine(IN OUT UINT64 Q[8]) {
+  UINT64 q0, q1, q2, q3, q4, q5, q6, q7;
+
+  q0 = ~Q[0];
+  q1 = ~Q[1];
+  q2 = Q[2];
+  q3 = Q[3];
+  q4 = Q[4];
+  q5 = ~Q[5];
+  q6 = ~Q[6];
+  q7 = Q[7];
+  Q[7] = q1 ^ q4 ^ q6;
+  Q[6] = q0 ^ q3 ^ q5;
+  Q[5] = q7 ^ q2 ^ q4;
+  Q[4] = q6 ^ q1 ^ q3;
+  Q[3] = q5 ^ q0 ^ q2;
+  Q[2] = q4 ^ q7 ^ q1;
+  Q[1] = q3 ^ q6 ^ q0;
+  Q[0] = q2 ^ q5 ^ q7;
+}
+
+/**
+ * Bitsliced InvSubBytes.
+ *
+ * @param Q   Bitsliced state to update.
+ */
+STATIC
+VOID
+EFIAPI
+InvSbox(IN OUT UINT64 Q[8]) {
+  InvAffine(Q);
+  Sbox(Q);
+  InvAffine(Q);
+}
+
+/**
+ * Convert between the word-per-column layout of InterleaveIn and the
+ * bitsliced layout.  The transformation is its own inverse.
+ *
+ * @param Q   State to convert.
+ */
+STATIC
+VOID
+EFIAPI
+Ortho(IN OUT UINT64 Q[8]) {
+#define SwapN(cl, ch, s, x, y) do { \
+    UINT64 a = (x); \
+    UINT64 b = (y); \
+    (x) = (a & (cl)) | ((b & (cl)) << (s)); \
+    (y) = ((a & (ch)) >> (s)) | (b & (ch)); \
+  } while(0)
+#define Swap2(x, y) \
+  SwapN(0x5555555555555555ULL, 0xAAAAAAAAAAAAAAAAULL, 1, x, y)
+#define Swap4(x, y) \
+  SwapN(0x3333333333333333ULL, 0xCCCCCCCCCCCCCCCCULL, 2, x, y)
+#define Swap8(x, y) \
+  SwapN(0x0F0F0F0F0F0F0F0FULL, 0xF0F0F0F0F0F0F0F0ULL, 4, x, y)
+
+  Swap2(Q[0], Q[1]);
+  Swap2(Q[2], Q[3]);
+  Swap2(Q[4], Q[5]);
+  Swap2(Q[6], Q[7]);
+
+  Swap4(Q[0], Q[2]);
+  Swap4(Q[1], Q[3]);
+  Swap4(Q[4], Q[6]);
+  Swap4(Q[5], Q[7]);
+
+  Swap8(Q[0], Q[4]);
+  Swap8(Q[1], Q[5]);
+  Swap8(Q[2], Q[6]);
+  Swap8(Q[3], Q[7]);
+
+#undef Swap8
+#undef Swap4
+#undef Swap2
+#undef SwapN
+}
+
+/**
+ * Spread the four (little-endian) words of a block over two 64-bit words, so
+ * that Ortho can be applied.
+ *
+ * @param Q0  Where to store the even bytes of each word.
+ * @param Q1  Where to store the odd bytes of each word.
+ * @param W   The block to convert.
+ */
+STATIC
+VOID
+EFIAPI
+InterleaveIn(OUT UINT64       *Q0,
+             OUT UINT64       *Q1,
+             IN  UINT32 CONST  W[4]) {
+  UINT64 x0, x1, x2, x3;
+
+  x0 = W[0];
+  x1 = W[1];
+  x2 = W[2];
+  x3 = W[3];
+  x0 |= (x0 << 16);
+  x1 |= (x1 << 16);
+  x2 |= (x2 << 16);
+  x3 |= (x3 << 16);
+  x0 &= 0x0000FFFF0000FFFFULL;
+  x1 &= 0x0000FFFF0000FFFFULL;
+  x2 &= 0x0000FFFF0000FFFFULL;
+  x3 &= 0x0000FFFF0000FFFFULL;
+  x0 |= (x0 << 8);
+  x1 |= (x1 << 8);
+  x2 |= (x2 << 8);
+  x3 |= (x3 << 8);
+  x0 &= 0x00FF00FF00FF00FFULL;
+  x1 &= 0x00FF00FF00FF00FFULL;
+  x2 &= 0x00FF00FF00FF00FFULL;
+  x3 &= 0x00FF00FF00FF00FFULL;
+  *Q0 = x0 | (x2 << 8);
+  *Q1 = x1 | (x3 << 8);
+}
+
+/**
+ * Reverse InterleaveIn.
+ *
+ * @param W   Where to store the block.
+ * @param Q0  The even bytes of each word.
+ * @param Q1  The odd bytes of each word.
+ */
+STATIC
+VOID
+EFIAPI
+InterleaveOut(OUT UINT32 W[4],
+              IN  UINT64 Q0,
+              IN  UINT64 Q1) {
+  UINT64 x0, x1, x2, x3;
+
+  x0 = Q0 & 0x00FF00FF00FF00FFULL;
+  x1 = Q1 & 0x00FF00FF00FF00FFULL;
+  x2 = (Q0 >> 8) & 0x00FF00FF00FF00FFULL;
+  x3 = (Q1 >> 8) & 0x00FF00FF00FF00FFULL;
+  x0 |= (x0 >> 8);
+  x1 |= (x1 >> 8);
+  x2 |= (x2 >> 8);
+  x3 |= (x3 >> 8);
+  x0 &= 0x0000FFFF0000FFFFULL;
+  x1 &= 0x0000FFFF0000FFFFULL;
+  x2 &= 0x0000FFFF0000FFFFULL;
+  x3 &= 0x0000FFFF0000FFFFULL;
+  W[0] = (UINT32)x0 | (UINT32)(x0 >> 16);
+  W[1] = (UINT32)x1 | (UINT32)(x1 >> 16);
+  W[2] = (UINT32)x2 | (UINT32)(x2 >> 16);
+  W[3] = (UINT32)x3 | (UINT32)(x3 >> 16);
+}
+
+/**
+ * AddRoundKey transformation - see section 5.1.4 of FIPS 197.
+ */
+STATIC
+VOID
+EFIAPI
+AddRoundKey(IN OUT UINT64       Q[8],
+            IN     UINT64 CONST SKey[8]) {
+  UINTN Idx;
+  for(Idx = 0; Idx < 8; Idx++)
+    Q[Idx] ^= SKey[Idx];
+}
+
+/**
+ * ShiftRows transformation - see section 5.1.2 of FIPS 197.
+ *
+ * Each 16-bit lane holds one row, with one nibble per column.
+ */
+STATIC
+VOID
+EFIAPI
+ShiftRows(IN OUT UINT64 Q[8]) {
+  UINTN  Idx;
+  UINT64 x;
+  for(Idx = 0; Idx < 8; Idx++) {
+    x = Q[Idx];
+    Q[Idx] = (x & 0x000000000000FFFFULL)
+           | ((x & 0x00000000FFF00000ULL) >> 4)
+           | ((x & 0x00000000000F0000ULL) << 12)
+           | ((x & 0x0000FF0000000000ULL) >> 8)
+           | ((x & 0x000000FF00000000ULL) << 8)
+           | ((x & 0xF000000000000000ULL) >> 12)
+           | ((x & 0x0FFF000000000000ULL) << 4);
+  }
+}
+
+/**
+ * InvShiftRows transformation - see section 5.3.1 of FIPS 197.
+ */
+STATIC
+VOID
+EFIAPI
+InvShiftRows(IN OUT UINT64 Q[8]) {
+  UINTN  Idx;
+  UINT64 x;
+  for(Idx = 0; Idx < 8; Idx++) {
+    x = Q[Idx];
+    Q[Idx] = (x & 0x000000000000FFFFULL)
+           | ((x & 0x000000000FFF0000ULL) << 4)
+           | ((x & 0x00000000F0000000ULL) >> 12)
+           | ((x & 0x000000FF00000000ULL) << 8)
+           | ((x & 0x0000FF0000000000ULL) >> 8)
+           | ((x & 0x000F000000000000ULL) << 12)
+           | ((x & 0xFFF0000000000000ULL) >> 4);
+  }
+}
+
+/**
+ * Rotate the rows of the state by one (Rotr16) or two (Rotr32) places.
+ */
+#define Rotr16(x) (((x) >> 16) | ((x) << 48))
+#define Rotr32(x) (((x) >> 32) | ((x) << 32))
+
+/**
+ * MixColumns transformation - see section 5.1.3 of FIPS 197.
+ */
+STATIC
+VOID
+EFIAPI
+MixColumns(IN OUT UINT64 Q[8]) {
+  UINT64 q0, q1, q2, q3, q4, q5, q6, q7;
+  UINT64 r0, r1, r2, r3, r4, r5, r6, r7;
+
+  q0 = Q[0];
+  q1 = Q[1];
+  q2 = Q[2];
+  q3 = Q[3];
+  q4 = Q[4];
+  q5 = Q[5];
+  q6 = Q[6];
+  q7 = Q[7];
+  r0 = Rotr16(q0);
+  r1 = Rotr16(q1);
+  r2 = Rotr16(q2);
+  r3 = Rotr16(q3);
+  r4 = Rotr16(q4);
+  r5 = Rotr16(q5);
+  r6 = Rotr16(q6);
+  r7 = Rotr16(q7);
+
+  Q[0] = q7 ^ r7 ^ r0 ^ Rotr32(q0 ^ r0);
+  Q[1] = q0 ^ r0 ^ q7 ^ r7 ^ r1 ^ Rotr32(q1 ^ r1);
+  Q[2] = q1 ^ r1 ^ r2 ^ Rotr32(q2 ^ r2);
+  Q[3] = q2 ^ r2 ^ q7 ^ r7 ^ r3 ^ Rotr32(q3 ^ r3);
+  Q[4] = q3 ^ r3 ^ q7 ^ r7 ^ r4 ^ Rotr32(q4 ^ r4);
+  Q[5] = q4 ^ r4 ^ r5 ^ Rotr32(q5 ^ r5);
+  Q[6] = q5 ^ r5 ^ r6 ^ Rotr32(q6 ^ r6);
+  Q[7] = q6 ^ r6 ^ r7 ^ Rotr32(q7 ^ r7);
+}
+
+/**
+ * InvMixColumns transformation - see section 5.3.3 of FIPS 197.
+ */
+STATIC
+VOID
+EFIAPI
+InvMixColumns(IN OUT UINT64 Q[8]) {
+  UINT64 q0, q1, q2, q3, q4, q5, q6, q7;
+  UINT64 r0, r1, r2, r3, r4, r5, r6, r7;
+
+  q0 = Q[0];
+  q1 = Q[1];
+  q2 = Q[2];
+  q3 = Q[3];
+  q4 = Q[4];
+  q5 = Q[5];
+  q6 = Q[6];
+  q7 = Q[7];
+  r0 = Rotr16(q0);
+  r1 = Rotr16(q1);
+  r2 = Rotr16(q2);
+  r3 = Rotr16(q3);
+  r4 = Rotr16(q4);
+  r5 = Rotr16(q5);
+  r6 = Rotr16(q6);
+  r7 = Rotr16(q7);
+
+  Q[0] = q5 ^ q6 ^ q7 ^ r0 ^ r5 ^ r7 ^ Rotr32(q0 ^ q5 ^ q6 ^ r0 ^ r5);
+  Q[1] = q0 ^ q5 ^ r0 ^ r1 ^ r5 ^ r6 ^ r7 ^
+         Rotr32(q1 ^ q5 ^ q7 ^ r1 ^ r5 ^ r6);
+  Q[2] = q0 ^ q1 ^ q6 ^ r1 ^ r2 ^ r6 ^ r7 ^
+         Rotr32(q0 ^ q2 ^ q6 ^ r2 ^ r6 ^ r7);
+  Q[3] = q0 ^ q1 ^ q2 ^ q5 ^ q6 ^ r0 ^ r2 ^ r3 ^ r5 ^
+         Rotr32(q0 ^ q1 ^ q3 ^ q5 ^ q6 ^ q7 ^ r0 ^ r3 ^ r5 ^ r7);
+  Q[4] = q1 ^ q2 ^ q3 ^ q5 ^ r1 ^ r3 ^ r4 ^ r5 ^ r6 ^ r7 ^
+         Rotr32(q1 ^ q2 ^ q4 ^ q5 ^ q7 ^ r1 ^ r4 ^ r5 ^ r6);
+  Q[5] = q2 ^ q3 ^ q4 ^ q6 ^ r2 ^ r4 ^ r5 ^ r6 ^ r7 ^
+         Rotr32(q2 ^ q3 ^ q5 ^ q6 ^ r2 ^ r5 ^ r6 ^ r7);
+  Q[6] = q3 ^ q4 ^ q5 ^ q7 ^ r3 ^ r5 ^ r6 ^ r7 ^
+         Rotr32(q3 ^ q4 ^ q6 ^ q7 ^ r3 ^ r6 ^ r7);
+  Q[7] = q4 ^ q5 ^ q6 ^ r4 ^ r6 ^ r7 ^ Rotr32(q4 ^ q5 ^ q7 ^ r4 ^ r7);
+}
+
+/**
+ * Expand the compressed round keys stored in the context.
+ *
+ * @param Context   Context initialised by BitslicedInitContext
+ * @param SKey      Where to store the bitsliced round keys
+ */
+STATIC
+VOID
+EFIAPI
+ExpandRoundKeys(IN  AES_CONTEXT CONST *Context,
+                OUT UINT64             SKey[8 * (AES_MAX_ROUNDS + 1)]) {
+  UINT64 Compressed;
+  UINT64 x0, x1, x2, x3;
+  UINTN  Idx;
+
+  for(Idx = 0; Idx < 2 * (Context->Rounds + 1); Idx++) {
+    Compressed = Context->EncKey[2*Idx] |
+                 ((UINT64)Context->EncKey[2*Idx + 1] << 32);
+    x0 = Compressed & 0x1111111111111111ULL;
+    x1 = (Compressed & 0x2222222222222222ULL) >> 1;
+    x2 = (Compressed & 0x4444444444444444ULL) >> 2;
+    x3 = (Compressed & 0x8888888888888888ULL) >> 3;
+    // Replicate the bit into all four nibble positions
+    SKey[4*Idx + 0] = (x0 << 4) - x0;
+    SKey[4*Idx + 1] = (x1 << 4) - x1;
+    SKey[4*Idx + 2] = (x2 << 4) - x2;
+    SKey[4*Idx + 3] = (x3 << 4) - x3;
+  }
+}
+
+/**
+ * Expand a key - see section 5.2 of FIPS 197.
+ *
+ * The key is expanded by the reference code, then each round key is
+ * bitsliced as if it were four copies of the same block, and compressed.
+ *
+ * @param Nk        Size of the key in words - must be 4, 6 or 8.
+ * @param Key       Key to expand
+ * @param Context   Where to store the expanded key
+ */
+STATIC
+VOID
+EFIAPI
+BitslicedInitContext(IN  UINTN CONST  Nk,
+                     IN  UINT8 CONST  Key[static 4*Nk],
+                     OUT AES_CONTEXT *Context) {
+  AES_CONTEXT Words;
+  UINT32      W[4];
+  UINT64      Q[8];
+  UINT64      Compressed;
+  UINTN       Round;
+  UINTN       Idx;
+
+  InitContext(Nk, Key, &Words);
+  for(Round = 0; Round <= Words.Rounds; Round++) {
+    for(Idx = 0; Idx < 4; Idx++)
+      W[Idx] = SwapBytes32(Words.EncKey[4*Round + Idx]);
+    InterleaveIn(&Q[0], &Q[4], W);
+    Q[1] = Q[2] = Q[3] = Q[0];
+    Q[5] = Q[6] = Q[7] = Q[4];
+    Ortho(Q);
+    for(Idx = 0; Idx < 2; Idx++) {
+      Compressed = (Q[4*Idx + 0] & 0x1111111111111111ULL) |
+                   (Q[4*Idx + 1] & 0x2222222222222222ULL) |
+                   (Q[4*Idx + 2] & 0x4444444444444444ULL) |
+                   (Q[4*Idx + 3] & 0x8888888888888888ULL);
+      Context->EncKey[4*Round + 2*Idx + 0] = (UINT32)Compressed;
+      Context->EncKey[4*Round + 2*Idx + 1] = (UINT32)(Compressed >> 32);
+    }
+  }
+  // The decryption schedule is not used
+  ZeroMem(Context->DecKey, sizeof(Context->DecKey));
+  Context->Rounds = Words.Rounds;
+
+  ZeroMem(&Words, sizeof(Words));
+  ZeroMem(W, sizeof(W));
+  ZeroMem(Q, sizeof(Q));
+}
+
+/**
+ * Load up to BITSLICED_BLOCKS blocks into bitsliced state.  Unused lanes are
+ * filled with zeros.
+ *
+ * @param Blocks    Number of blocks to load
+ * @param In        The blocks to load
+ * @param Q         Where to store the state
+ */
+STATIC
+VOID
+EFIAPI
+LoadBlocks(IN  UINTN CONST Blocks,
+           IN  UINT8 CONST In[static 16*Blocks],
+           OUT UINT64      Q[GROUPS][8]) {
+  UINT32 W[4];
+  UINTN  Group;
+  UINTN  Block;
+  UINTN  Idx;
+
+  for(Group = 0; Group < GROUPS; Group++) {
+    for(Block = 0; Block < BLOCKS_PER_GROUP; Block++) {
+      Idx = Group * BLOCKS_PER_GROUP + Block;
+      if(Idx < Blocks) {
+        W[0] = GetWordLe(In + 16*Idx +  0);
+        W[1] = GetWordLe(In + 16*Idx +  4);
+        W[2] = GetWordLe(In + 16*Idx +  8);
+        W[3] = GetWordLe(In + 16*Idx + 12);
+      } else {
+        W[0] = W[1] = W[2] = W[3] = 0;
+      }
+      InterleaveIn(&Q[Group][Block], &Q[Group][Block + 4], W);
+    }
+    Ortho(Q[Group]);
+  }
+}
+
+/**
+ * Reverse LoadBlocks.
+ *
+ * @param Blocks    Number of blocks to store
+ * @param Q         The state to store
+ * @param Out       Where to store the blocks
+ */
+STATIC
+VOID
+EFIAPI
+StoreBlocks(IN  UINTN CONST Blocks,
+            IN  UINT64      Q[GROUPS][8],
+            OUT UINT8       Out[static 16*Blocks]) {
+  UINT32 W[4];
+  UINTN  Group;
+  UINTN  Block;
+  UINTN  Idx;
+
+  for(Group = 0; Group < GROUPS; Group++) {
+    Ortho(Q[Group]);
+    for(Block = 0; Block < BLOCKS_PER_GROUP; Block++) {
+      Idx = Group * BLOCKS_PER_GROUP + Block;
+      if(Idx >= Blocks)
+        return;
+      InterleaveOut(W, Q[Group][Block], Q[Group][Block + 4]);
+      PutWordLe(Out + 16*Idx +  0, W[0]);
+      PutWordLe(Out + 16*Idx +  4, W[1]);
+      PutWordLe(Out + 16*Idx +  8, W[2]);
+      PutWordLe(Out + 16*Idx + 12, W[3]);
+    }
+  }
+}
+
+/**
+ * Encrypt any number of blocks, BITSLICED_BLOCKS at a time.
+ *
+ * @param Context   Expanded key, as initialised by BitslicedInitContext
+ * @param Blocks    Number of blocks to encrypt
+ * @param In        Data to encrypt
+ * @param Out       Where to store the encrypted data (may be the same as In)
+ */
+STATIC
+VOID
+EFIAPI
+BitslicedCipherBlocks(IN  AES_CONTEXT CONST *Context,
+                      IN  UINTN              Blocks,
+                      IN  UINT8       CONST *In,
+                      OUT UINT8             *Out) {
+  UINT64 SKey[8 * (AES_MAX_ROUNDS + 1)];
+  UINT64 Q[GROUPS][8];
+  UINTN  Rounds = Context->Rounds;
+  UINTN  Count;
+  UINTN  Groups;
+  UINTN  Group;
+  UINTN  Round;
+
+  ExpandRoundKeys(Context, SKey);
+  while(Blocks > 0) {
+    Count = MIN(Blocks, BITSLICED_BLOCKS);
+    Groups = (Count + BLOCKS_PER_GROUP - 1) / BLOCKS_PER_GROUP;
+    LoadBlocks(Count, In, Q);
+    for(Group = 0; Group < Groups; Group++)
+      AddRoundKey(Q[Group], SKey);
+    for(Round = 1; Round < Rounds; Round++) {
+      for(Group = 0; Group < Groups; Group++) {
+        Sbox(Q[Group]);
+        ShiftRows(Q[Group]);
+        MixColumns(Q[Group]);
+        AddRoundKey(Q[Group], SKey + 8*Round);
+      }
+    }
+    for(Group = 0; Group < Groups; Group++) {
+      Sbox(Q[Group]);
+      ShiftRows(Q[Group]);
+      AddRoundKey(Q[Group], SKey + 8*Rounds);
+    }
+    StoreBlocks(Count, Q, Out);
+    Blocks -= Count;
+    In += 16 * Count;
+    Out += 16 * Count;
+  }
+  ZeroMem(SKey, sizeof(SKey));
+  ZeroMem(Q, sizeof(Q));
+}
+
+/**
+ * Decrypt any number of blocks, BITSLICED_BLOCKS at a time.
+ *
+ * @param Context   Expanded key, as initialised by BitslicedInitContext
+ * @param Blocks    Number of blocks to decrypt
+ * @param In        Data to decrypt
+ * @param Out       Where to store the decrypted data (may be the same as In)
+ */
+STATIC
+VOID
+EFIAPI
+BitslicedInvCipherBlocks(IN  AES_CONTEXT CONST *Context,
+                         IN  UINTN              Blocks,
+                         IN  UINT8       CONST *In,
+                         OUT UINT8             *Out) {
+  UINT64 SKey[8 * (AES_MAX_ROUNDS + 1)];
+  UINT64 Q[GROUPS][8];
+  UINTN  Rounds = Context->Rounds;
+  UINTN  Count;
+  UINTN  Groups;
+  UINTN  Group;
+  UINTN  Round;
+
+  ExpandRoundKeys(Context, SKey);
+  while(Blocks > 0) {
+    Count = MIN(Blocks, BITSLICED_BLOCKS);
+    Groups = (Count + BLOCKS_PER_GROUP - 1) / BLOCKS_PER_GROUP;
+    LoadBlocks(Count, In, Q);
+    for(Group = 0; Group < Groups; Group++)
+      AddRoundKey(Q[Group], SKey + 8*Rounds);
+    for(Round = Rounds - 1; Round > 0; Round--) {
+      for(Group = 0; Group < Groups; Group++) {
+        InvShiftRows(Q[Group]);
+        InvSbox(Q[Group]);
+        AddRoundKey(Q[Group], SKey + 8*Round);
+        InvMixColumns(Q[Group]);
+      }
+    }
+    for(Group = 0; Group < Groups; Group++) {
+      InvShiftRows(Q[Group]);
+      InvSbox(Q[Group]);
+      AddRoundKey(Q[Group], SKey);
+    }
+    StoreBlocks(Count, Q, Out);
+    Blocks -= Count;
+    In += 16 * Count;
+    Out += 16 * Count;
+  }
+  ZeroMem(SKey, sizeof(SKey));
+  ZeroMem(Q, sizeof(Q));
+}
+
+/**
+ * Encrypt a single block.
+ *
+ * @param Context   Expanded key, as initialised by BitslicedInitContext
+ * @param In        Data to encrypt (16 bytes)
+ * @param Out       Where to store the encrypted data
+ */
+STATIC
+VOID
+EFIAPI
+BitslicedCipher(IN  AES_CONTEXT CONST *Context,
+                IN  UINT8       CONST  In[16],
+                OUT UINT8              Out[16]) {
+  BitslicedCipherBlocks(Context, 1, In, Out);
+}
+
+/**
+ * Decrypt a single block.
+ *
+ * @param Context   Expanded key, as initialised by BitslicedInitContext
+ * @param In        Data to decrypt (16 bytes)
+ * @param Out       Where to store the decrypted data
+ */
+STATIC
+VOID
+EFIAPI
+BitslicedInvCipher(IN  AES_CONTEXT CONST *Context,
+                   IN  UINT8       CONST  In[16],
+                   OUT UINT8              Out[16]) {
+  BitslicedInvCipherBlocks(Context, 1, In, Out);
+}
+
+/**
+ * Engine definition for the bitsliced implementation.
+ */
+AES_ENGINE CONST gAesBitslicedEngine = {
+  BitslicedInitContext,
+  BitslicedCipher,
+  BitslicedInvCipher,
+  BitslicedCipherBlocks,
+  BitslicedInvCipherBlocks
+};
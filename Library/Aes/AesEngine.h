@@ -0,0 +1,187 @@
+/**
+ * Copyright (c) 2015, baskingshark
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __AES_ENGINE_H__
+#define __AES_ENGINE_H__
+
+#include <Uefi.h>
+#include <Library/Aes.h>
+
+/**
+ * Expand a key into an AES_CONTEXT.
+ *
+ * @param Nk        Size of the key in words - must be 4, 6 or 8.
+ * @param Key       Key to expand
+ * @param Context   Where to store the expanded key
+ */
+typedef
+VOID
+(EFIAPI *AES_ENGINE_INIT)(IN  UINTN CONST  Nk,
+                          IN  UINT8 CONST  Key[static 4*Nk],
+                          OUT AES_CONTEXT *Context);
+
+/**
+ * Encrypt or decrypt a single block with an expanded key.
+ *
+ * @param Context   Expanded key, as initialised by the same engine
+ * @param In        Data to encrypt or decrypt (16 bytes)
+ * @param Out       Where to store the result (may be the same as In)
+ */
+typedef
+VOID
+(EFIAPI *AES_ENGINE_BLOCK)(IN  AES_CONTEXT CONST *Context,
+                           IN  UINT8       CONST  In[16],
+                           OUT UINT8              Out[16]);
+
+/**
+ * Encrypt or decrypt a number of consecutive blocks with an expanded key.
+ */
+typedef AES_BLOCKS_FUNCTION AES_ENGINE_BLOCKS;
+
+/**
+ * An implementation of AES.
+ *
+ * Each engine is free to choose the layout of the key schedules within the
+ * AES_CONTEXT, so a context must only be used with the engine that
+ * initialised it.
+ *
+ * CipherBlocks and InvCipherBlocks are optional - engines which do not gain
+ * anything from seeing several blocks at once leave them NULL, and the blocks
+ * are passed to Cipher and InvCipher one at a time.  They are copied into the
+ * AES_CONTEXT before InitContext is called, which may then replace them with
+ * functions specialised for the key size.
+ */
+typedef struct _AES_ENGINE {
+  AES_ENGINE_INIT   InitContext;
+  AES_ENGINE_BLOCK  Cipher;
+  AES_ENGINE_BLOCK  InvCipher;
+  AES_ENGINE_BLOCKS CipherBlocks;
+  AES_ENGINE_BLOCKS InvCipherBlocks;
+} AES_ENGINE;
+
+/**
+ * Override the engine chosen by AesLibConstructor.  This is intended for
+ * benchmarks and tests which compare the engines through the public API.
+ *
+ * @param NewEngine   The engine to use
+ */
+VOID
+EFIAPI
+AesSetEngine(IN AES_ENGINE CONST *NewEngine);
+
+/**
+ * Multiply two elements of GF(2^128), as used for XTS-AES tweaks.
+ *
+ * @param A     The first element, in little-endian format
+ * @param B     The second element, in little-endian format
+ * @param Out   Where to store the product (may be the same as A or B)
+ */
+typedef
+VOID
+(EFIAPI *XTS_GF_MUL)(IN  UINT8 CONST A[16],
+                     IN  UINT8 CONST B[16],
+                     OUT UINT8       Out[16]);
+
+/**
+ * Override the GF(2^128) multiply used by the XTS-AES functions to move to
+ * an arbitrary block of a data unit.  AesLibConstructor selects one to suit
+ * the processor.  This is intended for tests which compare the
+ * implementations.
+ *
+ * @param NewGfMul    The multiply to use, or NULL for the portable one
+ */
+VOID
+EFIAPI
+XtsAesSetGfMul(IN XTS_GF_MUL NewGfMul);
+
+/**
+ * Byte-oriented reference implementation of FIPS 197 - see AesGeneric.c.
+ */
+extern AES_ENGINE CONST gAesGenericEngine;
+
+/**
+ * 32-bit table driven implementation - see AesTable.c.
+ */
+extern AES_ENGINE CONST gAesTableEngine;
+
+/**
+ * Constant-time bitsliced implementation - see AesBitsliced.c.
+ */
+extern AES_ENGINE CONST gAesBitslicedEngine;
+
+#if defined(MDE_CPU_IA32) || defined(MDE_CPU_X64)
+/**
+ * Implementation using the AES-NI instructions - see AesNi.c.
+ */
+extern AES_ENGINE CONST gAesNiEngine;
+
+/**
+ * Check whether the AES-NI engine can be used.
+ *
+ * @return A BOOLEAN indicating whether the processor supports AES-NI and SSE
+ *         has been enabled.
+ */
+BOOLEAN
+EFIAPI
+AesNiSupported(VOID);
+
+/**
+ * Implementation using the SSSE3 PSHUFB instruction - see AesSsse3.c.
+ */
+extern AES_ENGINE CONST gAesSsse3Engine;
+
+/**
+ * Check whether the SSSE3 engine can be used.
+ *
+ * @return A BOOLEAN indicating whether the processor supports SSSE3 and SSE
+ *         has been enabled.
+ */
+BOOLEAN
+EFIAPI
+AesSsse3Supported(VOID);
+
+/**
+ * GF(2^128) multiply using the PCLMULQDQ instruction - see XtsPclmul.c.
+ */
+VOID
+EFIAPI
+XtsPclmulMul(IN  UINT8 CONST A[16],
+             IN  UINT8 CONST B[16],
+             OUT UINT8       Out[16]);
+
+/**
+ * Check whether XtsPclmulMul can be used.
+ *
+ * @return A BOOLEAN indicating whether the processor supports PCLMULQDQ and
+ *         SSE has been enabled.
+ */
+BOOLEAN
+EFIAPI
+XtsPclmulSupported(VOID);
+#endif
+
+#endif
@@ -29,6 +29,9 @@
  * This is an implementation of the AES algorithm described in FIPS 197.
  */
 #include <Uefi.h>
+#include <Library/Aes.h>
+#include "AesEngine.h"
+#include "AesGeneric.h"
 
 /**
  * Constants:
@@ -40,7 +43,6 @@
  *      This is 10, 12 or 14 for 128 bit, 192 bit or 256 bit respectively.
  */
 #define Nb 4
-#define NkFromKeySize(x)  ((x)/32)
 #define NrFromNk(x)       ((x)+6)
 
 /**
@@ -227,12 +229,6 @@ InvShiftRows(IN OUT State *S) {
 
 
 #define xtime(x) (((x)<<1) ^ (((x>>7) & 1) ? 0x1b : 0))
-#define multiply(x,y) (\
-(((y>>0) & 1) * (x)) ^\
-(((y>>1) & 1) * xtime(x)) ^\
-(((y>>2) & 1) * xtime(xtime(x))) ^\
-(((y>>3) & 1) * xtime(xtime(xtime(x)))) ^\
-(((y>>4) & 1) * xtime(xtime(xtime(xtime(x))))))
 
 /**
  * MixColumns implementation - see section 5.1.3 of FIPS 197
@@ -289,35 +285,27 @@ InvMixColumns(IN OUT State *S) {
   // s'(1,c) = ({09}•s(0,c))+({0e}•s(1,c))+({0b}•s(2,c))+({0d}•s(3,c))
   // s'(2,c) = ({0d}•s(0,c))+({09}•s(1,c))+({0e}•s(2,c))+({0b}•s(3,c))
   // s'(4,c) = ({0b}•s(0,c))+({0d}•s(1,c))+({09}•s(2,c))+({0e}•s(3,c))
+  //
+  // The InvMixColumns polynomial is the MixColumns polynomial multiplied by
+  // {04}x^2 + {05}, so this becomes ...
+  //
+  // u = {04}•(s(0,c)+s(2,c))
+  // v = {04}•(s(1,c)+s(3,c))
+  // s(0,c) += u, s(1,c) += v, s(2,c) += u, s(3,c) += v
+  //
+  // ... followed by MixColumns.
 
   UINTN c;
   for(c = 0; c < 4; c++) {
-    UINT8 S0c = (*S)[0][c];
-    UINT8 S1c = (*S)[1][c];
-    UINT8 S2c = (*S)[2][c];
-    UINT8 S3c = (*S)[3][c];
+    UINT8 u = xtime(xtime((UINT8)((*S)[0][c] ^ (*S)[2][c])));
+    UINT8 v = xtime(xtime((UINT8)((*S)[1][c] ^ (*S)[3][c])));
 
-    // s'(0,c) = ...
-    (*S)[0][c] = (multiply(S0c, 0x0e) ^
-                  multiply(S1c, 0x0b) ^
-                  multiply(S2c, 0x0d) ^
-                  multiply(S3c, 0x09));
-    // s'(1,c) = ...
-    (*S)[1][c] = (multiply(S0c, 0x09) ^
-                  multiply(S1c, 0x0e) ^
-                  multiply(S2c, 0x0b) ^
-                  multiply(S3c, 0x0d));
-    // s'(2,c) = ...
-    (*S)[2][c] = (multiply(S0c, 0x0d) ^
-                  multiply(S1c, 0x09) ^
-                  multiply(S2c, 0x0e) ^
-                  multiply(S3c, 0x0b));
-    // s'(3,c) = ...
-    (*S)[3][c] = (multiply(S0c, 0x0b) ^
-                  multiply(S1c, 0x0d) ^
-                  multiply(S2c, 0x09) ^
-                  multiply(S3c, 0x0e));
+    (*S)[0][c] ^= u;
+    (*S)[1][c] ^= v;
+    (*S)[2][c] ^= u;
+    (*S)[3][c] ^= v;
   }
+  MixColumns(S);
 }
 
 /**
@@ -336,28 +324,68 @@ AddRoundKey(IN OUT State*       S,
 }
 
 /**
- * Implementation of the AES Cipher - see section 5.1 of FIPS 197.
+ * Expand a key - see section 5.2 of FIPS 197.
+ *
+ * The encryption schedule is stored as generated by KeyExpansion.  The
+ * decryption schedule is the one used by the equivalent inverse cipher (see
+ * section 5.3.5 of FIPS 197): the same round keys in reverse order, with
+ * InvMixColumns applied to all but the first and last.  This lets InvCipher
+ * walk through it in the same direction, and with the same sequence of steps,
+ * as Cipher.
  *
- * @param Nk    Size of the key in words - must be 4, 6 or 8.
- * @param In    Data to encrypt (16 bytes)
- * @param Key   Key to use (must match size in keysize)
- * @param Out   Where to store the encrypted data
+ * @param Nk        Size of the key in words - must be 4, 6 or 8.
+ * @param Key       Key to expand
+ * @param Context   Where to store the expanded key
  */
 VOID
 EFIAPI
-Cipher(IN  UINTN CONST Nk,
-       IN  UINT8 CONST In[16],
-       IN  UINT8 CONST Key[static 4*Nk],
-       OUT UINT8       Out[16]) {
-  State  State;
-  UINT32 W[60]; // Maximum of 14 rounds => maximum of 60 words of key
-  UINTN  Nr;    // Number of rounds
-  UINTN  Idx;
-  UINTN  Round;
+InitContext(IN  UINTN CONST  Nk,
+            IN  UINT8 CONST  Key[static 4*Nk],
+            OUT AES_CONTEXT *Context) {
+  UINT32 *Dk = Context->DecKey;
+  State   State;
+  UINTN   Nr;     // Number of rounds
+  UINTN   Round;
+  UINTN   Idx;
 
   Nr = NrFromNk(Nk);
 
-  KeyExpansion(Key, Nk, Nr, W);
+  KeyExpansion(Key, Nk, Nr, Context->EncKey);
+  for(Round = 0; Round <= Nr; Round++)
+    for(Idx = 0; Idx < Nb; Idx++)
+      Dk[Nb*Round + Idx] = Context->EncKey[Nb*(Nr - Round) + Idx];
+  for(Round = 1; Round < Nr; Round++) {
+    for(Idx = 0; Idx < 16; Idx++)
+      State[Idx % 4][Idx / 4] = (Dk[Nb*Round + Idx/4] >> (24 - 8*(Idx % 4)));
+    InvMixColumns(&State);
+    for(Idx = 0; Idx < Nb; Idx++)
+      Dk[Nb*Round + Idx] = ((UINT32)State[0][Idx] << 24) |
+                           ((UINT32)State[1][Idx] << 16) |
+                           ((UINT32)State[2][Idx] <<  8) |
+                           ((UINT32)State[3][Idx] <<  0);
+  }
+  Context->Rounds = Nr;
+}
+
+/**
+ * Implementation of the AES Cipher - see section 5.1 of FIPS 197.
+ *
+ * @param Context   Expanded key, as initialised by InitContext
+ * @param In        Data to encrypt (16 bytes)
+ * @param Out       Where to store the encrypted data
+ */
+VOID
+EFIAPI
+Cipher(IN  AES_CONTEXT CONST *Context,
+       IN  UINT8       CONST  In[16],
+       OUT UINT8              Out[16]) {
+  UINT32 CONST *W = Context->EncKey;
+  State         State;
+  UINTN         Nr;    // Number of rounds
+  UINTN         Idx;
+  UINTN         Round;
+
+  Nr = Context->Rounds;
 
   for(Idx = 0; Idx < 16; Idx++)
     State[Idx % 4][Idx / 4] = In[Idx];
@@ -379,94 +407,52 @@ Cipher(IN  UINTN CONST Nk,
 }
 
 /**
- * Implementation of the AES Cipher - see section 5.1 of FIPS 197.
- *
- * @param keysize   Size of the key in bits - must be 128, 192 or 256
- * @param in        Data to encrypt (16 bytes)
- * @param key       Key to use (must match size in keysize)
- * @param out       Where to store the encrypted data
+ * Implementation of the Equivalent Inverse Cipher - see section 5.3.5 of
+ * FIPS 197.
  *
- * @retval EFI_SUCCESS            The data was successfully encrypted
- * @retval EFI_INVALID_PARAMETER  One of the parameters was incorrect
- */
-EFI_STATUS
-EFIAPI
-AesCipher(IN  UINTN CONST Keysize,
-          IN  UINT8 CONST In[16],
-          IN  UINT8 CONST Key[static Keysize/8],
-          OUT UINT8       Out[16]) {
-  if(128 != Keysize && 192 != Keysize && 256 != Keysize)
-    return EFI_INVALID_PARAMETER;
-
-  Cipher(NkFromKeySize(Keysize), In, Key, Out);
-
-  return EFI_SUCCESS;
-}
-
-/**
- * Implementation of the AES Cipher - see section 5.1 of FIPS 197.
- *
- * @param Nk    Size of the key in words - must be 4, 6 or 8.
- * @param In    Data to encrypt (16 bytes)
- * @param Key   Key to use (must match size in keysize)
- * @param Out   Where to store the encrypted data
+ * @param Context   Expanded key, as initialised by InitContext
+ * @param In        Data to decrypt (16 bytes)
+ * @param Out       Where to store the decrypted data
  */
 VOID
 EFIAPI
-InvCipher(IN  CONST UINTN Nk,
-          IN  CONST UINT8 In[16],
-          IN  CONST UINT8 Key[static 4*Nk],
-          OUT       UINT8 Out[16]) {
-  State  State;
-  UINT32 W[60]; // Maximum of 14 rounds => maximum of 60 words of key
-  UINTN  Nr;    // Number of rounds
-  UINTN  Idx;
-  UINTN  Round;
+InvCipher(IN  AES_CONTEXT CONST *Context,
+          IN  UINT8       CONST  In[16],
+          OUT UINT8              Out[16]) {
+  UINT32 CONST *W = Context->DecKey;
+  State         State;
+  UINTN         Nr;    // Number of rounds
+  UINTN         Idx;
+  UINTN         Round;
 
-  Nr = NrFromNk(Nk);
-
-  KeyExpansion(Key, Nk, Nr, W);
+  Nr = Context->Rounds;
 
   for(Idx = 0; Idx < 16; Idx++)
     State[Idx % 4][Idx / 4] = In[Idx];
 
-  AddRoundKey(&State, W + 4*Nr);
-  for(Round = Nr - 1; Round > 0; Round--) {
-    InvShiftRows(&State);
+  AddRoundKey(&State, W);
+  for(Round = 1; Round < Nr; Round++) {
     InvSubBytes(&State);
-    AddRoundKey(&State, W + 4*Round);
+    InvShiftRows(&State);
     InvMixColumns(&State);
+    AddRoundKey(&State, W + 4*Round);
   }
 
-  InvShiftRows(&State);
   InvSubBytes(&State);
-  AddRoundKey(&State, W);
+  InvShiftRows(&State);
+  AddRoundKey(&State, W + 4*Nr);
 
   for(Idx = 0; Idx < 16; Idx++)
     Out[Idx] = State[Idx % 4][Idx/4];
 }
 
 /**
- * Implementation of the Inverse AES Cipher - see section 5.3 of FIPS 197.
- *
- * @param Keysize   Size of the key in bits - must be 128, 192 or 256
- * @param In        Data to decrypt (16 bytes)
- * @param Key       Key to use (must match size in keysize)
- * @param Out       Where to store the decrypted data
- *
- * @retval EFI_SUCCESS            The data was successfully encrypted
- * @retval EFI_INVALID_PARAMETER  One of the parameters was incorrect
+ * Engine definition for the reference implementation.
  */
-EFI_STATUS
-EFIAPI
-InvAesCipher(IN  CONST UINTN Keysize,
-             IN  CONST UINT8 In[16],
-             IN  CONST UINT8 Key[static Keysize/8],
-             OUT       UINT8 Out[16]) {
-  if(128 != Keysize && 192 != Keysize && 256 != Keysize)
-    return EFI_INVALID_PARAMETER;
-
-  InvCipher(NkFromKeySize(Keysize), In, Key, Out);
-
-  return EFI_SUCCESS;
-}
+AES_ENGINE CONST gAesGenericEngine = {
+  InitContext,
+  Cipher,
+  InvCipher,
+  NULL,
+  NULL
+};
@@ -29,35 +29,49 @@
 #define __AES_GENERIC_H__
 
 #include <Uefi.h>
+#include <Library/Aes.h>
 
 /**
- * Implementation of the AES Cipher - see section 5.1 of FIPS 197.
+ * Expand a key - see section 5.2 of FIPS 197.
+ *
+ * The decryption schedule is prepared for the equivalent inverse cipher (see
+ * section 5.3.5 of FIPS 197), so can be shared by engines which use it.
  *
- * @param Nk    Size of the key in words - must be 4, 6 or 8.
- * @param In    Data to encrypt (16 bytes)
- * @param Key   Key to use (must match size in keysize)
- * @param Out   Where to store the encrypted data
+ * @param Nk        Size of the key in words - must be 4, 6 or 8.
+ * @param Key       Key to expand
+ * @param Context   Where to store the expanded key
  */
 VOID
 EFIAPI
-Cipher(IN  UINTN CONST Nk,
-       IN  UINT8 CONST In[16],
-       IN  UINT8 CONST Key[static 4*Nk],
-       OUT UINT8       Out[16]);
+InitContext(IN  UINTN CONST  Nk,
+            IN  UINT8 CONST  Key[static 4*Nk],
+            OUT AES_CONTEXT *Context);
 
 /**
  * Implementation of the AES Cipher - see section 5.1 of FIPS 197.
  *
- * @param Nk    Size of the key in words - must be 4, 6 or 8.
- * @param In    Data to encrypt (16 bytes)
- * @param Key   Key to use (must match size in keysize)
- * @param Out   Where to store the encrypted data
+ * @param Context   Expanded key, as initialised by InitContext
+ * @param In        Data to encrypt (16 bytes)
+ * @param Out       Where to store the encrypted data
+ */
+VOID
+EFIAPI
+Cipher(IN  AES_CONTEXT CONST *Context,
+       IN  UINT8       CONST  In[16],
+       OUT UINT8              Out[16]);
+
+/**
+ * Implementation of the Equivalent Inverse Cipher - see section 5.3.5 of
+ * FIPS 197.
+ *
+ * @param Context   Expanded key, as initialised by InitContext
+ * @param In        Data to decrypt (16 bytes)
+ * @param Out       Where to store the decrypted data
  */
 VOID
 EFIAPI
-InvCipher(IN  CONST UINTN Nk,
-          IN  CONST UINT8 In[16],
-          IN  CONST UINT8 Key[static 4*Nk],
-          OUT       UINT8 Out[16]);
+InvCipher(IN  AES_CONTEXT CONST *Context,
+          IN  UINT8       CONST  In[16],
+          OUT UINT8              Out[16]);
 
 #endif
@@ -0,0 +1,164 @@
+/**
+ * Copyright (c) 2015, baskingshark
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * AES Key Wrap - see RFC 3394.
+ *
+ * The wrapped key is treated as n 64-bit blocks R[1..n] and an integrity check
+ * register A, and six passes are made over the blocks with the AES cipher
+ * applied to A | R[i].  Unwrapping reverses this and checks that A ends up
+ * with the default initial value.
+ */
+#include <Uefi.h>
+#include <Library/Aes.h>
+#include <Library/BaseMemoryLib.h>
+
+/**
+ * Default initial value - see section 2.2.3.1 of RFC 3394.
+ */
+STATIC UINT8 CONST DefaultIV[8] = {
+  0xa6, 0xa6, 0xa6, 0xa6, 0xa6, 0xa6, 0xa6, 0xa6
+};
+
+/**
+ * XOR the big-endian 64-bit step count t into A.
+ */
+STATIC
+VOID
+EFIAPI
+XorStep(IN OUT UINT8  A[8],
+        IN     UINT64 Step) {
+  UINTN Idx;
+
+  for(Idx = 8; Idx > 0; Idx--) {
+    A[Idx - 1] ^= (UINT8)Step;
+    Step >>= 8;
+  }
+}
+
+/**
+ * Wrap a key - see section 2.2.1 of RFC 3394.
+ *
+ * @param Context   Expanded key encryption key, as initialised by
+ *                  AesInitContext
+ * @param Size      Size of the key to wrap in bytes - must be a multiple of 8
+ *                  and at least 16
+ * @param Key       Key to wrap
+ * @param Wrapped   Where to store the wrapped key (Size + 8 bytes)
+ *
+ * @retval EFI_SUCCESS            The key was wrapped
+ * @retval EFI_INVALID_PARAMETER  One of the parameters was incorrect
+ */
+EFI_STATUS
+EFIAPI
+AesKeyWrap(IN  AES_CONTEXT CONST *Context,
+           IN  UINTN              Size,
+           IN  UINT8       CONST *Key,
+           OUT UINT8             *Wrapped) {
+  UINT8  B[16];
+  UINT8 *R;
+  UINTN  n;
+  UINTN  i;
+  UINTN  j;
+
+  if(!Context || !Key || !Wrapped || Size < 16 || Size % 8)
+    return EFI_INVALID_PARAMETER;
+
+  n = Size / 8;
+  R = Wrapped + 8;
+  CopyMem(R, Key, Size);
+  CopyMem(B, DefaultIV, 8);
+
+  for(j = 0; j <= 5; j++) {
+    for(i = 1; i <= n; i++) {
+      CopyMem(B + 8, R + 8*(i-1), 8);
+      AesCipherBlock(Context, B, B);
+      XorStep(B, (UINT64)n * j + i);
+      CopyMem(R + 8*(i-1), B + 8, 8);
+    }
+  }
+  CopyMem(Wrapped, B, 8);
+
+  ZeroMem(B, sizeof(B));
+  return EFI_SUCCESS;
+}
+
+/**
+ * Unwrap a key - see section 2.2.2 of RFC 3394.
+ *
+ * @param Context   Expanded key encryption key, as initialised by
+ *                  AesInitContext
+ * @param Size      Size of the wrapped key in bytes - must be a multiple of 8
+ *                  and at least 24
+ * @param Wrapped   Wrapped key
+ * @param Key       Where to store the unwrapped key (Size - 8 bytes)
+ *
+ * @retval EFI_SUCCESS              The key was unwrapped and passed the
+ *                                  integrity check
+ * @retval EFI_SECURITY_VIOLATION   The integrity check failed - the key
+ *                                  encryption key is wrong or the wrapped key
+ *                                  is corrupt.  Key is zeroed.
+ * @retval EFI_INVALID_PARAMETER    One of the parameters was incorrect
+ */
+EFI_STATUS
+EFIAPI
+AesKeyUnwrap(IN  AES_CONTEXT CONST *Context,
+             IN  UINTN              Size,
+             IN  UINT8       CONST *Wrapped,
+             OUT UINT8             *Key) {
+  EFI_STATUS Status;
+  UINT8      B[16];
+  UINTN      n;
+  UINTN      i;
+  UINTN      j;
+
+  if(!Context || !Wrapped || !Key || Size < 24 || Size % 8)
+    return EFI_INVALID_PARAMETER;
+
+  n = Size / 8 - 1;
+  CopyMem(B, Wrapped, 8);
+  CopyMem(Key, Wrapped + 8, Size - 8);
+
+  for(j = 6; j > 0; j--) {
+    for(i = n; i > 0; i--) {
+      XorStep(B, (UINT64)n * (j-1) + i);
+      CopyMem(B + 8, Key + 8*(i-1), 8);
+      InvAesCipherBlock(Context, B, B);
+      CopyMem(Key + 8*(i-1), B + 8, 8);
+    }
+  }
+
+  if(CompareMem(B, DefaultIV, 8)) {
+    ZeroMem(Key, Size - 8);
+    Status = EFI_SECURITY_VIOLATION;
+  } else {
+    Status = EFI_SUCCESS;
+  }
+
+  ZeroMem(B, sizeof(B));
+  return Status;
+}
@@ -0,0 +1,350 @@
+/**
+ * Copyright (c) 2015, baskingshark
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * This is an implementation of the AES algorithm described in FIPS 197 using
+ * the AES-NI instructions (AESENC, AESDEC, AESIMC and AESKEYGENASSIST).
+ *
+ * It must only be used once AesNiSupported has confirmed that the processor
+ * (and the firmware) support the instructions.
+ */
+#include <Uefi.h>
+#include <Library/Aes.h>
+#include <Library/BaseLib.h>
+#include <wmmintrin.h>
+#include <emmintrin.h>
+#include "AesEngine.h"
+
+/**
+ * The rest of the firmware may be built without SSE, so the functions using
+ * the intrinsics have to enable the instructions individually.
+ */
+#if defined(__GNUC__)
+#define AESNI_TARGET __attribute__((target("sse2,aes")))
+#else
+#define AESNI_TARGET
+#endif
+
+/**
+ * CPUID.01H:ECX.AESNI[bit 25] and CPUID.01H:EDX.SSE2[bit 26]
+ */
+#define CPUID_ECX_AESNI   BIT25
+#define CPUID_EDX_SSE2    BIT26
+
+/**
+ * CR4.OSFXSR[bit 9] - SSE instructions are enabled.
+ */
+#define CR4_OSFXSR        BIT9
+
+/**
+ * Number of blocks kept in flight by the block functions.  AESENC/AESDEC
+ * have a latency of several cycles but can be issued every cycle, so working
+ * on independent blocks in turn keeps the AES unit busy.
+ */
+#define AESNI_INTERLEAVE  8
+
+/**
+ * Load/store a round key from/to a key schedule.
+ */
+#define GetRoundKey(Schedule, Round) \
+  _mm_loadu_si128((__m128i CONST*)((Schedule) + 4*(Round)))
+#define PutRoundKey(Schedule, Round, Value) \
+  _mm_storeu_si128((__m128i*)((Schedule) + 4*(Round)), (Value))
+
+/**
+ * Check whether the AES-NI engine can be used.
+ *
+ * @return A BOOLEAN indicating whether the processor supports AES-NI and SSE
+ *         has been enabled.
+ */
+BOOLEAN
+EFIAPI
+AesNiSupported(VOID)
+{
+  UINT32 RegEcx;
+  UINT32 RegEdx;
+
+  AsmCpuid(1, NULL, NULL, &RegEcx, &RegEdx);
+  if(!(RegEcx & CPUID_ECX_AESNI) || !(RegEdx & CPUID_EDX_SSE2))
+    return FALSE;
+  // X64 firmware always runs with SSE enabled, but IA32 firmware might not.
+  return (AsmReadCr4() & CR4_OSFXSR) != 0;
+}
+
+/**
+ * Implementation of the AES Cipher - see section 5.1 of FIPS 197.
+ *
+ * @param Context   Expanded key, as initialised by AesNiInitContext
+ * @param In        Data to encrypt (16 bytes)
+ * @param Out       Where to store the encrypted data
+ */
+STATIC
+VOID
+EFIAPI
+AESNI_TARGET
+AesNiCipher(IN  AES_CONTEXT CONST *Context,
+            IN  UINT8       CONST  In[16],
+            OUT UINT8              Out[16]) {
+  UINT32 CONST *W = Context->EncKey;
+  __m128i       State;
+  UINTN         Round;
+
+  State = _mm_xor_si128(_mm_loadu_si128((__m128i CONST*)In),
+                        GetRoundKey(W, 0));
+  for(Round = 1; Round < Context->Rounds; Round++)
+    State = _mm_aesenc_si128(State, GetRoundKey(W, Round));
+  State = _mm_aesenclast_si128(State, GetRoundKey(W, Round));
+  _mm_storeu_si128((__m128i*)Out, State);
+}
+
+/**
+ * Implementation of the Equivalent Inverse Cipher - see section 5.3.5 of FIPS
+ * 197.
+ *
+ * @param Context   Expanded key, as initialised by AesNiInitContext
+ * @param In        Data to decrypt (16 bytes)
+ * @param Out       Where to store the decrypted data
+ */
+STATIC
+VOID
+EFIAPI
+AESNI_TARGET
+AesNiInvCipher(IN  AES_CONTEXT CONST *Context,
+               IN  UINT8       CONST  In[16],
+               OUT UINT8              Out[16]) {
+  UINT32 CONST *Dk = Context->DecKey;
+  __m128i       State;
+  UINTN         Round;
+
+  State = _mm_xor_si128(_mm_loadu_si128((__m128i CONST*)In),
+                        GetRoundKey(Dk, 0));
+  for(Round = 1; Round < Context->Rounds; Round++)
+    State = _mm_aesdec_si128(State, GetRoundKey(Dk, Round));
+  State = _mm_aesdeclast_si128(State, GetRoundKey(Dk, Round));
+  _mm_storeu_si128((__m128i*)Out, State);
+}
+
+/**
+ * Apply one round to all AESNI_INTERLEAVE blocks.
+ */
+#define AesNiRound(Op, W, Round)                                          \
+  do {                                                                    \
+    RoundKey = GetRoundKey(W, Round);                                     \
+    S0 = Op(S0, RoundKey);                                                \
+    S1 = Op(S1, RoundKey);                                                \
+    S2 = Op(S2, RoundKey);                                                \
+    S3 = Op(S3, RoundKey);                                                \
+    S4 = Op(S4, RoundKey);                                                \
+    S5 = Op(S5, RoundKey);                                                \
+    S6 = Op(S6, RoundKey);                                                \
+    S7 = Op(S7, RoundKey);                                                \
+  } while(0)
+
+/**
+ * Rounds 1 to Nr-1 for each key size.
+ */
+#define AesNiRounds10(Op, W)                                              \
+  do {                                                                    \
+    AesNiRound(Op, W, 1);                                                 \
+    AesNiRound(Op, W, 2);                                                 \
+    AesNiRound(Op, W, 3);                                                 \
+    AesNiRound(Op, W, 4);                                                 \
+    AesNiRound(Op, W, 5);                                                 \
+    AesNiRound(Op, W, 6);                                                 \
+    AesNiRound(Op, W, 7);                                                 \
+    AesNiRound(Op, W, 8);                                                 \
+    AesNiRound(Op, W, 9);                                                 \
+  } while(0)
+#define AesNiRounds12(Op, W)                                              \
+  do {                                                                    \
+    AesNiRounds10(Op, W);                                                 \
+    AesNiRound(Op, W, 10);                                                \
+    AesNiRound(Op, W, 11);                                                \
+  } while(0)
+#define AesNiRounds14(Op, W)                                              \
+  do {                                                                    \
+    AesNiRounds12(Op, W);                                                 \
+    AesNiRound(Op, W, 12);                                                \
+    AesNiRound(Op, W, 13);                                                \
+  } while(0)
+
+/**
+ * Define a function to encrypt or decrypt any number of blocks,
+ * AESNI_INTERLEAVE at a time, with the rounds for one key size unrolled.
+ * Any remaining blocks are processed one at a time.
+ *
+ * @param Name      Name of the function
+ * @param Schedule  Key schedule to use (EncKey or DecKey)
+ * @param Op        Instruction for rounds 1 to Nr-1
+ * @param LastOp    Instruction for the final round
+ * @param Single    Function to process a single block
+ * @param Nr        Number of rounds (10, 12 or 14)
+ */
+#define AESNI_BLOCKS(Name, Schedule, Op, LastOp, Single, Nr)              \
+STATIC                                                                    \
+VOID                                                                      \
+EFIAPI                                                                    \
+AESNI_TARGET                                                              \
+Name(IN  AES_CONTEXT CONST *Context,                                      \
+     IN  UINTN              Blocks,                                       \
+     IN  UINT8       CONST *In,                                           \
+     OUT UINT8             *Out) {                                        \
+  UINT32 CONST *W = Context->Schedule;                                    \
+  __m128i       RoundKey;                                                 \
+  __m128i       S0, S1, S2, S3, S4, S5, S6, S7;                           \
+                                                                          \
+  for(; Blocks >= AESNI_INTERLEAVE; Blocks -= AESNI_INTERLEAVE) {         \
+    S0 = _mm_loadu_si128((__m128i CONST*)In + 0);                         \
+    S1 = _mm_loadu_si128((__m128i CONST*)In + 1);                         \
+    S2 = _mm_loadu_si128((__m128i CONST*)In + 2);                         \
+    S3 = _mm_loadu_si128((__m128i CONST*)In + 3);                         \
+    S4 = _mm_loadu_si128((__m128i CONST*)In + 4);                         \
+    S5 = _mm_loadu_si128((__m128i CONST*)In + 5);                         \
+    S6 = _mm_loadu_si128((__m128i CONST*)In + 6);                         \
+    S7 = _mm_loadu_si128((__m128i CONST*)In + 7);                         \
+    AesNiRound(_mm_xor_si128, W, 0);                                      \
+    AesNiRounds##Nr(Op, W);                                               \
+    AesNiRound(LastOp, W, Nr);                                            \
+    _mm_storeu_si128((__m128i*)Out + 0, S0);                              \
+    _mm_storeu_si128((__m128i*)Out + 1, S1);                              \
+    _mm_storeu_si128((__m128i*)Out + 2, S2);                              \
+    _mm_storeu_si128((__m128i*)Out + 3, S3);                              \
+    _mm_storeu_si128((__m128i*)Out + 4, S4);                              \
+    _mm_storeu_si128((__m128i*)Out + 5, S5);                              \
+    _mm_storeu_si128((__m128i*)Out + 6, S6);                              \
+    _mm_storeu_si128((__m128i*)Out + 7, S7);                              \
+    In += 16 * AESNI_INTERLEAVE;                                          \
+    Out += 16 * AESNI_INTERLEAVE;                                         \
+  }                                                                       \
+  for(; Blocks > 0; Blocks--) {                                           \
+    Single(Context, In, Out);                                             \
+    In += 16;                                                             \
+    Out += 16;                                                            \
+  }                                                                       \
+}
+
+AESNI_BLOCKS(AesNiCipherBlocks128, EncKey,
+             _mm_aesenc_si128, _mm_aesenclast_si128, AesNiCipher, 10)
+AESNI_BLOCKS(AesNiCipherBlocks192, EncKey,
+             _mm_aesenc_si128, _mm_aesenclast_si128, AesNiCipher, 12)
+AESNI_BLOCKS(AesNiCipherBlocks256, EncKey,
+             _mm_aesenc_si128, _mm_aesenclast_si128, AesNiCipher, 14)
+AESNI_BLOCKS(AesNiInvCipherBlocks128, DecKey,
+             _mm_aesdec_si128, _mm_aesdeclast_si128, AesNiInvCipher, 10)
+AESNI_BLOCKS(AesNiInvCipherBlocks192, DecKey,
+             _mm_aesdec_si128, _mm_aesdeclast_si128, AesNiInvCipher, 12)
+AESNI_BLOCKS(AesNiInvCipherBlocks256, DecKey,
+             _mm_aesdec_si128, _mm_aesdeclast_si128, AesNiInvCipher, 14)
+
+/**
+ * Expand a key - see section 5.2 of FIPS 197.
+ *
+ * This follows the word-by-word KeyExpansion of the reference code, but uses
+ * AESKEYGENASSIST to perform SubWord and RotWord.  Words are held in the
+ * little-endian order used by the AES-NI instructions, so the schedules can be
+ * loaded directly as round keys.  The block functions unrolled for the key
+ * size are selected here, so the size is not checked again for each call.
+ *
+ * @param Nk        Size of the key in words - must be 4, 6 or 8.
+ * @param Key       Key to expand
+ * @param Context   Where to store the expanded key
+ */
+STATIC
+VOID
+EFIAPI
+AESNI_TARGET
+AesNiInitContext(IN  UINTN CONST  Nk,
+                 IN  UINT8 CONST  Key[static 4*Nk],
+                 OUT AES_CONTEXT *Context) {
+  STATIC UINT8 CONST RConBytes[] = {
+    0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36
+  };
+  UINT32 *W = Context->EncKey;
+  UINT32 *Dk = Context->DecKey;
+  __m128i Assist;
+  UINT32  Temp;
+  UINTN   Nr;
+  UINTN   Round;
+  UINTN   i;
+
+  Nr = Nk + 6;
+
+  for(i = 0; i < Nk; i++) {
+    W[i] = (Key[4*i+0] <<  0) | (Key[4*i+1] <<  8) |
+           (Key[4*i+2] << 16) | (Key[4*i+3] << 24);
+  }
+  for(; i < 4 * (Nr+1); i++) {
+    Temp = W[i-1];
+    if(i % Nk == 0 || (Nk > 6 && i % Nk == 4)) {
+      // Word 1 of the result is RotWord(SubWord(Temp)), word 0 is SubWord(Temp)
+      Assist = _mm_aeskeygenassist_si128(_mm_shuffle_epi32(
+                                           _mm_cvtsi32_si128((INT32)Temp),
+                                           0x00),
+                                         0);
+      if(i % Nk == 0)
+        Temp = (UINT32)_mm_cvtsi128_si32(_mm_shuffle_epi32(Assist, 0x55)) ^
+               RConBytes[i/Nk - 1];
+      else
+        Temp = (UINT32)_mm_cvtsi128_si32(Assist);
+    }
+    W[i] = W[i - Nk] ^ Temp;
+  }
+
+  // Equivalent inverse cipher - see section 5.3.5 of FIPS 197
+  PutRoundKey(Dk, 0, GetRoundKey(W, Nr));
+  for(Round = 1; Round < Nr; Round++)
+    PutRoundKey(Dk, Round, _mm_aesimc_si128(GetRoundKey(W, Nr - Round)));
+  PutRoundKey(Dk, Nr, GetRoundKey(W, 0));
+
+  Context->Rounds = Nr;
+
+  switch(Nr) {
+  case 10:
+    Context->CipherBlocks = AesNiCipherBlocks128;
+    Context->InvCipherBlocks = AesNiInvCipherBlocks128;
+    break;
+  case 12:
+    Context->CipherBlocks = AesNiCipherBlocks192;
+    Context->InvCipherBlocks = AesNiInvCipherBlocks192;
+    break;
+  default:
+    Context->CipherBlocks = AesNiCipherBlocks256;
+    Context->InvCipherBlocks = AesNiInvCipherBlocks256;
+    break;
+  }
+}
+
+/**
+ * Engine definition for the AES-NI implementation.
+ */
+AES_ENGINE CONST gAesNiEngine = {
+  AesNiInitContext,
+  AesNiCipher,
+  AesNiInvCipher,
+  NULL,                 // Selected by AesNiInitContext
+  NULL
+};
@@ -0,0 +1,486 @@
+/**
+ * Copyright (c) 2015, baskingshark
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * This is an implementation of the AES algorithm described in FIPS 197 using
+ * the SSSE3 PSHUFB (byte shuffle) instruction, for processors which lack
+ * AES-NI.  PSHUFB performs 16 parallel lookups into a 16 entry table, so any
+ * function of a nibble can be computed in one instruction without memory
+ * accesses indexed by secret data.
+ *
+ * SubBytes is computed in the style of Hamburg's "vector permute" AES, by
+ * representing GF(2^8) as GF(2^4)[t]/(t^2 + ct + c), where GF(2^4) uses the
+ * polynomial x^4 + x + 1 and c = 2.  A byte maps linearly to a pair of
+ * nibbles (i, k) representing it + k, whose inverse is
+ *
+ *   (it + (ci + k)) / N    where N = ci^2 + cik + k^2
+ *
+ * With j = i + k, it can be shown that
+ *
+ *   io = 1/(1/i + c/k) + j = N / (ci + k)
+ *   jo = 1/(1/j + c/k) + i = N / (cj + k)
+ *
+ * so both coordinates of the inverse are linear in 1/io and 1/jo.  The
+ * lookups of 1/io and 1/jo are folded into the output tables, along with the
+ * conversion back to the AES basis and (for encryption) the S-box affine
+ * transformation.  1/0 is represented as 0x80, which PSHUFB maps to zero, so
+ * the special cases come out without branches.
+ *
+ * ShiftRows and the rotations needed by MixColumns are also single PSHUFBs.
+ *
+ * The key schedules are those generated by the reference code (with the
+ * equivalent inverse cipher schedule for decryption - see section 5.3.5 of
+ * FIPS 197), with each word stored in byte order so that round keys can be
+ * loaded directly.  The S-box constant 0x63 passes through ShiftRows and
+ * MixColumns unchanged, so it is added to the encryption round keys rather
+ * than in every round.
+ */
+#include <Uefi.h>
+#include <Library/Aes.h>
+#include <Library/BaseLib.h>
+#include <tmmintrin.h>
+#include <emmintrin.h>
+#include "AesEngine.h"
+#include "AesGeneric.h"
+
+/**
+ * The rest of the firmware may be built without SSE, so the functions using
+ * the intrinsics have to enable the instructions individually.
+ */
+#if defined(__GNUC__)
+#define SSSE3_TARGET __attribute__((target("ssse3")))
+#else
+#define SSSE3_TARGET
+#endif
+
+/**
+ * CPUID.01H:ECX.SSSE3[bit 9] and CPUID.01H:EDX.SSE2[bit 26]
+ */
+#define CPUID_ECX_SSSE3   BIT9
+#define CPUID_EDX_SSE2    BIT26
+
+/**
+ * CR4.OSFXSR[bit 9] - SSE instructions are enabled.
+ */
+#define CR4_OSFXSR        BIT9
+
+/**
+ * Number of blocks processed together by Ssse3CipherBlocks and
+ * Ssse3InvCipherBlocks, to give the processor independent work while each
+ * S-box lookup completes.
+ */
+#define SSSE3_INTERLEAVE  4
+
+/**
+ * Inversion and division of c by an element of GF(2^4), with 1/0 = 0x80.
+ */
+STATIC
+UINT8
+CONST
+Inverse[16] = {
+  0x80, 0x01, 0x09, 0x0e, 0x0d, 0x0b, 0x07, 0x06,
+  0x0f, 0x02, 0x0c, 0x05, 0x0a, 0x04, 0x03, 0x08
+};
+
+STATIC
+UINT8
+CONST
+DivideC[16] = {
+  0x80, 0x02, 0x01, 0x0f, 0x09, 0x05, 0x0e, 0x0c,
+  0x0d, 0x04, 0x0b, 0x0a, 0x07, 0x08, 0x06, 0x03
+};
+
+/**
+ * Tables used by SubBytes, for the forward and inverse S-box.
+ *
+ * The input tables map the low and high nibbles of a byte to the tower field
+ * representation (with i in the high nibble), and the output tables map io
+ * and jo back to the AES basis.
+ */
+typedef struct {
+  UINT8 InLo[16];
+  UINT8 InHi[16];
+  UINT8 OutIo[16];
+  UINT8 OutJo[16];
+} SBOX_TABLES;
+
+STATIC
+SBOX_TABLES
+CONST
+SBox = {
+  {
+    0x00, 0x01, 0x1c, 0x1d, 0x2d, 0x2c, 0x31, 0x30,
+    0x27, 0x26, 0x3b, 0x3a, 0x0a, 0x0b, 0x16, 0x17
+  },
+  {
+    0x00, 0x86, 0xfd, 0x7b, 0x8e, 0x08, 0x73, 0xf5,
+    0x77, 0xf1, 0x8a, 0x0c, 0xf9, 0x7f, 0x04, 0x82
+  },
+  {
+    0x00, 0xcb, 0xd7, 0xb0, 0x21, 0x8d, 0x67, 0xac,
+    0x7b, 0x5a, 0xea, 0x3d, 0x46, 0xf6, 0x91, 0x1c
+  },
+  {
+    0x00, 0x9f, 0x61, 0x16, 0xc2, 0x2a, 0x77, 0xe8,
+    0x89, 0x4b, 0x5d, 0x3c, 0xb5, 0xa3, 0xd4, 0xfe
+  }
+};
+
+/**
+ * The inverse S-box has the inverse of the affine transformation (including
+ * its constant) folded into the input tables.
+ */
+STATIC
+SBOX_TABLES
+CONST
+InvSBox = {
+  {
+    0x2c, 0x99, 0xf0, 0x45, 0xf7, 0x42, 0x2b, 0x9e,
+    0x38, 0x8d, 0xe4, 0x51, 0xe3, 0x56, 0x3f, 0x8a
+  },
+  {
+    0x00, 0xa7, 0xa8, 0x0f, 0xed, 0x4a, 0x45, 0xe2,
+    0xd1, 0x76, 0x79, 0xde, 0x3c, 0x9b, 0x94, 0x33
+  },
+  {
+    0x00, 0x3b, 0xe4, 0xc8, 0x03, 0x14, 0x2c, 0x17,
+    0xf3, 0xf0, 0x38, 0xdc, 0x2f, 0xe7, 0xcb, 0xdf
+  },
+  {
+    0x00, 0x24, 0x91, 0x19, 0x23, 0x8f, 0x88, 0xac,
+    0x3d, 0x1e, 0x07, 0x96, 0xab, 0xb2, 0x3a, 0xb5
+  }
+};
+
+/**
+ * PSHUFB masks for ShiftRows, InvShiftRows and rotation of the bytes within
+ * each column.  The state is held in the same (column-major) order as the
+ * input block.
+ */
+STATIC
+UINT8
+CONST
+ShiftRowsMask[16] = {
+  0x00, 0x05, 0x0a, 0x0f, 0x04, 0x09, 0x0e, 0x03,
+  0x08, 0x0d, 0x02, 0x07, 0x0c, 0x01, 0x06, 0x0b
+};
+
+STATIC
+UINT8
+CONST
+InvShiftRowsMask[16] = {
+  0x00, 0x0d, 0x0a, 0x07, 0x04, 0x01, 0x0e, 0x0b,
+  0x08, 0x05, 0x02, 0x0f, 0x0c, 0x09, 0x06, 0x03
+};
+
+STATIC
+UINT8
+CONST
+Rotate1Mask[16] = {
+  0x01, 0x02, 0x03, 0x00, 0x05, 0x06, 0x07, 0x04,
+  0x09, 0x0a, 0x0b, 0x08, 0x0d, 0x0e, 0x0f, 0x0c
+};
+
+STATIC
+UINT8
+CONST
+Rotate2Mask[16] = {
+  0x02, 0x03, 0x00, 0x01, 0x06, 0x07, 0x04, 0x05,
+  0x0a, 0x0b, 0x08, 0x09, 0x0e, 0x0f, 0x0c, 0x0d
+};
+
+/**
+ * Load a 16-byte constant or block.
+ */
+#define Load(p)   _mm_loadu_si128((__m128i CONST*)(p))
+
+/**
+ * Check whether the SSSE3 engine can be used.
+ *
+ * @return A BOOLEAN indicating whether the processor supports SSSE3 and SSE
+ *         has been enabled.
+ */
+BOOLEAN
+EFIAPI
+AesSsse3Supported(VOID)
+{
+  UINT32 RegEcx;
+  UINT32 RegEdx;
+
+  AsmCpuid(1, NULL, NULL, &RegEcx, &RegEdx);
+  if(!(RegEcx & CPUID_ECX_SSSE3) || !(RegEdx & CPUID_EDX_SSE2))
+    return FALSE;
+  // X64 firmware always runs with SSE enabled, but IA32 firmware might not.
+  return (AsmReadCr4() & CR4_OSFXSR) != 0;
+}
+
+/**
+ * Substitute every byte of the state.
+ *
+ * @param S       The state
+ * @param Tables  SBox or InvSBox
+ *
+ * @return The substituted state
+ */
+STATIC
+__m128i
+EFIAPI
+SSSE3_TARGET
+SubBytes(IN __m128i             S,
+         IN SBOX_TABLES CONST *Tables) {
+  __m128i Mask = _mm_set1_epi8(0x0f);
+  __m128i Inv = Load(Inverse);
+  __m128i I, J, K, Ak, Iak, Jak, Io, Jo;
+
+  // Change to the tower field representation
+  S = _mm_xor_si128(
+        _mm_shuffle_epi8(Load(Tables->InLo), _mm_and_si128(S, Mask)),
+        _mm_shuffle_epi8(Load(Tables->InHi),
+                         _mm_and_si128(_mm_srli_epi16(S, 4), Mask)));
+  I = _mm_and_si128(_mm_srli_epi16(S, 4), Mask);
+  K = _mm_and_si128(S, Mask);
+  J = _mm_xor_si128(I, K);
+
+  // Invert
+  Ak = _mm_shuffle_epi8(Load(DivideC), K);
+  Iak = _mm_xor_si128(_mm_shuffle_epi8(Inv, I), Ak);
+  Jak = _mm_xor_si128(_mm_shuffle_epi8(Inv, J), Ak);
+  Io = _mm_xor_si128(_mm_shuffle_epi8(Inv, Iak), J);
+  Jo = _mm_xor_si128(_mm_shuffle_epi8(Inv, Jak), I);
+
+  // Change back to the AES basis
+  return _mm_xor_si128(_mm_shuffle_epi8(Load(Tables->OutIo), Io),
+                       _mm_shuffle_epi8(Load(Tables->OutJo), Jo));
+}
+
+/**
+ * Multiply every byte by x ({02}) - see section 4.2.1 of FIPS 197.
+ */
+STATIC
+__m128i
+EFIAPI
+SSSE3_TARGET
+XTime(IN __m128i X) {
+  __m128i High = _mm_cmplt_epi8(X, _mm_setzero_si128());
+  return _mm_xor_si128(_mm_add_epi8(X, X),
+                       _mm_and_si128(High, _mm_set1_epi8(0x1b)));
+}
+
+/**
+ * MixColumns transformation - see section 5.1.3 of FIPS 197.
+ *
+ * s'(r,c) = {02}•(s(r,c)+s(r+1,c)) + s(r+1,c) + s(r+2,c) + s(r+3,c)
+ */
+STATIC
+__m128i
+EFIAPI
+SSSE3_TARGET
+MixColumns(IN __m128i S) {
+  __m128i Rot1 = _mm_shuffle_epi8(S, Load(Rotate1Mask));
+  __m128i T = _mm_xor_si128(S, Rot1);
+
+  return _mm_xor_si128(_mm_xor_si128(XTime(T), Rot1),
+                       _mm_shuffle_epi8(T, Load(Rotate2Mask)));
+}
+
+/**
+ * InvMixColumns transformation - see section 5.3.3 of FIPS 197.
+ *
+ * Multiply each column by {04}x^2 + {05}, then apply MixColumns.
+ */
+STATIC
+__m128i
+EFIAPI
+SSSE3_TARGET
+InvMixColumns(IN __m128i S) {
+  __m128i U = XTime(XTime(_mm_xor_si128(S,
+                                        _mm_shuffle_epi8(S,
+                                                         Load(Rotate2Mask)))));
+  return MixColumns(_mm_xor_si128(S, U));
+}
+
+/**
+ * Expand a key - see section 5.2 of FIPS 197.
+ *
+ * @param Nk        Size of the key in words - must be 4, 6 or 8.
+ * @param Key       Key to expand
+ * @param Context   Where to store the expanded key
+ */
+STATIC
+VOID
+EFIAPI
+Ssse3InitContext(IN  UINTN CONST  Nk,
+                 IN  UINT8 CONST  Key[static 4*Nk],
+                 OUT AES_CONTEXT *Context) {
+  UINTN Idx;
+
+  InitContext(Nk, Key, Context);
+  for(Idx = 0; Idx < 4 * (Context->Rounds + 1); Idx++) {
+    Context->EncKey[Idx] = SwapBytes32(Context->EncKey[Idx]);
+    Context->DecKey[Idx] = SwapBytes32(Context->DecKey[Idx]);
+    // Add the S-box constant to every round key but the first
+    if(Idx >= 4)
+      Context->EncKey[Idx] ^= 0x63636363;
+  }
+}
+
+/**
+ * Encrypt any number of blocks, SSSE3_INTERLEAVE at a time.
+ *
+ * @param Context   Expanded key, as initialised by Ssse3InitContext
+ * @param Blocks    Number of blocks to encrypt
+ * @param In        Data to encrypt
+ * @param Out       Where to store the encrypted data (may be the same as In)
+ */
+STATIC
+VOID
+EFIAPI
+SSSE3_TARGET
+Ssse3CipherBlocks(IN  AES_CONTEXT CONST *Context,
+                  IN  UINTN              Blocks,
+                  IN  UINT8       CONST *In,
+                  OUT UINT8             *Out) {
+  UINT32 CONST *W = Context->EncKey;
+  __m128i       State[SSSE3_INTERLEAVE];
+  __m128i       RoundKey;
+  UINTN         Count;
+  UINTN         Round;
+  UINTN         Idx;
+
+  while(Blocks > 0) {
+    Count = MIN(Blocks, SSSE3_INTERLEAVE);
+    for(Idx = 0; Idx < Count; Idx++)
+      State[Idx] = _mm_xor_si128(Load(In + 16*Idx), Load(W));
+    for(Round = 1; Round <= Context->Rounds; Round++) {
+      // ShiftRows and SubBytes commute, so shift first
+      for(Idx = 0; Idx < Count; Idx++)
+        State[Idx] = _mm_shuffle_epi8(State[Idx], Load(ShiftRowsMask));
+      RoundKey = Load(W + 4*Round);
+      for(Idx = 0; Idx < Count; Idx++) {
+        State[Idx] = SubBytes(State[Idx], &SBox);
+        if(Round < Context->Rounds)
+          State[Idx] = MixColumns(State[Idx]);
+        State[Idx] = _mm_xor_si128(State[Idx], RoundKey);
+      }
+    }
+    for(Idx = 0; Idx < Count; Idx++)
+      _mm_storeu_si128((__m128i*)(Out + 16*Idx), State[Idx]);
+    Blocks -= Count;
+    In += 16 * Count;
+    Out += 16 * Count;
+  }
+}
+
+/**
+ * Decrypt any number of blocks, SSSE3_INTERLEAVE at a time, using the
+ * Equivalent Inverse Cipher - see section 5.3.5 of FIPS 197.
+ *
+ * @param Context   Expanded key, as initialised by Ssse3InitContext
+ * @param Blocks    Number of blocks to decrypt
+ * @param In        Data to decrypt
+ * @param Out       Where to store the decrypted data (may be the same as In)
+ */
+STATIC
+VOID
+EFIAPI
+SSSE3_TARGET
+Ssse3InvCipherBlocks(IN  AES_CONTEXT CONST *Context,
+                     IN  UINTN              Blocks,
+                     IN  UINT8       CONST *In,
+                     OUT UINT8             *Out) {
+  UINT32 CONST *Dk = Context->DecKey;
+  __m128i       State[SSSE3_INTERLEAVE];
+  __m128i       RoundKey;
+  UINTN         Count;
+  UINTN         Round;
+  UINTN         Idx;
+
+  while(Blocks > 0) {
+    Count = MIN(Blocks, SSSE3_INTERLEAVE);
+    for(Idx = 0; Idx < Count; Idx++)
+      State[Idx] = _mm_xor_si128(Load(In + 16*Idx), Load(Dk));
+    for(Round = 1; Round <= Context->Rounds; Round++) {
+      for(Idx = 0; Idx < Count; Idx++)
+        State[Idx] = _mm_shuffle_epi8(State[Idx], Load(InvShiftRowsMask));
+      RoundKey = Load(Dk + 4*Round);
+      for(Idx = 0; Idx < Count; Idx++) {
+        State[Idx] = SubBytes(State[Idx], &InvSBox);
+        if(Round < Context->Rounds)
+          State[Idx] = InvMixColumns(State[Idx]);
+        State[Idx] = _mm_xor_si128(State[Idx], RoundKey);
+      }
+    }
+    for(Idx = 0; Idx < Count; Idx++)
+      _mm_storeu_si128((__m128i*)(Out + 16*Idx), State[Idx]);
+    Blocks -= Count;
+    In += 16 * Count;
+    Out += 16 * Count;
+  }
+}
+
+/**
+ * Encrypt a single block.
+ *
+ * @param Context   Expanded key, as initialised by Ssse3InitContext
+ * @param In        Data to encrypt (16 bytes)
+ * @param Out       Where to store the encrypted data
+ */
+STATIC
+VOID
+EFIAPI
+Ssse3Cipher(IN  AES_CONTEXT CONST *Context,
+            IN  UINT8       CONST  In[16],
+            OUT UINT8              Out[16]) {
+  Ssse3CipherBlocks(Context, 1, In, Out);
+}
+
+/**
+ * Decrypt a single block.
+ *
+ * @param Context   Expanded key, as initialised by Ssse3InitContext
+ * @param In        Data to decrypt (16 bytes)
+ * @param Out       Where to store the decrypted data
+ */
+STATIC
+VOID
+EFIAPI
+Ssse3InvCipher(IN  AES_CONTEXT CONST *Context,
+               IN  UINT8       CONST  In[16],
+               OUT UINT8              Out[16]) {
+  Ssse3InvCipherBlocks(Context, 1, In, Out);
+}
+
+/**
+ * Engine definition for the SSSE3 implementation.
+ */
+AES_ENGINE CONST gAesSsse3Engine = {
+  Ssse3InitContext,
+  Ssse3Cipher,
+  Ssse3InvCipher,
+  Ssse3CipherBlocks,
+  Ssse3InvCipherBlocks
+};
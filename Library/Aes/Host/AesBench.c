@@ -0,0 +1,281 @@
+/**
+ * Copyright (c) 2015, baskingshark
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Host benchmark for AesLib.
+ *
+ * Runs the block and XTS operations of the public API with each engine that
+ * the processor supports and reports the throughput in MB/s and in cycles per
+ * byte.  Cycles are measured with the time stamp counter, so on processors
+ * whose core clock differs from the TSC frequency they are reference cycles.
+ *
+ * Usage: AesBench [-t seconds] [engine ...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <Uefi.h>
+#include <Library/Aes.h>
+#include "../AesEngine.h"
+
+#if defined(MDE_CPU_IA32) || defined(MDE_CPU_X64)
+#include <x86intrin.h>
+#define HAVE_CYCLES 1
+#else
+#define HAVE_CYCLES 0
+#endif
+
+EFI_STATUS
+EFIAPI
+AesLibConstructor(IN EFI_HANDLE        ImageHandle,
+                  IN EFI_SYSTEM_TABLE *SystemTable);
+
+/**
+ * Largest buffer used by any of the operations.
+ */
+#define MAX_SIZE  (1024 * 1024)
+
+/**
+ * An engine which can be benchmarked, and how to tell whether the processor
+ * supports it (NULL if it always can be used).
+ */
+typedef struct _BENCH_ENGINE {
+  CONST CHAR8       *Name;
+  AES_ENGINE CONST  *Engine;
+  BOOLEAN           (EFIAPI *Supported)(VOID);
+} BENCH_ENGINE;
+
+STATIC BENCH_ENGINE CONST Engines[] = {
+  { "generic",   &gAesGenericEngine,   NULL },
+  { "table",     &gAesTableEngine,     NULL },
+  { "bitsliced", &gAesBitslicedEngine, NULL },
+#if defined(MDE_CPU_IA32) || defined(MDE_CPU_X64)
+  { "ssse3",     &gAesSsse3Engine,     AesSsse3Supported },
+  { "aesni",     &gAesNiEngine,        AesNiSupported },
+#endif
+};
+
+/**
+ * The operations measured for each engine.
+ */
+typedef enum {
+  OpBlock,
+  OpBlocks,
+  OpXts
+} BENCH_OP;
+
+typedef struct _BENCH_CASE {
+  CONST CHAR8 *Name;
+  BENCH_OP     Op;
+  UINTN        KeySize;
+  BOOLEAN      Encrypt;
+  UINTN        Size;
+} BENCH_CASE;
+
+STATIC BENCH_CASE CONST Cases[] = {
+  { "AES-128 block",      OpBlock,  128, TRUE,  16 },
+  { "AES-128 block dec",  OpBlock,  128, FALSE, 16 },
+  { "AES-128 blocks",     OpBlocks, 128, TRUE,  4096 },
+  { "AES-128 blocks dec", OpBlocks, 128, FALSE, 4096 },
+  { "AES-256 block",      OpBlock,  256, TRUE,  16 },
+  { "AES-256 block dec",  OpBlock,  256, FALSE, 16 },
+  { "AES-256 blocks",     OpBlocks, 256, TRUE,  4096 },
+  { "AES-256 blocks dec", OpBlocks, 256, FALSE, 4096 },
+  { "XTS-AES-128",        OpXts,    256, TRUE,  512 },
+  { "XTS-AES-128",        OpXts,    256, TRUE,  4096 },
+  { "XTS-AES-128",        OpXts,    256, TRUE,  65536 },
+  { "XTS-AES-128",        OpXts,    256, TRUE,  MAX_SIZE },
+  { "XTS-AES-128 dec",    OpXts,    256, FALSE, 512 },
+  { "XTS-AES-128 dec",    OpXts,    256, FALSE, 4096 },
+  { "XTS-AES-128 dec",    OpXts,    256, FALSE, 65536 },
+  { "XTS-AES-128 dec",    OpXts,    256, FALSE, MAX_SIZE },
+  { "XTS-AES-256",        OpXts,    512, TRUE,  512 },
+  { "XTS-AES-256",        OpXts,    512, TRUE,  4096 },
+  { "XTS-AES-256",        OpXts,    512, TRUE,  65536 },
+  { "XTS-AES-256",        OpXts,    512, TRUE,  MAX_SIZE },
+  { "XTS-AES-256 dec",    OpXts,    512, FALSE, 512 },
+  { "XTS-AES-256 dec",    OpXts,    512, FALSE, 4096 },
+  { "XTS-AES-256 dec",    OpXts,    512, FALSE, 65536 },
+  { "XTS-AES-256 dec",    OpXts,    512, FALSE, MAX_SIZE },
+};
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/**
+ * Monotonic time in seconds.
+ */
+STATIC
+double
+Now(VOID) {
+  struct timespec Time;
+
+  clock_gettime(CLOCK_MONOTONIC, &Time);
+  return Time.tv_sec + Time.tv_nsec * 1e-9;
+}
+
+/**
+ * Time stamp counter, or zero if there is none.
+ */
+STATIC
+UINT64
+Cycles(VOID) {
+#if HAVE_CYCLES
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+/**
+ * Run one operation once.
+ *
+ * @param Case      Operation to perform
+ * @param Context   Expanded key for the block operations
+ * @param Key       Key for XTS
+ * @param Buffer    Data, encrypted or decrypted in place
+ */
+STATIC
+VOID
+RunCase(IN     BENCH_CASE  CONST *Case,
+        IN     AES_CONTEXT CONST *Context,
+        IN     UINT8       CONST *Key,
+        IN OUT UINT8             *Buffer) {
+  STATIC UINT8 CONST IV[16] = { 0 };
+  UINTN              Idx;
+
+  switch(Case->Op) {
+  case OpBlock:
+    // The same block repeatedly, so each call depends on the last
+    for(Idx = 0; Idx < 256; Idx++) {
+      if(Case->Encrypt)
+        AesCipherBlock(Context, Buffer, Buffer);
+      else
+        InvAesCipherBlock(Context, Buffer, Buffer);
+    }
+    break;
+  case OpBlocks:
+    if(Case->Encrypt)
+      AesCipherBlocks(Context, Case->Size / 16, Buffer, Buffer);
+    else
+      InvAesCipherBlocks(Context, Case->Size / 16, Buffer, Buffer);
+    break;
+  case OpXts:
+    if(Case->Encrypt)
+      XtsAesCipher(Case->KeySize, Key, IV, Case->Size, Buffer, Buffer);
+    else
+      InvXtsAesCipher(Case->KeySize, Key, IV, Case->Size, Buffer, Buffer);
+    break;
+  }
+}
+
+int
+main(int argc, char **argv) {
+  STATIC UINT8 Key[64];
+  UINT8       *Buffer;
+  AES_CONTEXT  Context;
+  double       MinTime = 0.25;
+  double       Start;
+  double       Elapsed;
+  UINT64       StartCycles;
+  UINT64       TotalCycles;
+  UINT64       Bytes;
+  UINTN        Iterations;
+  UINTN        Idx;
+  UINTN        Eng;
+  UINTN        CaseIdx;
+  int          Arg = 1;
+  int          Selected;
+
+  if(argc > 2 && !strcmp(argv[1], "-t")) {
+    MinTime = atof(argv[2]);
+    Arg = 3;
+  }
+
+  Buffer = malloc(MAX_SIZE);
+  if(!Buffer)
+    return 1;
+  for(Idx = 0; Idx < sizeof(Key); Idx++)
+    Key[Idx] = (UINT8)(Idx * 0x1d + 0x63);
+  for(Idx = 0; Idx < MAX_SIZE; Idx++)
+    Buffer[Idx] = (UINT8)Idx;
+
+  // Check the engines as the firmware would
+  AesLibConstructor(NULL, NULL);
+
+  printf("%-10s %-20s %8s %12s %10s\n",
+         "engine", "operation", "bytes", "cycles/byte", "MB/s");
+  for(Eng = 0; Eng < ARRAY_SIZE(Engines); Eng++) {
+    if(Arg < argc) {
+      for(Selected = Arg; Selected < argc; Selected++)
+        if(!strcmp(argv[Selected], Engines[Eng].Name))
+          break;
+      if(Selected == argc)
+        continue;
+    }
+    if(Engines[Eng].Supported && !Engines[Eng].Supported()) {
+      printf("%-10s not supported by this processor\n", Engines[Eng].Name);
+      continue;
+    }
+    AesSetEngine(Engines[Eng].Engine);
+
+    for(CaseIdx = 0; CaseIdx < ARRAY_SIZE(Cases); CaseIdx++) {
+      BENCH_CASE CONST *Case = &Cases[CaseIdx];
+      UINTN             CaseBytes;
+
+      CaseBytes = Case->Op == OpBlock ? 256 * 16 : Case->Size;
+      if(Case->Op != OpXts)
+        AesInitContext(Case->KeySize, Key, &Context);
+
+      // Warm up the caches and the branch predictors
+      RunCase(Case, &Context, Key, Buffer);
+
+      Iterations = 0;
+      Start = Now();
+      StartCycles = Cycles();
+      do {
+        RunCase(Case, &Context, Key, Buffer);
+        Iterations++;
+        Elapsed = Now() - Start;
+      } while(Elapsed < MinTime);
+      TotalCycles = Cycles() - StartCycles;
+      Bytes = (UINT64)Iterations * CaseBytes;
+
+      printf("%-10s %-20s %8lu ", Engines[Eng].Name, Case->Name,
+             (unsigned long)Case->Size);
+      if(HAVE_CYCLES)
+        printf("%12.2f", (double)TotalCycles / Bytes);
+      else
+        printf("%12s", "-");
+      printf(" %10.1f\n", Bytes / Elapsed / 1e6);
+    }
+  }
+
+  free(Buffer);
+  return 0;
+}
@@ -0,0 +1,542 @@
+/**
+ * Copyright (c) 2015, baskingshark
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Host differential test for the XTS-AES functions of AesLib.
+ *
+ * Each engine the processor supports is run through the XTS-AES functions of
+ * the public API with random keys, tweaks and data, and the results are
+ * compared with a simple block at a time implementation of IEEE P1619 built
+ * on the generic engine.  The sizes run from 16 bytes to 1 MiB and include
+ * every ciphertext stealing remainder, and the data is processed out of place,
+ * in place (aligned and unaligned), through the stream functions in random
+ * pieces, from a random block with each GF(2^128) multiply, and as data
+ * units.  The throughput of XtsAesCipher and InvXtsAesCipher with each engine
+ * is reported at the end.
+ *
+ * Usage: AesCheck [-n cases] [-s seed] [engine ...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <Uefi.h>
+#include <Library/Aes.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include "../AesEngine.h"
+
+EFI_STATUS
+EFIAPI
+AesLibConstructor(IN EFI_HANDLE        ImageHandle,
+                  IN EFI_SYSTEM_TABLE *SystemTable);
+
+/**
+ * Largest size of data checked.
+ */
+#define MAX_SIZE  (1024 * 1024)
+
+/**
+ * An engine which can be checked, and how to tell whether the processor
+ * supports it (NULL if it always can be used).
+ */
+typedef struct _CHECK_ENGINE {
+  CONST CHAR8       *Name;
+  AES_ENGINE CONST  *Engine;
+  BOOLEAN           (EFIAPI *Supported)(VOID);
+} CHECK_ENGINE;
+
+STATIC CHECK_ENGINE CONST Engines[] = {
+  { "generic",   &gAesGenericEngine,   NULL },
+  { "table",     &gAesTableEngine,     NULL },
+  { "bitsliced", &gAesBitslicedEngine, NULL },
+#if defined(MDE_CPU_IA32) || defined(MDE_CPU_X64)
+  { "ssse3",     &gAesSsse3Engine,     AesSsse3Supported },
+  { "aesni",     &gAesNiEngine,        AesNiSupported },
+#endif
+};
+
+/**
+ * The GF(2^128) multiplies used to move to an arbitrary block, and how to
+ * tell whether the processor supports them.
+ */
+typedef struct _CHECK_GF_MUL {
+  CONST CHAR8 *Name;
+  XTS_GF_MUL   GfMul;
+  BOOLEAN      (EFIAPI *Supported)(VOID);
+} CHECK_GF_MUL;
+
+STATIC CHECK_GF_MUL CONST GfMuls[] = {
+  { "blocks at (portable)", NULL,         NULL },
+#if defined(MDE_CPU_IA32) || defined(MDE_CPU_X64)
+  { "blocks at (pclmul)",   XtsPclmulMul, XtsPclmulSupported },
+#endif
+};
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/**
+ * Results for each engine.
+ */
+typedef struct _CHECK_RESULT {
+  BOOLEAN Selected;
+  UINTN   Cases;
+  UINTN   Failures;
+  UINT64  Bytes;
+  double  Time;
+} CHECK_RESULT;
+
+/**
+ * State of the xorshift64* generator used for the keys, tweaks, data and
+ * sizes, so that a failing run can be repeated with the same seed.
+ */
+STATIC UINT64 RandomState = 1;
+
+STATIC
+UINT64
+Random(VOID) {
+  RandomState ^= RandomState >> 12;
+  RandomState ^= RandomState << 25;
+  RandomState ^= RandomState >> 27;
+  return RandomState * 0x2545f4914f6cdd1dULL;
+}
+
+STATIC
+VOID
+RandomBytes(IN  UINTN  Size,
+            OUT UINT8 *Buffer) {
+  while(Size--)
+    *Buffer++ = (UINT8)(Random() >> 56);
+}
+
+/**
+ * Monotonic time in seconds.
+ */
+STATIC
+double
+Now(VOID) {
+  struct timespec Time;
+
+  clock_gettime(CLOCK_MONOTONIC, &Time);
+  return Time.tv_sec + Time.tv_nsec * 1e-9;
+}
+
+/**
+ * Multiply a tweak by x, a byte at a time as in IEEE P1619.
+ *
+ * @param T     The tweak, in little-endian format
+ */
+STATIC
+VOID
+RefDouble(IN OUT UINT8 T[16]) {
+  UINT8 Carry;
+  UINT8 Next;
+  UINTN Idx;
+
+  Carry = 0;
+  for(Idx = 0; Idx < 16; Idx++) {
+    Next = T[Idx] >> 7;
+    T[Idx] = (UINT8)((T[Idx] << 1) | Carry);
+    Carry = Next;
+  }
+  if(Carry)
+    T[0] ^= 0x87;
+}
+
+/**
+ * Encrypt or decrypt one block with the tweak T, using the generic engine.
+ */
+STATIC
+VOID
+RefBlock(IN  AES_CONTEXT CONST *DataKey,
+         IN  BOOLEAN            Encrypt,
+         IN  UINT8       CONST  T[16],
+         IN  UINT8       CONST  In[16],
+         OUT UINT8              Out[16]) {
+  UINT8 Block[16];
+  UINTN Idx;
+
+  for(Idx = 0; Idx < 16; Idx++)
+    Block[Idx] = In[Idx] ^ T[Idx];
+  if(Encrypt)
+    gAesGenericEngine.Cipher(DataKey, Block, Block);
+  else
+    gAesGenericEngine.InvCipher(DataKey, Block, Block);
+  for(Idx = 0; Idx < 16; Idx++)
+    Out[Idx] = Block[Idx] ^ T[Idx];
+}
+
+/**
+ * Reference XTS-AES, one block at a time with the generic engine, written
+ * directly from IEEE P1619 and independent of XtsAes.c.
+ *
+ * @param KeySize   Size of the key in bits - 256 or 512
+ * @param Key       Data key followed by tweak key
+ * @param IV        Tweak IV
+ * @param Encrypt   TRUE to encrypt, FALSE to decrypt
+ * @param Size      Size of the data - at least 16 bytes
+ * @param Src       Data to process
+ * @param Dest      Where to store the result (must not overlap Src)
+ */
+STATIC
+VOID
+RefXts(IN  UINTN         KeySize,
+       IN  UINT8 CONST  *Key,
+       IN  UINT8 CONST   IV[16],
+       IN  BOOLEAN       Encrypt,
+       IN  UINTN         Size,
+       IN  UINT8 CONST  *Src,
+       OUT UINT8        *Dest) {
+  AES_CONTEXT DataKey;
+  AES_CONTEXT TweakKey;
+  UINT8       T[16];
+  UINT8       NextT[16];
+  UINT8       Block[16];
+  UINTN       PartSize;
+  UINTN       Blocks;
+  UINTN       Idx;
+
+  gAesGenericEngine.InitContext(KeySize / 64, Key, &DataKey);
+  gAesGenericEngine.InitContext(KeySize / 64, Key + KeySize / 16, &TweakKey);
+  gAesGenericEngine.Cipher(&TweakKey, IV, T);
+
+  PartSize = Size % 16;
+  Blocks = Size / 16;
+  // With a partial final block, the last full block is handled below
+  for(Idx = 0; Idx < Blocks - (PartSize ? 1 : 0); Idx++) {
+    RefBlock(&DataKey, Encrypt, T, Src + 16 * Idx, Dest + 16 * Idx);
+    RefDouble(T);
+  }
+  if(!PartSize)
+    return;
+
+  Src += 16 * Idx;
+  Dest += 16 * Idx;
+  CopyMem(NextT, T, 16);
+  RefDouble(NextT);
+  if(Encrypt) {
+    // CC = E(P[m-1]); C[m] = first part of CC; C[m-1] = E(P[m] | rest of CC)
+    RefBlock(&DataKey, TRUE, T, Src, Block);
+    CopyMem(Dest + 16, Block, PartSize);
+    CopyMem(Block, Src + 16, PartSize);
+    RefBlock(&DataKey, TRUE, NextT, Block, Dest);
+  }
+  else {
+    // PP = D(C[m-1]); P[m] = first part of PP; P[m-1] = D(C[m] | rest of PP)
+    RefBlock(&DataKey, FALSE, NextT, Src, Block);
+    CopyMem(Dest + 16, Block, PartSize);
+    CopyMem(Block, Src + 16, PartSize);
+    RefBlock(&DataKey, FALSE, T, Block, Dest);
+  }
+}
+
+/**
+ * Pick the size of a case.  The first 16 cases are short and the next 16 a
+ * few KiB, covering every remainder modulo 16 (and so every ciphertext
+ * stealing length) at both sizes.  The last case is MAX_SIZE.  The rest are
+ * spread evenly on a log scale from 16 bytes to MAX_SIZE.
+ */
+STATIC
+UINTN
+CaseSize(IN UINTN Case,
+         IN UINTN Cases) {
+  UINTN Size;
+
+  if(Case < 16)
+    return 16 * (1 + Random() % 4) + Case;
+  if(Case < 32)
+    return 16 * (1 + Random() % 256) + Case - 16;
+  if(Case == Cases - 1)
+    return MAX_SIZE;
+  Size = 16 + Random() % ((UINT64)16 << (Random() % 17));
+  return MIN(MAX_SIZE, Size);
+}
+
+/**
+ * Report a mismatch.
+ */
+STATIC
+UINTN
+Mismatch(IN CHECK_ENGINE CONST *Engine,
+         IN CONST CHAR8        *What,
+         IN UINTN               KeySize,
+         IN UINTN               Size) {
+  printf("%-10s XTS-AES-%lu %-22s %8lu bytes: mismatch\n", Engine->Name,
+         (unsigned long)KeySize / 2, What, (unsigned long)Size);
+  return 1;
+}
+
+/**
+ * Check one case with the current engine.
+ *
+ * @param Engine    The engine being checked
+ * @param Result    Results for the engine, updated with this case
+ * @param KeySize   Size of the key in bits
+ * @param Key       The key
+ * @param IV        The tweak IV
+ * @param Size      Size of the data
+ * @param Plain     The plaintext
+ * @param Cipher    The reference ciphertext
+ * @param Work      Buffer of at least MAX_SIZE + 32 bytes, 16-byte aligned
+ */
+STATIC
+VOID
+CheckCase(IN     CHECK_ENGINE CONST *Engine,
+          IN OUT CHECK_RESULT       *Result,
+          IN     UINTN               KeySize,
+          IN     UINT8        CONST *Key,
+          IN     UINT8        CONST  IV[16],
+          IN     UINTN               Size,
+          IN     UINT8        CONST *Plain,
+          IN     UINT8        CONST *Cipher,
+          IN     UINT8              *Work) {
+  XTS_AES_CONTEXT Context;
+  XTS_AES_STREAM  Stream;
+  UINT8          *Unaligned;
+  UINT8           UnitIV[16];
+  UINT8           Unit[4096];
+  UINT8           Far[ARRAY_SIZE(GfMuls)][16];
+  UINT64          FarIndex;
+  UINTN           Blocks;
+  UINTN           First;
+  UINTN           Count;
+  UINTN           UnitSize;
+  UINTN           Done;
+  UINTN           Out;
+  UINTN           Piece;
+  UINTN           Processed;
+  UINTN           Idx;
+  BOOLEAN         Encrypt;
+  double          Start;
+
+  Result->Cases++;
+
+  // Out of place, timed for the throughput figures
+  Start = Now();
+  XtsAesCipher(KeySize, Key, IV, Size, Plain, Work);
+  Result->Time += Now() - Start;
+  if(memcmp(Work, Cipher, Size))
+    Result->Failures += Mismatch(Engine, "encrypt", KeySize, Size);
+  Start = Now();
+  InvXtsAesCipher(KeySize, Key, IV, Size, Cipher, Work);
+  Result->Time += Now() - Start;
+  if(memcmp(Work, Plain, Size))
+    Result->Failures += Mismatch(Engine, "decrypt", KeySize, Size);
+  Result->Bytes += 2 * Size;
+
+  // In place, both aligned and not
+  Unaligned = Work + 1 + Random() % 15;
+  CopyMem(Work, Plain, Size);
+  XtsAesCipher(KeySize, Key, IV, Size, Work, Work);
+  if(memcmp(Work, Cipher, Size))
+    Result->Failures += Mismatch(Engine, "encrypt in place", KeySize, Size);
+  InvXtsAesCipher(KeySize, Key, IV, Size, Work, Work);
+  if(memcmp(Work, Plain, Size))
+    Result->Failures += Mismatch(Engine, "decrypt in place", KeySize, Size);
+  CopyMem(Unaligned, Cipher, Size);
+  InvXtsAesCipher(KeySize, Key, IV, Size, Unaligned, Unaligned);
+  if(memcmp(Unaligned, Plain, Size))
+    Result->Failures += Mismatch(Engine, "decrypt unaligned", KeySize, Size);
+  XtsAesCipher(KeySize, Key, IV, Size, Unaligned, Unaligned);
+  if(memcmp(Unaligned, Cipher, Size))
+    Result->Failures += Mismatch(Engine, "encrypt unaligned", KeySize, Size);
+
+  // Through the stream functions in random pieces, in place, alternating
+  // between encryption and decryption
+  XtsAesInitContext(KeySize, Key, &Context);
+  Encrypt = Result->Cases & 1;
+  CopyMem(Work, Encrypt ? Plain : Cipher, Size);
+  XtsAesStreamInit(&Stream, &Context, IV, Encrypt);
+  Out = 0;
+  for(Done = 0; Done < Size; Done += Piece) {
+    // MIN evaluates its arguments more than once
+    Piece = 1 + Random() % (Random() & 1 ? 64 : 65536);
+    Piece = MIN(Size - Done, Piece);
+    XtsAesStreamUpdate(&Stream, Piece, Work + Done, Work + Out, &Processed);
+    Out += Processed;
+  }
+  if(EFI_ERROR(XtsAesStreamFinal(&Stream, Work + Out, &Processed)) ||
+     Out + Processed != Size ||
+     memcmp(Work, Encrypt ? Cipher : Plain, Size))
+    Result->Failures += Mismatch(Engine,
+                                 Encrypt ? "stream encrypt" : "stream decrypt",
+                                 KeySize, Size);
+
+  // A random range of the blocks not involved in ciphertext stealing, with
+  // each GF(2^128) multiply.  The constructor's choice is the last one
+  // supported, so it is left selected at the end.
+  Blocks = Size % 16 ? Size / 16 - 1 : Size / 16;
+  if(Blocks > 0) {
+    First = Random() % Blocks;
+    Count = 1 + Random() % (Blocks - First);
+    FarIndex = Random();
+    for(Idx = 0; Idx < ARRAY_SIZE(GfMuls); Idx++) {
+      if(GfMuls[Idx].Supported && !GfMuls[Idx].Supported())
+        continue;
+      XtsAesSetGfMul(GfMuls[Idx].GfMul);
+      InvXtsAesCipherBlocksAt(&Context, IV, First, 16 * Count,
+                              Cipher + 16 * First, Work);
+      if(memcmp(Work, Plain + 16 * First, 16 * Count))
+        Result->Failures += Mismatch(Engine, GfMuls[Idx].Name, KeySize, Size);
+      // Far beyond any real data unit, where the reference would take too
+      // long, so the multiplies are only compared with each other
+      XtsAesCipherBlocksAt(&Context, IV, FarIndex, 16, Plain, Far[Idx]);
+      if(memcmp(Far[Idx], Far[0], 16))
+        Result->Failures += Mismatch(Engine, "blocks at far index",
+                                     KeySize, Size);
+    }
+  }
+  ZeroMem(&Context, sizeof(Context));
+
+  // As data units numbered from the IV, when the size allows
+  UnitSize = Size % 4096 ? 512 : 4096;
+  if(Size % UnitSize)
+    return;
+  XtsAesCipherDataUnits(KeySize, Key, ReadUnaligned64((UINT64 CONST*)IV),
+                        UnitSize, Size, Plain, Work);
+  CopyMem(UnitIV, IV, 16);
+  ZeroMem(UnitIV + 8, 8);
+  for(Idx = 0; Idx < Size; Idx += UnitSize) {
+    RefXts(KeySize, Key, UnitIV, TRUE, UnitSize, Plain + Idx, Unit);
+    if(memcmp(Work + Idx, Unit, UnitSize)) {
+      Result->Failures += Mismatch(Engine, "data units", KeySize, Size);
+      break;
+    }
+    // The data unit number is a 128-bit little-endian value
+    for(Done = 0; Done < 16 && ++UnitIV[Done] == 0; Done++)
+      ;
+  }
+}
+
+int
+main(int argc, char **argv) {
+  STATIC UINT8 Key[64];
+  STATIC UINT8 IV[16];
+  STATIC UINT8 CONST KatKey[32] = {
+    0xff, 0xfe, 0xfd, 0xfc, 0xfb, 0xfa, 0xf9, 0xf8,
+    0xf7, 0xf6, 0xf5, 0xf4, 0xf3, 0xf2, 0xf1, 0xf0,
+    0xbf, 0xbe, 0xbd, 0xbc, 0xbb, 0xba, 0xb9, 0xb8,
+    0xb7, 0xb6, 0xb5, 0xb4, 0xb3, 0xb2, 0xb1, 0xb0
+  };
+  STATIC UINT8 CONST KatIV[16] = { 0x9a, 0x78, 0x56, 0x34, 0x12 };
+  STATIC UINT8 CONST KatCipher[17] = {
+    0x6c, 0x16, 0x25, 0xdb, 0x46, 0x71, 0x52, 0x2d,
+    0x3d, 0x75, 0x99, 0x60, 0x1d, 0xe7, 0xca, 0x09,
+    0xed
+  };
+  CHECK_RESULT  Results[ARRAY_SIZE(Engines)];
+  UINT8        *Plain;
+  UINT8        *Cipher;
+  UINT8        *Work;
+  UINTN         Cases = 200;
+  UINTN         Case;
+  UINTN         Eng;
+  UINTN         KeySize;
+  UINTN         Size;
+  UINTN         Failures;
+  int           Arg = 1;
+  int           Selected;
+
+  while(Arg + 1 < argc && argv[Arg][0] == '-') {
+    if(!strcmp(argv[Arg], "-n"))
+      Cases = MAX(strtoul(argv[Arg + 1], NULL, 0), 1);
+    else if(!strcmp(argv[Arg], "-s"))
+      RandomState = strtoull(argv[Arg + 1], NULL, 0) | 1;
+    else
+      break;
+    Arg += 2;
+  }
+
+  Plain = malloc(MAX_SIZE);
+  Cipher = malloc(MAX_SIZE);
+  Work = aligned_alloc(16, MAX_SIZE + 32);
+  if(!Plain || !Cipher || !Work)
+    return 1;
+
+  // Check the reference itself against IEEE P1619 vector 15, which has a
+  // partial final block
+  for(Size = 0; Size < 17; Size++)
+    Plain[Size] = (UINT8)Size;
+  RefXts(256, KatKey, KatIV, TRUE, 17, Plain, Cipher);
+  RefXts(256, KatKey, KatIV, FALSE, 17, Cipher, Work);
+  if(memcmp(Cipher, KatCipher, 17) || memcmp(Work, Plain, 17)) {
+    printf("Reference implementation fails IEEE P1619 vector 15\n");
+    return 1;
+  }
+
+  AesLibConstructor(NULL, NULL);
+
+  memset(Results, 0, sizeof(Results));
+  for(Eng = 0; Eng < ARRAY_SIZE(Engines); Eng++) {
+    if(Arg < argc) {
+      for(Selected = Arg; Selected < argc; Selected++)
+        if(!strcmp(argv[Selected], Engines[Eng].Name))
+          break;
+      if(Selected == argc)
+        continue;
+    }
+    if(Engines[Eng].Supported && !Engines[Eng].Supported()) {
+      printf("%-10s not supported by this processor\n", Engines[Eng].Name);
+      continue;
+    }
+    Results[Eng].Selected = TRUE;
+  }
+
+  for(Case = 0; Case < Cases; Case++) {
+    KeySize = Random() & 1 ? 512 : 256;
+    Size = CaseSize(Case, Cases);
+    RandomBytes(sizeof(Key), Key);
+    RandomBytes(sizeof(IV), IV);
+    RandomBytes(Size, Plain);
+    RefXts(KeySize, Key, IV, TRUE, Size, Plain, Cipher);
+    for(Eng = 0; Eng < ARRAY_SIZE(Engines); Eng++) {
+      if(!Results[Eng].Selected)
+        continue;
+      AesSetEngine(Engines[Eng].Engine);
+      CheckCase(&Engines[Eng], &Results[Eng], KeySize, Key, IV, Size,
+                Plain, Cipher, Work);
+    }
+  }
+
+  Failures = 0;
+  printf("%-10s %8s %8s %10s\n", "engine", "cases", "failures", "MB/s");
+  for(Eng = 0; Eng < ARRAY_SIZE(Engines); Eng++) {
+    if(!Results[Eng].Selected)
+      continue;
+    printf("%-10s %8lu %8lu %10.1f\n", Engines[Eng].Name,
+           (unsigned long)Results[Eng].Cases,
+           (unsigned long)Results[Eng].Failures,
+           Results[Eng].Bytes / Results[Eng].Time / 1e6);
+    Failures += Results[Eng].Failures;
+  }
+
+  free(Plain);
+  free(Cipher);
+  free(Work);
+  return Failures ? 1 : 0;
+}
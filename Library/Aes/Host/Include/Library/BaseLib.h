@@ -0,0 +1,129 @@
+/**
+ * Copyright (c) 2015, baskingshark
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Host replacement for the parts of the EDK2 BaseLib used by AesLib.
+ */
+#ifndef __BASE_LIB__
+#define __BASE_LIB__
+
+#include <Uefi.h>
+
+#if defined(MDE_CPU_IA32) || defined(MDE_CPU_X64)
+#include <cpuid.h>
+
+static inline
+UINT32
+AsmCpuid(IN  UINT32  Index,
+         OUT UINT32 *Eax OPTIONAL,
+         OUT UINT32 *Ebx OPTIONAL,
+         OUT UINT32 *Ecx OPTIONAL,
+         OUT UINT32 *Edx OPTIONAL) {
+  unsigned int A, B, C, D;
+
+  __cpuid_count(Index, 0, A, B, C, D);
+  if(Eax)
+    *Eax = A;
+  if(Ebx)
+    *Ebx = B;
+  if(Ecx)
+    *Ecx = C;
+  if(Edx)
+    *Edx = D;
+
+  return Index;
+}
+
+/**
+ * CR4 cannot be read from user mode, but a hosted OS always enables SSE, so
+ * report CR4.OSFXSR as set.
+ */
+static inline
+UINTN
+AsmReadCr4(VOID) {
+  return BIT9;
+}
+#endif
+
+static inline
+UINT32
+SwapBytes32(IN UINT32 Value) {
+  return __builtin_bswap32(Value);
+}
+
+static inline
+UINT16
+ReadUnaligned16(IN UINT16 CONST *Buffer) {
+  UINT16 Value;
+
+  __builtin_memcpy(&Value, Buffer, sizeof(Value));
+  return Value;
+}
+
+static inline
+UINT16
+WriteUnaligned16(OUT UINT16 *Buffer,
+                 IN  UINT16  Value) {
+  __builtin_memcpy(Buffer, &Value, sizeof(Value));
+  return Value;
+}
+
+static inline
+UINT32
+ReadUnaligned32(IN UINT32 CONST *Buffer) {
+  UINT32 Value;
+
+  __builtin_memcpy(&Value, Buffer, sizeof(Value));
+  return Value;
+}
+
+static inline
+UINT32
+WriteUnaligned32(OUT UINT32 *Buffer,
+                 IN  UINT32  Value) {
+  __builtin_memcpy(Buffer, &Value, sizeof(Value));
+  return Value;
+}
+
+static inline
+UINT64
+ReadUnaligned64(IN UINT64 CONST *Buffer) {
+  UINT64 Value;
+
+  __builtin_memcpy(&Value, Buffer, sizeof(Value));
+  return Value;
+}
+
+static inline
+UINT64
+WriteUnaligned64(OUT UINT64 *Buffer,
+                 IN  UINT64  Value) {
+  __builtin_memcpy(Buffer, &Value, sizeof(Value));
+  return Value;
+}
+
+#endif
@@ -0,0 +1,132 @@
+/**
+ * Copyright (c) 2015, baskingshark
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Minimal replacement for the EDK2 Uefi.h, providing just enough of the base
+ * types and status codes to build AesLib as an ordinary host library, and the
+ * plist filter and password check of FVNetworkUnlock for their host checks.
+ */
+#ifndef __UEFI_H__
+#define __UEFI_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint8_t   UINT8;
+typedef uint16_t  UINT16;
+typedef uint32_t  UINT32;
+typedef uint64_t  UINT64;
+typedef int8_t    INT8;
+typedef int16_t   INT16;
+typedef int32_t   INT32;
+typedef int64_t   INT64;
+typedef uintptr_t UINTN;
+typedef intptr_t  INTN;
+typedef UINT8     BOOLEAN;
+typedef char      CHAR8;
+typedef UINT16    CHAR16;
+typedef void      VOID;
+
+typedef struct {
+  UINT32 Data1;
+  UINT16 Data2;
+  UINT16 Data3;
+  UINT8  Data4[8];
+} EFI_GUID;
+
+typedef UINTN     EFI_STATUS;
+typedef VOID     *EFI_HANDLE;
+typedef struct _EFI_SYSTEM_TABLE EFI_SYSTEM_TABLE;
+
+#define IN
+#define OUT
+#define OPTIONAL
+#define CONST     const
+#define STATIC    static
+#define EFIAPI
+
+#define TRUE      ((BOOLEAN)1)
+#define FALSE     ((BOOLEAN)0)
+
+#if defined(__x86_64__)
+#define MDE_CPU_X64
+#elif defined(__i386__)
+#define MDE_CPU_IA32
+#endif
+
+#define BIT0      0x00000001
+#define BIT1      0x00000002
+#define BIT2      0x00000004
+#define BIT3      0x00000008
+#define BIT4      0x00000010
+#define BIT5      0x00000020
+#define BIT6      0x00000040
+#define BIT7      0x00000080
+#define BIT8      0x00000100
+#define BIT9      0x00000200
+#define BIT10     0x00000400
+#define BIT11     0x00000800
+#define BIT12     0x00001000
+#define BIT13     0x00002000
+#define BIT14     0x00004000
+#define BIT15     0x00008000
+#define BIT16     0x00010000
+#define BIT17     0x00020000
+#define BIT18     0x00040000
+#define BIT19     0x00080000
+#define BIT20     0x00100000
+#define BIT21     0x00200000
+#define BIT22     0x00400000
+#define BIT23     0x00800000
+#define BIT24     0x01000000
+#define BIT25     0x02000000
+#define BIT26     0x04000000
+#define BIT27     0x08000000
+#define BIT28     0x10000000
+#define BIT29     0x20000000
+#define BIT30     0x40000000
+#define BIT31     0x80000000
+
+#define MIN(a, b)               (((a) < (b)) ? (a) : (b))
+#define MAX(a, b)               (((a) > (b)) ? (a) : (b))
+
+#define MAX_UINT32              ((UINT32)0xFFFFFFFF)
+#define MAX_BIT                 ((UINTN)1 << (sizeof(UINTN) * 8 - 1))
+#define ENCODE_ERROR(Code)      (MAX_BIT | (Code))
+#define EFI_ERROR(Status)       (((INTN)(EFI_STATUS)(Status)) < 0)
+
+#define EFI_SUCCESS             0
+#define EFI_INVALID_PARAMETER   ENCODE_ERROR(2)
+#define EFI_UNSUPPORTED         ENCODE_ERROR(3)
+#define EFI_BUFFER_TOO_SMALL    ENCODE_ERROR(5)
+#define EFI_NOT_READY           ENCODE_ERROR(6)
+#define EFI_OUT_OF_RESOURCES    ENCODE_ERROR(9)
+#define EFI_NOT_FOUND           ENCODE_ERROR(14)
+#define EFI_SECURITY_VIOLATION  ENCODE_ERROR(26)
+#define EFI_END_OF_FILE         ENCODE_ERROR(31)
+
+#endif
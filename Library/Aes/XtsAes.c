@@ -26,14 +26,95 @@
  */
 
 #include <Uefi.h>
+#include <Library/Aes.h>
+#include <Library/BaseLib.h>
 #include <Library/BaseMemoryLib.h>
-#include "AesGeneric.h"
+#include "AesEngine.h"
 
 /**
- * Multiply an element of GF(2^128) by x.
+ * Number of blocks passed to the AES engine at once.  The tweaks for a batch
+ * are all known up front, so engines which work on several blocks in
+ * parallel can be kept busy.  This must be no more than 8, the largest power
+ * of x GfMulPower handles.
+ */
+#define XTS_BATCH_BLOCKS  8
+
+/**
+ * The tweak arithmetic and XORs work on whole words rather than bytes.  On
+ * IA32 32-bit words are used, as each 64-bit shift would otherwise take
+ * several instructions (or a helper call with some compilers).  All UEFI
+ * platforms are little-endian, so the words of a block are also the
+ * little-endian words of the GF(2^128) element.
+ */
+#if defined(MDE_CPU_IA32)
+typedef UINT32 XTS_WORD;
+typedef INT32  XTS_SIGNED_WORD;
+#define ReadWord(p)       ReadUnaligned32((UINT32 CONST*)(p))
+#define WriteWord(p, v)   WriteUnaligned32((UINT32*)(p), (v))
+#else
+typedef UINT64 XTS_WORD;
+typedef INT64  XTS_SIGNED_WORD;
+#define ReadWord(p)       ReadUnaligned64((UINT64 CONST*)(p))
+#define WriteWord(p, v)   WriteUnaligned64((UINT64*)(p), (v))
+#endif
+
+#define XTS_WORDS         (16 / sizeof(XTS_WORD))
+#define XTS_WORD_BITS     (8 * sizeof(XTS_WORD))
+
+/**
+ * Multiply an element of GF(2^128), held as words, by x.
+ *
+ * The reduction is applied with a mask made from the top bit by an arithmetic
+ * shift, rather than a branch on it, so the time taken does not depend on the
+ * tweak.
+ *
+ * @param T     The element to multiply, least significant word first.
+ */
+STATIC
+VOID
+EFIAPI
+GfDouble(IN OUT XTS_WORD T[XTS_WORDS])
+{
+  XTS_WORD Carry;
+  UINTN    Idx;
+
+  Carry = (XTS_WORD)((XTS_SIGNED_WORD)T[XTS_WORDS - 1] >> (XTS_WORD_BITS - 1));
+  for(Idx = XTS_WORDS - 1; Idx > 0; Idx--)
+    T[Idx] = (T[Idx] << 1) | (T[Idx - 1] >> (XTS_WORD_BITS - 1));
+  T[0] = (T[0] << 1) ^ (Carry & 0x87);
+}
+
+/**
+ * Multiply an element of GF(2^128), held as words, by x^Power.
+ *
+ * Rather than doubling Power times, the element is shifted left by Power bits
+ * in one go and the Power bits shifted out of the top are reduced by carry-less
+ * multiplication by the polynomial's low terms (x^7 + x^2 + x + 1).  Each
+ * power of a tweak can then be calculated independently of the others.
  *
- * Note: this implementation works byte-by-byte so is not the most efficient
- * method.
+ * @param Src     The element to multiply, least significant word first.
+ * @param Power   The power of x to multiply by - must be between 1 and 8.
+ * @param Dest    Where to store the result.  This must not be Src.
+ */
+STATIC
+VOID
+EFIAPI
+GfMulPower(IN  XTS_WORD CONST Src[XTS_WORDS],
+           IN  UINTN          Power,
+           OUT XTS_WORD       Dest[XTS_WORDS])
+{
+  XTS_WORD Carry;
+  UINTN    Idx;
+
+  Carry = Src[XTS_WORDS - 1] >> (XTS_WORD_BITS - Power);
+  for(Idx = XTS_WORDS - 1; Idx > 0; Idx--)
+    Dest[Idx] = (Src[Idx] << Power) | (Src[Idx - 1] >> (XTS_WORD_BITS - Power));
+  Dest[0] = (Src[0] << Power) ^
+            Carry ^ (Carry << 1) ^ (Carry << 2) ^ (Carry << 7);
+}
+
+/**
+ * Multiply an element of GF(2^128) by x.
  *
  * @param Src   Location of the element of GF(2^128), in little-endian format.
  * @param Dest  Where to store the result of multiplaction by x.  This can be
@@ -45,19 +126,121 @@ EFIAPI
 GfMul128(IN  UINT8 CONST Src[static 16],
          OUT UINT8       Dest[static 16])
 {
-  UINTN Carry = Src[15] >> 7;
-  UINTN Idx;
-  for(Idx = 15; Idx > 0; --Idx) {
-    Dest[Idx] = (Src[Idx] << 1) | (Src[Idx-1] >> 7);
+  XTS_WORD T[XTS_WORDS];
+  UINTN    Idx;
+
+  for(Idx = 0; Idx < XTS_WORDS; Idx++)
+    T[Idx] = ReadWord(Src + Idx * sizeof(XTS_WORD));
+  GfDouble(T);
+  for(Idx = 0; Idx < XTS_WORDS; Idx++)
+    WriteWord(Dest + Idx * sizeof(XTS_WORD), T[Idx]);
+}
+
+/**
+ * Multiply two elements of GF(2^128) without any special instructions.
+ *
+ * This is the shift-and-add method, with the add masked rather than skipped
+ * for each bit of B, so the time taken does not depend on either element.
+ *
+ * @param A     The first element, in little-endian format.
+ * @param B     The second element, in little-endian format.
+ * @param Out   Where to store the product.  This can be the same location as
+ *              A or B.
+ */
+STATIC
+VOID
+EFIAPI
+GfMulPortable(IN  UINT8 CONST A[16],
+              IN  UINT8 CONST B[16],
+              OUT UINT8       Out[16])
+{
+  XTS_WORD V[XTS_WORDS];
+  XTS_WORD W[XTS_WORDS];
+  XTS_WORD Product[XTS_WORDS];
+  XTS_WORD Mask;
+  UINTN    Bit;
+  UINTN    Idx;
+
+  for(Idx = 0; Idx < XTS_WORDS; Idx++) {
+    V[Idx] = ReadWord(A + Idx * sizeof(XTS_WORD));
+    W[Idx] = ReadWord(B + Idx * sizeof(XTS_WORD));
+    Product[Idx] = 0;
   }
-  Dest[0] = (Src[0] << 1) ^ (Carry * 0x87);
+  for(Bit = 0; Bit < 128; Bit++) {
+    Mask = 0 - ((W[Bit / XTS_WORD_BITS] >> (Bit % XTS_WORD_BITS)) & 1);
+    for(Idx = 0; Idx < XTS_WORDS; Idx++)
+      Product[Idx] ^= V[Idx] & Mask;
+    GfDouble(V);
+  }
+  for(Idx = 0; Idx < XTS_WORDS; Idx++)
+    WriteWord(Out + Idx * sizeof(XTS_WORD), Product[Idx]);
 }
 
 /**
- * XOR two AES-sized (16 byte) blocks and store the results.
+ * The GF(2^128) multiply used by GfMulAlphaPower.  AesLibConstructor replaces
+ * this with XtsPclmulMul if the processor supports it.
+ */
+STATIC
+XTS_GF_MUL
+GfMul = GfMulPortable;
+
+/**
+ * Select the GF(2^128) multiply used by GfMulAlphaPower.
+ *
+ * @param NewGfMul    The multiply to use, or NULL for the portable one
+ */
+VOID
+EFIAPI
+XtsAesSetGfMul(IN XTS_GF_MUL NewGfMul)
+{
+  GfMul = NewGfMul ? NewGfMul : GfMulPortable;
+}
+
+/**
+ * Multiply an element of GF(2^128) by x^Power, for any Power.
  *
- * Note: this implementation works byte-by-byte so is not the most efficient
- * method.
+ * This gives the tweak for block Power of a data unit directly from the tweak
+ * for block 0.  x^Power is found by square-and-multiply over the bits of
+ * Power, where the multiplies by x are just doublings, so it takes at most 64
+ * squarings and one more multiply to apply it.  Power is a block number and
+ * not secret, so it is fine to branch on its bits.
+ *
+ * @param Src     Location of the element of GF(2^128), in little-endian
+ *                format.
+ * @param Power   The power of x to multiply by.
+ * @param Dest    Where to store the result.  This can be the same location
+ *                as Src.
+ */
+STATIC
+VOID
+EFIAPI
+GfMulAlphaPower(IN  UINT8 CONST Src[static 16],
+                IN  UINT64      Power,
+                OUT UINT8       Dest[static 16])
+{
+  UINT8 X[16];
+  INTN  Bit;
+
+  if(0 == Power) {
+    CopyMem(Dest, Src, 16);
+    return;
+  }
+
+  // Start from x for the top bit of Power, and work down through the rest
+  ZeroMem(X, sizeof(X));
+  X[0] = 2;
+  for(Bit = 62; Bit >= 0 && !(Power >> (Bit + 1)); Bit--)
+    ;
+  for(; Bit >= 0; Bit--) {
+    GfMul(X, X, X);
+    if((Power >> Bit) & 1)
+      GfMul128(X, X);
+  }
+  GfMul(Src, X, Dest);
+}
+
+/**
+ * XOR two AES-sized (16 byte) blocks and store the results.
  *
  * @param Dest  Where to store the result of the XOR.  This can be the same as
  *              either Src1 or Src2.
@@ -72,8 +255,367 @@ XorBlock(IN  UINT8 CONST Src1[16],
          OUT UINT8       Dest[16])
 {
   UINTN Idx;
-  for(Idx = 0; Idx < 16; Idx++)
-    (Dest)[Idx] = (Src1)[Idx] ^ (Src2)[Idx];
+  for(Idx = 0; Idx < XTS_WORDS; Idx++)
+    WriteWord(Dest + Idx * sizeof(XTS_WORD),
+              ReadWord(Src1 + Idx * sizeof(XTS_WORD)) ^
+              ReadWord(Src2 + Idx * sizeof(XTS_WORD)));
+}
+
+/**
+ * Encrypt or decrypt whole blocks in batches of XTS_BATCH_BLOCKS.
+ *
+ * The tweak is kept in words for the whole of the data, and the tweaks and
+ * intermediate blocks of each batch are word arrays, so only the data itself
+ * needs unaligned accesses.  When the data is processed in place and happens
+ * to be 16-byte aligned, the tweaks are XORed into the data directly with
+ * aligned accesses and the AES engine works on it in place, so no intermediate
+ * copy is made.  Out-of-place or unaligned data takes the copying path.
+ *
+ * @param DataKey   Expanded data key.
+ * @param Encrypt   TRUE to encrypt the data, FALSE to decrypt it.
+ * @param Tweak     The tweak for the first block.  On return, this is updated
+ *                  to the tweak for the block following the data.
+ * @param Size      Size of the data - must be a multiple of 16 bytes.
+ * @param Src       Pointer to the data.
+ * @param Dest      Pointer to the location to store the result (this may be
+ *                  the same as Src).
+ */
+STATIC
+VOID
+EFIAPI
+XtsBlocks(IN     AES_CONTEXT CONST *DataKey,
+          IN     BOOLEAN            Encrypt,
+          IN OUT UINT8              Tweak[16],
+          IN     UINTN              Size,
+          IN     UINT8       CONST *Src,
+          OUT    UINT8             *Dest)
+{
+  XTS_WORD  T[XTS_WORDS];
+  XTS_WORD  Tweaks[XTS_BATCH_BLOCKS + 1][XTS_WORDS];
+  XTS_WORD  Buffer[XTS_BATCH_BLOCKS][XTS_WORDS];
+  XTS_WORD *Data;
+  BOOLEAN   InPlace;
+  UINTN     Blocks;
+  UINTN     Idx;
+  UINTN     Word;
+
+  for(Word = 0; Word < XTS_WORDS; Word++)
+    T[Word] = ReadWord(Tweak + Word * sizeof(XTS_WORD));
+  InPlace = Src == Dest && 0 == ((UINTN)Dest & 15);
+
+  while(Size > 0) {
+    Blocks = MIN(Size / 16, XTS_BATCH_BLOCKS);
+    // The tweaks of the batch are T.x^0 .. T.x^(Blocks-1), each of which is
+    // calculated from T directly rather than from the tweak before it
+    CopyMem(Tweaks[0], T, sizeof(T));
+    for(Idx = 1; Idx < Blocks; Idx++)
+      GfMulPower(T, Idx, Tweaks[Idx]);
+    GfMulPower(T, Blocks, Tweaks[XTS_BATCH_BLOCKS]);
+    CopyMem(T, Tweaks[XTS_BATCH_BLOCKS], sizeof(T));
+    if(InPlace) {
+      // The tweaks of the batch are contiguous, as are the blocks, so both
+      // can be treated as a single run of words
+      Data = (XTS_WORD*)Dest;
+      for(Word = 0; Word < Blocks * XTS_WORDS; Word++)
+        Data[Word] ^= ((XTS_WORD*)Tweaks)[Word];
+      if(Encrypt)
+        AesCipherBlocks(DataKey, Blocks, Dest, Dest);
+      else
+        InvAesCipherBlocks(DataKey, Blocks, Dest, Dest);
+      for(Word = 0; Word < Blocks * XTS_WORDS; Word++)
+        Data[Word] ^= ((XTS_WORD*)Tweaks)[Word];
+    }
+    else {
+      for(Idx = 0; Idx < Blocks; Idx++)
+        for(Word = 0; Word < XTS_WORDS; Word++)
+          Buffer[Idx][Word] = ReadWord(Src + 16*Idx + Word*sizeof(XTS_WORD)) ^
+                              Tweaks[Idx][Word];
+      if(Encrypt)
+        AesCipherBlocks(DataKey, Blocks, (UINT8*)Buffer, (UINT8*)Buffer);
+      else
+        InvAesCipherBlocks(DataKey, Blocks, (UINT8*)Buffer, (UINT8*)Buffer);
+      for(Idx = 0; Idx < Blocks; Idx++)
+        for(Word = 0; Word < XTS_WORDS; Word++)
+          WriteWord(Dest + 16*Idx + Word*sizeof(XTS_WORD),
+                    Buffer[Idx][Word] ^ Tweaks[Idx][Word]);
+    }
+    Size -= 16 * Blocks;
+    Src += 16 * Blocks;
+    Dest += 16 * Blocks;
+  }
+
+  for(Word = 0; Word < XTS_WORDS; Word++)
+    WriteWord(Tweak + Word * sizeof(XTS_WORD), T[Word]);
+}
+
+/**
+ * Encrypt the final partial block with ciphertext stealing.
+ *
+ * @param DataKey         Expanded data key.
+ * @param Tweak           The tweak for the final partial block.
+ * @param PartBlockSize   Size of the final partial block (1 to 15 bytes).
+ * @param Src             Pointer to the final partial block of plaintext.
+ * @param Dest            Pointer to the already encrypted final full block,
+ *                        which is followed by room for the partial block.
+ */
+STATIC
+VOID
+EFIAPI
+XtsStealEncrypt(IN     AES_CONTEXT CONST *DataKey,
+                IN     UINT8       CONST  Tweak[16],
+                IN     UINTN              PartBlockSize,
+                IN     UINT8       CONST *Src,
+                IN OUT UINT8             *Dest)
+{
+  UINT8 Buffer[16];
+
+  // Reamining plaintext
+  CopyMem(Buffer, Src, PartBlockSize);
+  // Move final block into place
+  CopyMem(Dest + 16, Dest, PartBlockSize);
+  // Stolen ciphertext
+  CopyMem(Buffer + PartBlockSize, Dest + PartBlockSize, 16 - PartBlockSize);
+  // Encrypt penultimate block
+  XorBlock(Buffer, Tweak, Buffer);
+  AesCipherBlock(DataKey, Buffer, Buffer);
+  XorBlock(Buffer, Tweak, Dest);
+  ZeroMem(Buffer, sizeof(Buffer));
+}
+
+/**
+ * Decrypt the final full and partial blocks with ciphertext stealing.
+ *
+ * @param DataKey         Expanded data key.
+ * @param Tweak           The tweak for the final full block.
+ * @param PartBlockSize   Size of the final partial block (1 to 15 bytes).
+ * @param Src             Pointer to the final full block of ciphertext, which
+ *                        is followed by the partial block.
+ * @param Dest            Where to store the 16 + PartBlockSize bytes of
+ *                        plaintext (this may be the same as Src).
+ */
+STATIC
+VOID
+EFIAPI
+XtsStealDecrypt(IN  AES_CONTEXT CONST *DataKey,
+                IN  UINT8       CONST  Tweak[16],
+                IN  UINTN              PartBlockSize,
+                IN  UINT8       CONST *Src,
+                OUT UINT8             *Dest)
+{
+  UINT8 Buffer[16];
+  UINT8 Tweak2[16];
+
+  // With partial final block, penultimate block uses next tweak
+  GfMul128(Tweak, Tweak2);
+  XorBlock(Src, Tweak2, Buffer);
+  InvAesCipherBlock(DataKey, Buffer, Buffer);
+  XorBlock(Buffer, Tweak2, Buffer);
+  // Reamining ciphertext, followed by stolen ciphertext
+  CopyMem(Tweak2, Src + 16, PartBlockSize);
+  CopyMem(Tweak2 + PartBlockSize, Buffer + PartBlockSize, 16 - PartBlockSize);
+  // Move final block into place
+  CopyMem(Dest + 16, Buffer, PartBlockSize);
+  // Decrypt penultimate block
+  XorBlock(Tweak2, Tweak, Buffer);
+  InvAesCipherBlock(DataKey, Buffer, Buffer);
+  XorBlock(Buffer, Tweak, Dest);
+  ZeroMem(Buffer, sizeof(Buffer));
+}
+
+/**
+ * Expand an XTS-AES key for use with XtsAesCipherUnit, InvXtsAesCipherUnit
+ * and XtsAesStreamInit.
+ *
+ * @param KeySize   Size of the key in bits - must be 256 or 512.
+ * @param Key       Pointer to the key - the first half is used to encrypt the
+ *                  data, while the second half is used to encrypt the initial
+ *                  tweak.
+ * @param Context   Where to store the expanded key.
+ *
+ * @retval  EFI_SUCCESS             The key was expanded.
+ * @retval  EFI_INVALID_PARAMETER   One or more of the parameters were invalid.
+ */
+EFI_STATUS
+EFIAPI
+XtsAesInitContext(IN  UINTN           CONST KeySize,
+                  IN  UINT8           CONST Key[static KeySize/8],
+                  OUT XTS_AES_CONTEXT      *Context)
+{
+  if((256 != KeySize && 512 != KeySize) || !Key || !Context)
+    return EFI_INVALID_PARAMETER;
+
+  AesInitContext(KeySize / 2, Key, &Context->DataKey);
+  AesInitContext(KeySize / 2, Key + KeySize / 16, &Context->TweakKey);
+
+  return EFI_SUCCESS;
+}
+
+/**
+ * XTS-AES encryption of a data unit with an expanded key.
+ *
+ * @param Context   Expanded key, as initialised by XtsAesInitContext.
+ * @param IV        Pointer to the tweak IV.
+ * @param Size      Size of the data (in bytes) - must be at least 16 bytes.
+ * @param Src       Pointer to the data.
+ * @param Dest      Pointer to the location to store the encrypted data (this
+ *                  may be the same as Src).
+ *
+ * @retval  EFI_SUCCESS             The data was encrypted.
+ * @retval  EFI_INVALID_PARAMETER   One or more of the parameters were invalid.
+ */
+EFI_STATUS
+EFIAPI
+XtsAesCipherUnit(IN  XTS_AES_CONTEXT CONST *Context,
+                 IN  UINT8           CONST  IV[static 16],
+                 IN  UINTN           CONST  Size,
+                 IN  UINT8           CONST  Src[static Size],
+                 OUT UINT8                  Dest[static Size])
+{
+  UINT8 Tweak[16];
+  UINTN FullBlockSize;
+
+  if(!Context || !IV || Size < 16 || !Src || !Dest)
+    return EFI_INVALID_PARAMETER;
+
+  FullBlockSize = Size - (Size % 16);
+  AesCipherBlock(&Context->TweakKey, IV, Tweak);
+  XtsBlocks(&Context->DataKey, TRUE, Tweak, FullBlockSize, Src, Dest);
+  // Handle partial block with ciphertext stealing
+  if(FullBlockSize < Size)
+    XtsStealEncrypt(&Context->DataKey, Tweak, Size % 16,
+                    Src + FullBlockSize, Dest + FullBlockSize - 16);
+
+  return EFI_SUCCESS;
+}
+
+/**
+ * XTS-AES decryption of a data unit with an expanded key.
+ *
+ * @param Context   Expanded key, as initialised by XtsAesInitContext.
+ * @param IV        Pointer to the tweak IV.
+ * @param Size      Size of the data (in bytes) - must be at least 16 bytes.
+ * @param Src       Pointer to the encrypted data.
+ * @param Dest      Pointer to the location to store the decrypted data (this
+ *                  may be the same as Src).
+ *
+ * @retval  EFI_SUCCESS             The data was decrypted.
+ * @retval  EFI_INVALID_PARAMETER   One or more of the parameters were invalid.
+ */
+EFI_STATUS
+EFIAPI
+InvXtsAesCipherUnit(IN  XTS_AES_CONTEXT CONST *Context,
+                    IN  UINT8           CONST  IV[static 16],
+                    IN  UINTN           CONST  Size,
+                    IN  UINT8           CONST  Src[static Size],
+                    OUT UINT8                  Dest[static Size])
+{
+  UINT8 Tweak[16];
+  UINTN FullBlockSize;
+
+  if(!Context || !IV || Size < 16 || !Src || !Dest)
+    return EFI_INVALID_PARAMETER;
+
+  FullBlockSize = Size % 16 ? Size - 16 - (Size % 16) : Size;
+  AesCipherBlock(&Context->TweakKey, IV, Tweak);
+  XtsBlocks(&Context->DataKey, FALSE, Tweak, FullBlockSize, Src, Dest);
+  // Handle partial block with ciphertext stealing
+  if(FullBlockSize < Size)
+    XtsStealDecrypt(&Context->DataKey, Tweak, Size % 16,
+                    Src + FullBlockSize, Dest + FullBlockSize);
+
+  return EFI_SUCCESS;
+}
+
+/**
+ * Encrypt or decrypt whole blocks from anywhere within a data unit.
+ *
+ * @param Context     Expanded key.
+ * @param Encrypt     TRUE to encrypt the data, FALSE to decrypt it.
+ * @param IV          Pointer to the tweak IV of the data unit.
+ * @param BlockIndex  Index of the first block within the data unit.
+ * @param Size        Size of the data - a non-zero multiple of 16 bytes.
+ * @param Src         Pointer to the data.
+ * @param Dest        Pointer to the location to store the result (this may be
+ *                    the same as Src).
+ *
+ * @retval  EFI_SUCCESS             The data was processed.
+ * @retval  EFI_INVALID_PARAMETER   One or more of the parameters were invalid.
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+XtsBlocksAt(IN  XTS_AES_CONTEXT CONST *Context,
+            IN  BOOLEAN                Encrypt,
+            IN  UINT8           CONST  IV[static 16],
+            IN  UINT64                 BlockIndex,
+            IN  UINTN                  Size,
+            IN  UINT8           CONST *Src,
+            OUT UINT8                 *Dest)
+{
+  UINT8 Tweak[16];
+
+  if(!Context || !IV || 0 == Size || Size % 16 || !Src || !Dest)
+    return EFI_INVALID_PARAMETER;
+
+  AesCipherBlock(&Context->TweakKey, IV, Tweak);
+  GfMulAlphaPower(Tweak, BlockIndex, Tweak);
+  XtsBlocks(&Context->DataKey, Encrypt, Tweak, Size, Src, Dest);
+
+  return EFI_SUCCESS;
+}
+
+/**
+ * XTS-AES encryption of whole blocks from anywhere within a data unit.
+ *
+ * @param Context     Expanded key, as initialised by XtsAesInitContext.
+ * @param IV          Pointer to the tweak IV of the data unit.
+ * @param BlockIndex  Index of the first block within the data unit.
+ * @param Size        Size of the data (in bytes) - must be a non-zero multiple
+ *                    of 16 bytes.
+ * @param Src         Pointer to the data.
+ * @param Dest        Pointer to the location to store the encrypted data (this
+ *                    may be the same as Src).
+ *
+ * @retval  EFI_SUCCESS             The data was encrypted.
+ * @retval  EFI_INVALID_PARAMETER   One or more of the parameters were invalid.
+ */
+EFI_STATUS
+EFIAPI
+XtsAesCipherBlocksAt(IN  XTS_AES_CONTEXT CONST *Context,
+                     IN  UINT8           CONST  IV[static 16],
+                     IN  UINT64          CONST  BlockIndex,
+                     IN  UINTN           CONST  Size,
+                     IN  UINT8           CONST  Src[static Size],
+                     OUT UINT8                  Dest[static Size])
+{
+  return XtsBlocksAt(Context, TRUE, IV, BlockIndex, Size, Src, Dest);
+}
+
+/**
+ * XTS-AES decryption of whole blocks from anywhere within a data unit.
+ *
+ * @param Context     Expanded key, as initialised by XtsAesInitContext.
+ * @param IV          Pointer to the tweak IV of the data unit.
+ * @param BlockIndex  Index of the first block within the data unit.
+ * @param Size        Size of the data (in bytes) - must be a non-zero multiple
+ *                    of 16 bytes.
+ * @param Src         Pointer to the encrypted data.
+ * @param Dest        Pointer to the location to store the decrypted data (this
+ *                    may be the same as Src).
+ *
+ * @retval  EFI_SUCCESS             The data was decrypted.
+ * @retval  EFI_INVALID_PARAMETER   One or more of the parameters were invalid.
+ */
+EFI_STATUS
+EFIAPI
+InvXtsAesCipherBlocksAt(IN  XTS_AES_CONTEXT CONST *Context,
+                        IN  UINT8           CONST  IV[static 16],
+                        IN  UINT64          CONST  BlockIndex,
+                        IN  UINTN           CONST  Size,
+                        IN  UINT8           CONST  Src[static Size],
+                        OUT UINT8                  Dest[static Size])
+{
+  return XtsBlocksAt(Context, FALSE, IV, BlockIndex, Size, Src, Dest);
 }
 
 /**
@@ -101,44 +643,16 @@ XtsAesCipher(IN  UINTN CONST KeySize,
              IN  UINT8 CONST Src[static Size],
              OUT UINT8       Dest[static Size])
 {
-  UINT8 Buffer[16];
-  UINT8 Tweak[16];
-  UINTN FullBlockSize;
-  UINTN PartBlockSize;
-  UINTN Idx;
-  UINTN Nk;
-
-  if((256 != KeySize && 512 != KeySize) ||
-     !Key || !IV || Size < 16 || !Src || !Dest)
-    return EFI_INVALID_PARAMETER;
+  XTS_AES_CONTEXT Context;
+  EFI_STATUS      Status;
 
-  FullBlockSize = Size - (Size % 16);
-  Nk = KeySize / 64;
-  Cipher(Nk, IV, Key + KeySize / 16, Tweak);
-  for(Idx = 0; Idx < FullBlockSize; Idx += 16) {
-    XorBlock(Src + Idx, Tweak, Buffer);
-    Cipher(Nk, Buffer, Key, Buffer);
-    XorBlock(Buffer, Tweak, Dest + Idx);
-    GfMul128(Tweak, Tweak);
-  }
-  // Handle partial block with ciphertext stealing
-  if(Idx < Size) {
-    PartBlockSize = Size % 16;
-    // Reamining plaintext
-    CopyMem(Buffer, Src + Idx, PartBlockSize);
-    // Move final block into place
-    CopyMem(Dest + Idx, Dest + Idx - 16, PartBlockSize);
-    // Stolen ciphertext
-    CopyMem(Buffer + PartBlockSize,
-            Dest + Idx - 16 + PartBlockSize,
-            16 - PartBlockSize);
-    // Encrypt penultimate block
-    XorBlock(Buffer, Tweak, Buffer);
-    Cipher(Nk, Buffer, Key, Buffer);
-    XorBlock(Buffer, Tweak, Dest + Idx - 16);
+  Status = XtsAesInitContext(KeySize, Key, &Context);
+  if(!EFI_ERROR(Status)) {
+    Status = XtsAesCipherUnit(&Context, IV, Size, Src, Dest);
+    ZeroMem(&Context, sizeof(Context));
   }
 
-  return EFI_SUCCESS;
+  return Status;
 }
 
 /**
@@ -166,51 +680,295 @@ InvXtsAesCipher(IN  UINTN CONST KeySize,
                 IN  UINT8 CONST Src[static Size],
                 OUT UINT8       Dest[static Size])
 {
-  UINT8 Buffer[16];
-  UINT8 Tweak[16];
-  UINTN FullBlockSize;
-  UINTN PartBlockSize;
-  UINTN Idx;
-  UINTN Nk;
+  XTS_AES_CONTEXT Context;
+  EFI_STATUS      Status;
+
+  Status = XtsAesInitContext(KeySize, Key, &Context);
+  if(!EFI_ERROR(Status)) {
+    Status = InvXtsAesCipherUnit(&Context, IV, Size, Src, Dest);
+    ZeroMem(&Context, sizeof(Context));
+  }
+
+  return Status;
+}
+
+/**
+ * Encrypt or decrypt a run of consecutive data units.
+ *
+ * The initial tweaks of up to XTS_BATCH_BLOCKS data units are encrypted
+ * together, then each data unit is processed with XtsBlocks.
+ *
+ * @param KeySize       Size of the key in bits - must be 256 or 512.
+ * @param Key           Pointer to the key.
+ * @param DataUnit      Number of the first data unit.
+ * @param DataUnitSize  Size of each data unit in bytes - must be a non-zero
+ *                      multiple of 16 bytes.
+ * @param Size          Size of the data - must be a non-zero multiple of
+ *                      DataUnitSize.
+ * @param Src           Pointer to the data.
+ * @param Dest          Pointer to the location to store the result (this may
+ *                      be the same as Src).
+ * @param Encrypt       TRUE to encrypt the data, FALSE to decrypt it.
+ *
+ * @retval  EFI_SUCCESS             The data was processed.
+ * @retval  EFI_INVALID_PARAMETER   One or more of the parameters were invalid.
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+XtsDataUnits(IN  UINTN  CONST  KeySize,
+             IN  UINT8  CONST *Key,
+             IN  UINT64        DataUnit,
+             IN  UINTN  CONST  DataUnitSize,
+             IN  UINTN         Size,
+             IN  UINT8  CONST *Src,
+             OUT UINT8        *Dest,
+             IN  BOOLEAN       Encrypt)
+{
+  XTS_AES_CONTEXT Context;
+  XTS_WORD        Tweaks[XTS_BATCH_BLOCKS][XTS_WORDS];
+  UINTN           Units;
+  UINTN           Idx;
 
-  if((256 != KeySize && 512 != KeySize) ||
-     !Key || !IV || Size < 16 || !Src || !Dest)
+  if((256 != KeySize && 512 != KeySize) || !Key ||
+     0 == DataUnitSize || 0 != DataUnitSize % 16 ||
+     0 == Size || 0 != Size % DataUnitSize || !Src || !Dest)
     return EFI_INVALID_PARAMETER;
 
-  FullBlockSize = Size % 16 ? Size - 16 - (Size % 16) : Size;
-  Nk = KeySize / 64;
-
-  Cipher(Nk, IV, Key + KeySize / 16, Tweak);
-  for(Idx = 0; Idx < FullBlockSize; Idx += 16) {
-    XorBlock(Src + Idx, Tweak, Buffer);
-    InvCipher(Nk, Buffer, Key, Buffer);
-    XorBlock(Buffer, Tweak, Dest + Idx);
-    GfMul128(Tweak, Tweak);
+  XtsAesInitContext(KeySize, Key, &Context);
+  while(Size > 0) {
+    Units = MIN(Size / DataUnitSize, XTS_BATCH_BLOCKS);
+    // The tweak IV is the data unit number as a 128-bit little-endian value
+    for(Idx = 0; Idx < Units; Idx++) {
+      WriteUnaligned64((UINT64*)Tweaks[Idx], DataUnit + Idx);
+      WriteUnaligned64((UINT64*)((UINT8*)Tweaks[Idx] + 8), 0);
+    }
+    AesCipherBlocks(&Context.TweakKey, Units, (UINT8*)Tweaks, (UINT8*)Tweaks);
+    for(Idx = 0; Idx < Units; Idx++) {
+      XtsBlocks(&Context.DataKey, Encrypt, (UINT8*)Tweaks[Idx], DataUnitSize,
+                Src, Dest);
+      Src += DataUnitSize;
+      Dest += DataUnitSize;
+    }
+    DataUnit += Units;
+    Size -= Units * DataUnitSize;
   }
-  // Handle partial block with ciphertext stealing
-  if(Idx < Size) {
-    UINT8 Tweak2[16];
-    // With partial final block, penultimate block uses next tweak
-    GfMul128(Tweak, Tweak2);
-    XorBlock(Src + Idx, Tweak2, Buffer);
-    InvCipher(Nk, Buffer, Key, Buffer);
-    XorBlock(Buffer, Tweak2, Dest + Idx);
-    // Shuffle data
-    PartBlockSize = Size % 16;
-    Idx += 16;
-    // Reamining ciphertext
-    CopyMem(Buffer, Src + Idx, PartBlockSize);
-    // Stolen ciphertext
-    CopyMem(Buffer + PartBlockSize,
-            Dest + Idx - 16 + PartBlockSize,
-            16 - PartBlockSize);
-    // Move final block into place
-    CopyMem(Dest + Idx, Dest + Idx - 16, PartBlockSize);
-    // Decrypt penultimate block
-    XorBlock(Buffer, Tweak, Buffer);
-    InvCipher(Nk, Buffer, Key, Buffer);
-    XorBlock(Buffer, Tweak, Dest + Idx - 16);
+  ZeroMem(Tweaks, sizeof(Tweaks));
+  ZeroMem(&Context, sizeof(Context));
+
+  return EFI_SUCCESS;
+}
+
+/**
+ * XTS-AES encryption of consecutive data units (e.g. disk sectors).
+ *
+ * @param KeySize       Size of the key in bits - must be 256 or 512.
+ * @param Key           Pointer to the key - the first half is used to encrypt
+ *                      the data, while the second half is used to encrypt the
+ *                      initial tweaks.
+ * @param DataUnit      Number of the first data unit.  Each following data
+ *                      unit has the next number.
+ * @param DataUnitSize  Size of each data unit in bytes, typically 512 or 4096 -
+ *                      must be a non-zero multiple of 16 bytes.
+ * @param Size          Size of the data (in bytes) - must be a non-zero
+ *                      multiple of DataUnitSize.
+ * @param Src           Pointer to the data.
+ * @param Dest          Pointer to the location to store the encrypted data
+ *                      (this may be the same as Src).
+ *
+ * @retval  EFI_SUCCESS             The data was encrypted.
+ * @retval  EFI_INVALID_PARAMETER   One or more of the parameters were invalid.
+ */
+EFI_STATUS
+EFIAPI
+XtsAesCipherDataUnits(IN  UINTN  CONST KeySize,
+                      IN  UINT8  CONST Key[static KeySize/8],
+                      IN  UINT64 CONST DataUnit,
+                      IN  UINTN  CONST DataUnitSize,
+                      IN  UINTN  CONST Size,
+                      IN  UINT8  CONST Src[static Size],
+                      OUT UINT8        Dest[static Size])
+{
+  return XtsDataUnits(KeySize, Key, DataUnit, DataUnitSize,
+                      Size, Src, Dest, TRUE);
+}
+
+/**
+ * XTS-AES decryption of consecutive data units (e.g. disk sectors).
+ *
+ * @param KeySize       Size of the key in bits - must be 256 or 512.
+ * @param Key           Pointer to the key - the first half is used to encrypt
+ *                      the data, while the second half is used to encrypt the
+ *                      initial tweaks.
+ * @param DataUnit      Number of the first data unit.  Each following data
+ *                      unit has the next number.
+ * @param DataUnitSize  Size of each data unit in bytes, typically 512 or 4096 -
+ *                      must be a non-zero multiple of 16 bytes.
+ * @param Size          Size of the data (in bytes) - must be a non-zero
+ *                      multiple of DataUnitSize.
+ * @param Src           Pointer to the encrypted data.
+ * @param Dest          Pointer to the location to store the decrypted data
+ *                      (this may be the same as Src).
+ *
+ * @retval  EFI_SUCCESS             The data was decrypted.
+ * @retval  EFI_INVALID_PARAMETER   One or more of the parameters were invalid.
+ */
+EFI_STATUS
+EFIAPI
+InvXtsAesCipherDataUnits(IN  UINTN  CONST KeySize,
+                         IN  UINT8  CONST Key[static KeySize/8],
+                         IN  UINT64 CONST DataUnit,
+                         IN  UINTN  CONST DataUnitSize,
+                         IN  UINTN  CONST Size,
+                         IN  UINT8  CONST Src[static Size],
+                         OUT UINT8        Dest[static Size])
+{
+  return XtsDataUnits(KeySize, Key, DataUnit, DataUnitSize,
+                      Size, Src, Dest, FALSE);
+}
+
+/**
+ * Start encrypting or decrypting a single data unit in pieces.
+ *
+ * @param Stream    The stream context to initialise.
+ * @param Context   Expanded key, as initialised by XtsAesInitContext.  The
+ *                  stream refers to this, rather than taking a copy, so it
+ *                  must not be changed or freed until the stream is finished.
+ * @param IV        Pointer to the tweak IV.
+ * @param Encrypt   TRUE to encrypt the data, FALSE to decrypt it.
+ *
+ * @retval  EFI_SUCCESS             The stream was initialised.
+ * @retval  EFI_INVALID_PARAMETER   One or more of the parameters were invalid.
+ */
+EFI_STATUS
+EFIAPI
+XtsAesStreamInit(OUT XTS_AES_STREAM        *Stream,
+                 IN  XTS_AES_CONTEXT CONST *Context,
+                 IN  UINT8           CONST  IV[static 16],
+                 IN  BOOLEAN                Encrypt)
+{
+  if(!Stream || !Context || !IV)
+    return EFI_INVALID_PARAMETER;
+
+  Stream->Key = Context;
+  AesCipherBlock(&Context->TweakKey, IV, Stream->Tweak);
+  Stream->Encrypt = Encrypt;
+  Stream->Buffered = 0;
+
+  return EFI_SUCCESS;
+}
+
+/**
+ * Encrypt or decrypt the next piece of a data unit.
+ *
+ * The last 16 to 31 bytes seen are held back in the stream, as they may be
+ * needed for ciphertext stealing once the end of the data is known, so the
+ * output lags the input by up to 31 bytes.
+ *
+ * @param Stream    The stream context.
+ * @param Size      Size of the piece (in bytes) - this can be any size.
+ * @param Src       Pointer to the piece of data.
+ * @param Dest      Where to store the processed data - up to Size + 15 bytes
+ *                  are written.  This may overlap Src as long as it does not
+ *                  start after it, so a buffer can be processed in place by
+ *                  passing the buffer offset by the total size processed so
+ *                  far.
+ * @param Processed On return, the number of bytes stored at Dest.
+ *
+ * @retval  EFI_SUCCESS             The data was processed.
+ * @retval  EFI_INVALID_PARAMETER   One or more of the parameters were invalid.
+ */
+EFI_STATUS
+EFIAPI
+XtsAesStreamUpdate(IN OUT XTS_AES_STREAM       *Stream,
+                   IN     UINTN                 Size,
+                   IN     UINT8          CONST *Src,
+                   OUT    UINT8                *Dest,
+                   OUT    UINTN                *Processed)
+{
+  UINTN ToProcess;
+  UINTN Copy;
+
+  if(!Stream || (Size && !Src) || !Dest || !Processed)
+    return EFI_INVALID_PARAMETER;
+
+  // Process whole blocks, leaving 16 to 31 bytes for XtsAesStreamFinal
+  ToProcess = Stream->Buffered + Size;
+  ToProcess = ToProcess < 32 ? 0 : (ToProcess - 16) & ~(UINTN)15;
+  *Processed = ToProcess;
+
+  // Start with any blocks which begin in the held back data
+  while(ToProcess > 0 && Stream->Buffered > 0) {
+    if(Stream->Buffered < 16) {
+      Copy = 16 - Stream->Buffered;
+      CopyMem(Stream->Buffer + Stream->Buffered, Src, Copy);
+      Stream->Buffered += Copy;
+      Src += Copy;
+      Size -= Copy;
+    }
+    XtsBlocks(&Stream->Key->DataKey, Stream->Encrypt, Stream->Tweak,
+              16, Stream->Buffer, Dest);
+    CopyMem(Stream->Buffer, Stream->Buffer + 16, Stream->Buffered - 16);
+    Stream->Buffered -= 16;
+    ToProcess -= 16;
+    Dest += 16;
   }
 
+  // The rest comes straight from Src
+  XtsBlocks(&Stream->Key->DataKey, Stream->Encrypt, Stream->Tweak,
+            ToProcess, Src, Dest);
+  CopyMem(Stream->Buffer + Stream->Buffered, Src + ToProcess, Size - ToProcess);
+  Stream->Buffered += Size - ToProcess;
+
   return EFI_SUCCESS;
 }
+
+/**
+ * Finish encrypting or decrypting a data unit.
+ *
+ * This processes the data held back by XtsAesStreamUpdate, using ciphertext
+ * stealing if the size of the data was not a multiple of 16 bytes, and then
+ * clears the stream context.
+ *
+ * @param Stream    The stream context.
+ * @param Dest      Where to store the rest of the data - up to 31 bytes.
+ * @param Processed On return, the number of bytes stored at Dest.
+ *
+ * @retval  EFI_SUCCESS             The data was processed.
+ * @retval  EFI_INVALID_PARAMETER   One or more of the parameters were invalid,
+ *                                  or the data was less than 16 bytes in total.
+ */
+EFI_STATUS
+EFIAPI
+XtsAesStreamFinal(IN OUT XTS_AES_STREAM *Stream,
+                  OUT    UINT8          *Dest,
+                  OUT    UINTN          *Processed)
+{
+  EFI_STATUS Status;
+  UINTN      PartBlockSize;
+
+  if(!Stream || !Dest || !Processed)
+    return EFI_INVALID_PARAMETER;
+
+  Status = EFI_INVALID_PARAMETER;
+  *Processed = 0;
+  if(Stream->Buffered >= 16) {
+    PartBlockSize = Stream->Buffered - 16;
+    if(Stream->Encrypt || 0 == PartBlockSize)
+      XtsBlocks(&Stream->Key->DataKey, Stream->Encrypt, Stream->Tweak,
+                16, Stream->Buffer, Dest);
+    if(PartBlockSize > 0) {
+      if(Stream->Encrypt)
+        XtsStealEncrypt(&Stream->Key->DataKey, Stream->Tweak, PartBlockSize,
+                        Stream->Buffer + 16, Dest);
+      else
+        XtsStealDecrypt(&Stream->Key->DataKey, Stream->Tweak, PartBlockSize,
+                        Stream->Buffer, Dest);
+    }
+    *Processed = Stream->Buffered;
+    Status = EFI_SUCCESS;
+  }
+  ZeroMem(Stream, sizeof(*Stream));
+
+  return Status;
+}
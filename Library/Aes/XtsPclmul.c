@@ -0,0 +1,131 @@
+/**
+ * Copyright (c) 2015, baskingshark
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Multiplication in GF(2^128) for XTS-AES using the PCLMULQDQ carry-less
+ * multiply instruction.
+ *
+ * XTS-AES holds elements of the field as 128-bit little-endian values with
+ * bit 0 as the coefficient of x^0, which is the order PCLMULQDQ works in, so
+ * unlike GCM no bit reflection is needed.
+ *
+ * It must only be used once XtsPclmulSupported has confirmed that the
+ * processor (and the firmware) support the instruction.
+ */
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <wmmintrin.h>
+#include <emmintrin.h>
+#include "AesEngine.h"
+
+/**
+ * The rest of the firmware may be built without SSE, so the functions using
+ * the intrinsics have to enable the instructions individually.
+ */
+#if defined(__GNUC__)
+#define PCLMUL_TARGET __attribute__((target("sse2,pclmul")))
+#else
+#define PCLMUL_TARGET
+#endif
+
+/**
+ * CPUID.01H:ECX.PCLMULQDQ[bit 1] and CPUID.01H:EDX.SSE2[bit 26]
+ */
+#define CPUID_ECX_PCLMULQDQ BIT1
+#define CPUID_EDX_SSE2      BIT26
+
+/**
+ * CR4.OSFXSR[bit 9] - SSE instructions are enabled.
+ */
+#define CR4_OSFXSR          BIT9
+
+/**
+ * Check whether XtsPclmulMul can be used.
+ *
+ * @return A BOOLEAN indicating whether the processor supports PCLMULQDQ and
+ *         SSE has been enabled.
+ */
+BOOLEAN
+EFIAPI
+XtsPclmulSupported(VOID)
+{
+  UINT32 RegEcx;
+  UINT32 RegEdx;
+
+  AsmCpuid(1, NULL, NULL, &RegEcx, &RegEdx);
+  if(!(RegEcx & CPUID_ECX_PCLMULQDQ) || !(RegEdx & CPUID_EDX_SSE2))
+    return FALSE;
+  // X64 firmware always runs with SSE enabled, but IA32 firmware might not.
+  return (AsmReadCr4() & CR4_OSFXSR) != 0;
+}
+
+/**
+ * Multiply two elements of GF(2^128) modulo x^128 + x^7 + x^2 + x + 1.
+ *
+ * The 256-bit product is formed from four 64x64 carry-less multiplies.  The
+ * upper half H is then reduced using x^128 = x^7 + x^2 + x + 1: H times the
+ * low terms of the polynomial is at most 135 bits, so the few bits which
+ * spill past x^127 are folded back in once more.
+ *
+ * @param A     The first element, in little-endian format
+ * @param B     The second element, in little-endian format
+ * @param Out   Where to store the product (may be the same as A or B)
+ */
+VOID
+EFIAPI
+PCLMUL_TARGET
+XtsPclmulMul(IN  UINT8 CONST A[16],
+             IN  UINT8 CONST B[16],
+             OUT UINT8       Out[16]) {
+  __m128i X;
+  __m128i Y;
+  __m128i Poly;
+  __m128i Lo;
+  __m128i Mid;
+  __m128i Hi;
+  __m128i Spill;
+
+  X = _mm_loadu_si128((__m128i CONST*)A);
+  Y = _mm_loadu_si128((__m128i CONST*)B);
+  Poly = _mm_cvtsi32_si128(0x87);
+
+  Lo  = _mm_clmulepi64_si128(X, Y, 0x00);
+  Hi  = _mm_clmulepi64_si128(X, Y, 0x11);
+  Mid = _mm_xor_si128(_mm_clmulepi64_si128(X, Y, 0x01),
+                      _mm_clmulepi64_si128(X, Y, 0x10));
+  Lo  = _mm_xor_si128(Lo, _mm_slli_si128(Mid, 8));
+  Hi  = _mm_xor_si128(Hi, _mm_srli_si128(Mid, 8));
+
+  // The top word of H lands at x^64 once multiplied, so part of it spills
+  Spill = _mm_clmulepi64_si128(Hi, Poly, 0x01);
+  Lo = _mm_xor_si128(Lo, _mm_clmulepi64_si128(Hi, Poly, 0x00));
+  Lo = _mm_xor_si128(Lo, _mm_slli_si128(Spill, 8));
+  Lo = _mm_xor_si128(Lo, _mm_clmulepi64_si128(_mm_srli_si128(Spill, 8),
+                                              Poly, 0x00));
+
+  _mm_storeu_si128((__m128i*)Out, Lo);
+}